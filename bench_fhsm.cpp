@@ -0,0 +1,523 @@
+// The cost of the basic operations of kv::fhsm machines: signal dispatch at
+// each depth of the hierarchy (handled and unhandled), guarded, unguarded and
+// blocked transitions, transitions through a deep least common ancestor,
+// ticks, setup, signaling, broadcasting or publishing to fleets of 10^3 to
+// 10^6 machines, and four independent aspects of one actor as four machines
+// or as four orthogonal regions of one.
+//
+//    g++ -std=c++14 -O2 -I. bench_fhsm.cpp -o bench_fhsm
+//    ./bench_fhsm [name filter]
+//
+// Prints one CSV line per benchmark: the best of several runs in nanoseconds
+// per operation, and the heap allocations per operation (global operator new
+// is replaced to count them). Names are stable, so the output of two builds
+// can be compared line by line.
+
+#include "kv/fhsm/StateMachine.h"
+#include "kv/fhsm/SharedStateMachine.h"
+#include "kv/fhsm/MachineFleet.h"
+#include "kv/fhsm/OrthogonalStateMachine.h"
+#include "kv/fhsm/RelocatableStateMachine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+size_t allocations = 0;
+}
+
+// Kept out of line so the compiler does not pair the inlined malloc/free with new/delete expressions.
+#if defined(__GNUC__)
+#define FHSM_NOINLINE __attribute__((noinline))
+#else
+#define FHSM_NOINLINE
+#endif
+
+FHSM_NOINLINE void* operator new(size_t size) {
+   ++allocations;
+   if (void* p = std::malloc(size ? size : 1)) {
+      return p;
+   }
+   throw std::bad_alloc();
+}
+FHSM_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+FHSM_NOINLINE void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+using namespace kv::fhsm;
+
+namespace {
+
+const char* filter = nullptr;
+volatile size_t sink = 0; // keeps the work observable
+
+// Run f(ops) with batches doubling until one takes long enough to time, then
+// report the best of RUNS such batches.
+template<class F>
+void Measure(const char* name, F f) {
+   if (filter && std::strstr(name, filter) == nullptr) {
+      return;
+   }
+   using Clock = std::chrono::steady_clock;
+   const std::chrono::nanoseconds enough = std::chrono::milliseconds(20);
+   const int RUNS = 5;
+   size_t ops = 1;
+   for (;;) {
+      const auto start = Clock::now();
+      f(ops);
+      if (Clock::now() - start >= enough || ops >= (size_t(1) << 30)) {
+         break;
+      }
+      ops *= 2;
+   }
+   double best = 0;
+   const size_t allocationsBefore = allocations;
+   for (int run=0; run<RUNS; run++) {
+      const auto start = Clock::now();
+      f(ops);
+      const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+      const double perOp = elapsed.count() / ops;
+      best = (run == 0) ? perOp : std::min(best, perOp);
+   }
+   const double allocationsPerOp = double(allocations - allocationsBefore) / (double(ops) * RUNS);
+   std::printf("%s,%zu,%.2f,%.3f\n", name, ops, best, allocationsPerOp);
+}
+
+// A chain of eight states, each the parent of the next. The root handles
+// PING and has the only tick handler (bound as a member function pointer,
+// or as a template argument); nothing handles IGNORED.
+enum class ChainStates  { L0, L1, L2, L3, L4, L5, L6, L7 };
+enum class ChainSignals { PING, IGNORED };
+
+class Chain {
+public:
+   using Machine = StateMachine<Chain, ChainStates, ChainStates::L0, ChainStates::L7,
+                                ChainSignals, ChainSignals::PING, ChainSignals::IGNORED>;
+   explicit Chain(ChainStates initial, bool bound=false) : m_hsm(*this) {
+      if (bound) {
+         m_hsm.DefineState(ChainStates::L0)
+            .SetNoParent()
+            .SetOnTick<&Chain::Count>()
+            .ForSignal(ChainSignals::PING).Do<&Chain::Count>();
+      } else {
+         m_hsm.DefineState(ChainStates::L0)
+            .SetNoParent()
+            .SetOnTick(&Chain::Count)
+            .ForSignal(ChainSignals::PING).Do(&Chain::Count);
+      }
+      for (int level=1; level<=7; level++) {
+         m_hsm.DefineState(static_cast<ChainStates>(level)).SetParent(static_cast<ChainStates>(level - 1));
+      }
+      m_hsm.ConcludeSetupAndSetInitialState(initial);
+   }
+   void Count() { ++count; }
+
+   Machine m_hsm;
+   size_t count = 0;
+};
+
+// Two branches of four states under a root, with enter and exit handlers
+// on every state (bound as member function pointers, or as template
+// arguments): FLIP and GUARDED swap the tops of the branches (A1, B1),
+// BLOCKED is refused by its guard and DEEP swaps their leaves (A4, B4).
+enum class TreeStates  { ROOT, A1, A2, A3, A4, B1, B2, B3, B4 };
+enum class TreeSignals { FLIP, GUARDED, BLOCKED, DEEP };
+
+template<bool dense, bool bound=false>
+class Tree {
+public:
+   using DenseMachine = StateMachine<Tree, TreeStates, TreeStates::ROOT, TreeStates::B4,
+                                     TreeSignals, TreeSignals::FLIP, TreeSignals::DEEP>;
+   using SparseMachine = StateMachine<Tree, TreeStates, TreeStates::ROOT, TreeStates::B4, TreeSignals>;
+   using Machine = typename std::conditional<dense, DenseMachine, SparseMachine>::type;
+   using Action = typename Machine::BoundState::Action;
+
+   explicit Tree(TreeStates initial) : m_hsm(*this) {
+      m_hsm.DefineState(TreeStates::ROOT)
+         .SetNoParent()
+         .SetOnEnter(Counter())
+         .SetOnExit(Counter());
+      DefineBranch(TreeStates::A1, TreeStates::B1, TreeStates::B4);
+      DefineBranch(TreeStates::B1, TreeStates::A1, TreeStates::A4);
+      m_hsm.ConcludeSetupAndSetInitialState(initial);
+   }
+   void Count() { ++count; }
+   bool Yes() const { return true; }
+   bool No() const { return false; }
+   static Action Counter() { return bound ? Action::template Method<&Tree::Count>() : Action(&Tree::Count); }
+
+   Machine m_hsm;
+   size_t count = 0;
+
+private:
+   void DefineBranch(TreeStates top, TreeStates otherTop, TreeStates otherLeaf) {
+      m_hsm.DefineState(top)
+         .SetParent(TreeStates::ROOT)
+         .SetOnEnter(Counter())
+         .SetOnExit(Counter())
+         .ForSignal(TreeSignals::FLIP).GoTo(otherTop)
+         .ForSignal(TreeSignals::GUARDED).GoToIf(otherTop, &Tree::Yes)
+         .ForSignal(TreeSignals::BLOCKED).GoToIf(otherTop, &Tree::No);
+      auto parent = top;
+      for (int level=1; level<=3; level++) {
+         auto state = static_cast<TreeStates>(static_cast<int>(top) + level);
+         auto& defined = m_hsm.DefineState(state)
+            .SetParent(parent)
+            .SetOnEnter(Counter())
+            .SetOnExit(Counter());
+         if (level == 3) {
+            defined.ForSignal(TreeSignals::DEEP).GoTo(otherLeaf);
+         }
+         parent = state;
+      }
+   }
+};
+
+// The smallest actor for fleets: two states and a relocatable machine, so
+// a million of them sit in one vector.
+enum class ToggleStates  { OFF, ON };
+enum class ToggleSignals { FLIP };
+
+class Toggle {
+public:
+   using Definition = Blueprint<Toggle, ToggleStates, ToggleStates::OFF, ToggleStates::ON,
+                                ToggleSignals, ToggleSignals::FLIP, ToggleSignals::FLIP>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(ToggleStates::OFF)
+            .SetNoParent()
+            .ForSignal(ToggleSignals::FLIP).GoTo(ToggleStates::ON);
+         b.DefineState(ToggleStates::ON)
+            .SetNoParent()
+            .SetOnEnter(&Toggle::Count)
+            .ForSignal(ToggleSignals::FLIP).GoTo(ToggleStates::OFF);
+         b.ConcludeSetupAndSetInitialState(ToggleStates::OFF);
+      });
+      return blueprint;
+   }
+   Toggle() : m_hsm(Shared()) {
+      m_hsm.Start(*this);
+   }
+   void Flip() { m_hsm.Signal(*this, ToggleSignals::FLIP); }
+   void Count() { ++count; }
+
+   RelocatableStateMachine<Definition> m_hsm;
+   std::uint32_t count = 0;
+};
+
+// An actor whose machine runs no handlers, so a broadcast never dispatches.
+enum class SwitchStates  { OFF, ON };
+enum class SwitchSignals { FLIP };
+
+class Switch {
+public:
+   using Definition = Blueprint<Switch, SwitchStates, SwitchStates::OFF, SwitchStates::ON,
+                                SwitchSignals, SwitchSignals::FLIP, SwitchSignals::FLIP>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(SwitchStates::OFF)
+            .SetNoParent()
+            .ForSignal(SwitchSignals::FLIP).GoTo(SwitchStates::ON);
+         b.DefineState(SwitchStates::ON)
+            .SetNoParent()
+            .ForSignal(SwitchSignals::FLIP).GoTo(SwitchStates::OFF);
+         b.ConcludeSetupAndSetInitialState(SwitchStates::OFF);
+      });
+      return blueprint;
+   }
+};
+
+// An actor that cares about ALARM only while ARMED, which few of them are.
+enum class SensorStates  { IDLE, ARMED };
+enum class SensorSignals { ARM, ALARM };
+
+class Sensor {
+public:
+   using Definition = Blueprint<Sensor, SensorStates, SensorStates::IDLE, SensorStates::ARMED,
+                                SensorSignals, SensorSignals::ARM, SensorSignals::ALARM>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(SensorStates::IDLE)
+            .SetNoParent()
+            .ForSignal(SensorSignals::ARM).GoTo(SensorStates::ARMED);
+         b.DefineState(SensorStates::ARMED)
+            .SetNoParent()
+            .ForSignal(SensorSignals::ALARM).Do(&Sensor::Count);
+         b.ConcludeSetupAndSetInitialState(SensorStates::IDLE);
+      });
+      return blueprint;
+   }
+   void Count() { ++count; }
+
+   std::uint32_t count = 0;
+};
+
+// Four independent aspects of one actor, each a tree of its own (the root,
+// IDLE and BUSY), and a signal per aspect that only that aspect handles.
+enum class AspectStates  { A, A_IDLE, A_BUSY, B, B_IDLE, B_BUSY, C, C_IDLE, C_BUSY, D, D_IDLE, D_BUSY };
+enum class AspectSignals { EVENT_A, EVENT_B, EVENT_C, EVENT_D };
+
+class Aspects {
+public:
+   using Definition = Blueprint<Aspects, AspectStates, AspectStates::A, AspectStates::D_BUSY,
+                                AspectSignals, AspectSignals::EVENT_A, AspectSignals::EVENT_D>;
+   static void Define(Definition& b, int initial) {
+      for (int a=0; a<4; a++) {
+         const auto root = static_cast<AspectStates>(3 * a);
+         const auto idle = static_cast<AspectStates>(3 * a + 1);
+         const auto busy = static_cast<AspectStates>(3 * a + 2);
+         const auto event = static_cast<AspectSignals>(a);
+         b.DefineState(root)
+            .SetNoParent();
+         b.DefineState(idle)
+            .SetParent(root)
+            .ForSignal(event).GoTo(busy);
+         b.DefineState(busy)
+            .SetParent(root)
+            .SetOnEnter(&Aspects::Count)
+            .ForSignal(event).GoTo(idle);
+      }
+      b.ConcludeSetupAndSetInitialState(static_cast<AspectStates>(3 * initial + 1));
+   }
+   void Count() { ++count; }
+
+   std::uint32_t count = 0;
+};
+
+void DispatchBenchmarks() {
+   for (int depth=0; depth<=7; depth++) {
+      for (auto signal : { ChainSignals::PING, ChainSignals::IGNORED }) {
+         Chain chain(static_cast<ChainStates>(depth));
+         const std::string name = std::string(signal == ChainSignals::PING ? "dispatch/handled_at_root/depth_" : "dispatch/unhandled/depth_")
+                                + std::to_string(depth);
+         Measure(name.c_str(), [&](size_t ops) {
+            for (size_t i=0; i<ops; i++) {
+               chain.m_hsm.Signal(signal);
+            }
+            sink = chain.count;
+         });
+      }
+   }
+   Chain bound(ChainStates::L7, true);
+   Measure("dispatch/bound_at_root/depth_7", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         bound.m_hsm.Signal(ChainSignals::PING);
+      }
+      sink = bound.count;
+   });
+   Tree<false> sparse(TreeStates::A1);
+   Measure("dispatch/sparse_signals/blocked", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         sparse.m_hsm.Signal(TreeSignals::BLOCKED);
+      }
+      sink = sparse.count;
+   });
+}
+
+void TransitionBenchmarks() {
+   const struct {
+      const char* name;
+      TreeStates initial;
+      TreeSignals signal;
+   } cases[] = {
+      { "transition/unguarded", TreeStates::A1, TreeSignals::FLIP },
+      { "transition/guarded", TreeStates::A1, TreeSignals::GUARDED },
+      { "transition/guard_blocked", TreeStates::A1, TreeSignals::BLOCKED },
+      { "transition/deep_lca", TreeStates::A4, TreeSignals::DEEP },
+   };
+   for (auto& c : cases) {
+      Tree<true> tree(c.initial);
+      Measure(c.name, [&](size_t ops) {
+         for (size_t i=0; i<ops; i++) {
+            tree.m_hsm.Signal(c.signal);
+         }
+         sink = tree.count;
+      });
+   }
+   Tree<true, true> bound(TreeStates::A4);
+   Measure("transition/deep_lca/bound_handlers", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         bound.m_hsm.Signal(TreeSignals::DEEP);
+      }
+      sink = bound.count;
+   });
+}
+
+void TickBenchmarks() {
+   Chain own(ChainStates::L0);
+   Measure("tick/own_handler", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         own.m_hsm.Tick();
+      }
+      sink = own.count;
+   });
+   Chain inherited(ChainStates::L7);
+   Measure("tick/inherited_handler/depth_7", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         inherited.m_hsm.Tick();
+      }
+      sink = inherited.count;
+   });
+   Chain bound(ChainStates::L0, true);
+   Measure("tick/bound_handler", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         bound.m_hsm.Tick();
+      }
+      sink = bound.count;
+   });
+   Tree<true> none(TreeStates::A4);
+   Measure("tick/no_handler", [&](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         none.m_hsm.Tick();
+      }
+      sink = none.count;
+   });
+}
+
+void SetupBenchmarks() {
+   Measure("setup/state_machine/dense", [](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         std::unique_ptr<Tree<true>> tree(new Tree<true>(TreeStates::A4));
+         sink = tree->count;
+      }
+   });
+   Measure("setup/state_machine/sparse", [](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         std::unique_ptr<Tree<false>> tree(new Tree<false>(TreeStates::A4));
+         sink = tree->count;
+      }
+   });
+   Toggle::Shared();
+   Measure("setup/relocatable_machine", [](size_t ops) {
+      for (size_t i=0; i<ops; i++) {
+         Toggle toggle;
+         sink = toggle.count;
+      }
+   });
+}
+
+void FleetBenchmarks() {
+   for (size_t machines=1000; machines<=1000000; machines*=10) {
+      std::vector<Toggle> fleet(machines);
+      const std::string name = "fleet/signal_each/" + std::to_string(machines);
+      // One op is one machine signaled; the fleet is walked round and round.
+      Measure(name.c_str(), [&](size_t ops) {
+         size_t next = 0;
+         for (size_t i=0; i<ops; i++) {
+            fleet[next].Flip();
+            if (++next == machines) {
+               next = 0;
+            }
+         }
+         sink = fleet[0].count;
+      });
+   }
+   // One op is one machine; a broadcast signals them all, the loop one by one.
+   for (size_t machines=1000; machines<=1000000; machines*=10) {
+      std::vector<Switch> switches(machines);
+      MachineFleet<Switch::Definition> fleet(Switch::Shared());
+      fleet.Reserve(machines);
+      for (auto& s : switches) {
+         fleet.Add(s);
+      }
+      const std::string broadcast = "fleet/broadcast/" + std::to_string(machines);
+      Measure(broadcast.c_str(), [&](size_t ops) {
+         for (size_t done=0; done<ops; done+=machines) {
+            sink = fleet.Broadcast(SwitchSignals::FLIP);
+         }
+      });
+      const std::string each = "fleet/broadcast_by_signal_each/" + std::to_string(machines);
+      Measure(each.c_str(), [&](size_t ops) {
+         size_t next = 0;
+         for (size_t i=0; i<ops; i++) {
+            fleet.Signal(next, SwitchSignals::FLIP);
+            if (++next == machines) {
+               next = 0;
+            }
+         }
+      });
+   }
+   // One op is one machine of the fleet, of which one in a hundred handles the signal.
+   for (size_t machines=1000; machines<=1000000; machines*=10) {
+      std::vector<Sensor> sensors(machines);
+      MachineFleet<Sensor::Definition, true> fleet(Sensor::Shared());
+      fleet.Reserve(machines);
+      for (auto& s : sensors) {
+         fleet.Add(s);
+      }
+      for (size_t m=0; m<machines; m+=100) {
+         fleet.Signal(m, SensorSignals::ARM);
+      }
+      const std::string publish = "fleet/publish_1_percent/" + std::to_string(machines);
+      Measure(publish.c_str(), [&](size_t ops) {
+         for (size_t done=0; done<ops; done+=machines) {
+            sink = fleet.Publish(SensorSignals::ALARM);
+         }
+      });
+      const std::string broadcast = "fleet/broadcast_1_percent/" + std::to_string(machines);
+      Measure(broadcast.c_str(), [&](size_t ops) {
+         for (size_t done=0; done<ops; done+=machines) {
+            sink = fleet.Broadcast(SensorSignals::ALARM);
+         }
+      });
+   }
+}
+
+void RegionBenchmarks() {
+   const AspectSignals events[] = { AspectSignals::EVENT_A, AspectSignals::EVENT_B, AspectSignals::EVENT_C, AspectSignals::EVENT_D };
+   // One op is one signal, which every aspect gets; the machines run to
+   // completion with a queue, as a StateMachine does.
+   {
+      Aspects aspects;
+      std::vector<std::unique_ptr<Aspects::Definition>> blueprints;
+      std::vector<std::unique_ptr<SharedStateMachine<Aspects::Definition, DEFAULT_QUEUE_CAPACITY>>> machines;
+      for (int a=0; a<4; a++) {
+         blueprints.emplace_back(new Aspects::Definition([a](Aspects::Definition& b) { Aspects::Define(b, a); }));
+         machines.emplace_back(new SharedStateMachine<Aspects::Definition, DEFAULT_QUEUE_CAPACITY>(aspects, *blueprints.back()));
+         machines.back()->Start();
+      }
+      Measure("regions/four_machines", [&](size_t ops) {
+         for (size_t i=0; i<ops; i++) {
+            for (auto& machine : machines) {
+               machine->Signal(events[i % 4]);
+            }
+         }
+         sink = aspects.count;
+      });
+   }
+   {
+      Aspects aspects;
+      Aspects::Definition blueprint([](Aspects::Definition& b) { Aspects::Define(b, 0); });
+      OrthogonalStateMachine<Aspects::Definition, 4, DEFAULT_QUEUE_CAPACITY> machine(aspects, blueprint,
+         {{ AspectStates::A_IDLE, AspectStates::B_IDLE, AspectStates::C_IDLE, AspectStates::D_IDLE }});
+      machine.Start();
+      Measure("regions/four_regions", [&](size_t ops) {
+         for (size_t i=0; i<ops; i++) {
+            machine.Signal(events[i % 4]);
+         }
+         sink = aspects.count;
+      });
+   }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+   filter = (argc > 1) ? argv[1] : nullptr;
+   std::printf("benchmark,ops,ns_per_op,allocs_per_op\n");
+   DispatchBenchmarks();
+   TransitionBenchmarks();
+   TickBenchmarks();
+   SetupBenchmarks();
+   FleetBenchmarks();
+   RegionBenchmarks();
+   return 0;
+}
@@ -0,0 +1,99 @@
+// Signal throughput of the work-stealing Executor as the number of worker
+// threads grows. Every actor forwards each signal it gets to its successor,
+// so after seeding the work keeps itself going on the workers (through
+// their own deques) until every actor has handled its share.
+//
+//    g++ -std=c++17 -O2 -I. bench_fhsm_executor.cpp -o bench_fhsm_executor -pthread
+//    ./bench_fhsm_executor [max threads]
+//
+// Prints one CSV line per thread count.
+
+#include "kv/fhsm/Executor.h"
+#include "kv/fhsm/StateMachine.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace kv::fhsm;
+
+namespace {
+
+enum class RelayStates  { RELAYING };
+enum class RelaySignals { HOP };
+
+const size_t ACTORS = 1024;
+const size_t TOKENS_PER_ACTOR = 2;
+const size_t HOPS_PER_ACTOR = 2000;
+
+class Relay {
+public:
+   using Machine = StateMachine<Relay, RelayStates, RelayStates::RELAYING, RelayStates::RELAYING, RelaySignals>;
+   Relay(Executor& executor) : m_hsm(*this), m_activity(executor, m_hsm) {
+      m_hsm.DefineState(RelayStates::RELAYING)
+         .SetNoParent()
+         .ForSignal(RelaySignals::HOP).Do(&Relay::Hop);
+      m_hsm.ConcludeSetupAndSetInitialState(RelayStates::RELAYING);
+   }
+   void Hop() {
+      if (++handled < HOPS_PER_ACTOR) {
+         if ( ! next->Post(RelaySignals::HOP)) {
+            ++dropped;
+         }
+      }
+   }
+   kv::embedded::Status Post(const RelaySignals s) { return m_activity.Post(s); }
+
+   Relay* next = nullptr;
+   size_t handled = 0;
+   size_t dropped = 0;
+private:
+   Machine m_hsm;
+   Activity<RelaySignals, Machine, 512> m_activity;
+};
+
+void Measure(size_t threads) {
+   Executor executor(threads);
+   std::vector<std::unique_ptr<Relay>> relays;
+   for (size_t a=0; a<ACTORS; a++) {
+      relays.emplace_back(new Relay(executor));
+   }
+   for (size_t a=0; a<ACTORS; a++) {
+      relays[a]->next = relays[(a * 7 + 1) % ACTORS].get(); // a permutation, since 7 and ACTORS are coprime
+   }
+
+   const auto start = std::chrono::steady_clock::now();
+   for (size_t t=0; t<TOKENS_PER_ACTOR; t++) {
+      for (auto& relay : relays) {
+         relay->Post(RelaySignals::HOP);
+      }
+   }
+   executor.WaitUntilIdle();
+   const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   size_t signals = 0;
+   size_t dropped = 0;
+   for (auto& relay : relays) {
+      signals += relay->handled;
+      dropped += relay->dropped;
+   }
+   std::printf("%zu,%zu,%zu,%.6f,%.0f\n", threads, signals, dropped, elapsed.count(), signals / elapsed.count());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+   size_t maxThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+   if (maxThreads == 0) {
+      maxThreads = 1;
+   }
+   std::printf("threads,signals,dropped,seconds,signals_per_second\n");
+   for (size_t threads=1; threads<maxThreads; threads*=2) {
+      Measure(threads);
+   }
+   Measure(maxThreads);
+   return 0;
+}
@@ -0,0 +1,82 @@
+// Decodes a dump written by kv::fhsm::TraceSink::Dump into readable text,
+// or (with --json) into a Chrome trace event file of time-in-state spans
+// for chrome://tracing or ui.perfetto.dev.
+//
+//    g++ -std=c++14 -O2 -I. fhsm_trace_decode.cpp -o fhsm_trace_decode
+//    ./fhsm_trace_decode [--json] trace.bin [names.txt] > trace.json
+//
+// The optional names file has lines of "state <index> <name>" and
+// "signal <value> <name>"; anything unnamed is printed as a number.
+
+#include "kv/fhsm/TraceDecoder.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace kv::fhsm;
+
+namespace {
+
+bool ReadNames(const char* path, TraceDecoder& decoder) {
+   std::ifstream in(path);
+   if ( ! in) {
+      return false;
+   }
+   std::string line;
+   while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string kind;
+      unsigned number = 0;
+      std::string name;
+      if ( ! (fields >> kind >> number >> name)) {
+         continue;
+      }
+      if (kind == "state") {
+         decoder.NameState(static_cast<std::uint16_t>(number), name);
+      } else if (kind == "signal") {
+         decoder.NameSignal(static_cast<std::uint16_t>(number), name);
+      }
+   }
+   return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+   int arg = 1;
+   const bool json = (argc > arg && std::strcmp(argv[arg], "--json") == 0);
+   if (json) {
+      ++arg;
+   }
+   if (argc <= arg) {
+      std::fprintf(stderr, "usage: %s [--json] trace.bin [names.txt]\n", argv[0]);
+      return 2;
+   }
+   TraceDecoder decoder;
+   if (argc > arg + 1 && ! ReadNames(argv[arg + 1], decoder)) {
+      std::fprintf(stderr, "cannot read %s\n", argv[arg + 1]);
+      return 1;
+   }
+   std::ifstream in(argv[arg], std::ios::binary);
+   if ( ! in) {
+      std::fprintf(stderr, "cannot open %s: %s\n", argv[arg], std::strerror(errno));
+      return 1;
+   }
+   try {
+      const auto records = TraceDecoder::Read(in);
+      if (json) {
+         decoder.WriteChromeTrace(std::cout, records);
+      } else {
+         decoder.WriteText(std::cout, records);
+      }
+   } catch (const TraceDecoder::FormatException& e) {
+      std::fprintf(stderr, "%s: %s\n", argv[arg], e.what());
+      return 1;
+   }
+   return 0;
+}
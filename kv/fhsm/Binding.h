@@ -0,0 +1,81 @@
+#ifndef kv_fhsm_Binding_h
+#define kv_fhsm_Binding_h
+
+#include <cstddef>
+#include <type_traits>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+template<typename Pointer, typename Function>
+class Binding;
+
+//! A handler or guard as a Blueprint holds it. A member function pointer
+//! (Pointer) is called through the actor as it always was. A member function
+//! given as a template argument (SetOnEnter<&Actor::Count>()) or a stateless
+//! functor gets a function made for it alone, whose body is the call itself,
+//! so a small handler is inlined into it and there is neither a this
+//! adjustment nor a virtual check. A captureless lambda (which cannot be
+//! default constructed before C++20) is called through its function pointer.
+//
+template<typename Pointer, typename Result, typename Actor>
+class Binding<Pointer, Result(*)(Actor&)> {
+public:
+   using PointerType = Pointer;
+   using FunctionType = Result(*)(Actor&);
+   using Call = Result(*)(Actor&, const Binding&);
+
+   Binding() {}
+   Binding(std::nullptr_t) {}
+   Binding(Pointer method) : m_method(method) {}
+   Binding(FunctionType function) : m_call(function ? &CallFunction : nullptr), m_function(function) {}
+
+   //! Bind a member function known at compile time.
+   template<Pointer method>
+   static Binding Method() { return Binding(&CallMethod<method>); }
+
+   //! Bind a captureless lambda or a stateless functor.
+   template<class F>
+   static Binding Functor(F f) { return Functor(f, std::is_convertible<F, FunctionType>{}); }
+
+   explicit operator bool() const { return m_call != nullptr || m_method != nullptr; }
+   bool operator==(const Binding& other) const {
+      return m_call == other.m_call && m_method == other.m_method && m_function == other.m_function;
+   }
+   bool operator!=(const Binding& other) const { return NOT (*this == other); }
+
+   Result operator()(Actor& actor) const { return m_call ? m_call(actor, *this) : (actor.*m_method)(); }
+
+private:
+   explicit Binding(Call call) : m_call(call) {}
+
+   template<class F>
+   static Binding Functor(F f, std::true_type /* a lambda's function pointer */) {
+      return Binding(static_cast<FunctionType>(f));
+   }
+   template<class F>
+   static Binding Functor(F, std::false_type) {
+      static_assert(std::is_empty<F>::value && std::is_default_constructible<F>::value,
+                    "Only member functions, captureless lambdas and stateless functors bind as handlers");
+      return Binding(&CallFunctor<F>);
+   }
+
+   static Result CallFunction(Actor& actor, const Binding& b) { return b.m_function(actor); }
+   template<Pointer method>
+   static Result CallMethod(Actor& actor, const Binding&) { return (actor.*method)(); }
+   template<class F>
+   static Result CallFunctor(Actor& actor, const Binding&) { return F{}(actor); }
+
+   Call m_call{nullptr};
+   Pointer m_method{nullptr};
+   FunctionType m_function{nullptr};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,679 @@
+
+#ifndef kv_fhsm_Blueprint_h
+#define kv_fhsm_Blueprint_h
+
+#include "EventQueue.h"
+#include "History.h"
+#include "Instrumentation.h"
+#include "State.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <limits>
+
+//! The number of distinct handlers (enter, exit, tick and action) and of
+//! distinct guards a Blueprint with a dense signal range has room for.
+#ifndef KV_FHSM_HANDLER_CAPACITY
+#define KV_FHSM_HANDLER_CAPACITY 32
+#endif
+#ifndef KV_FHSM_GUARD_CAPACITY
+#define KV_FHSM_GUARD_CAPACITY 16
+#endif
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! The definition of a hierarchical state machine: the states, their
+//! handlers and the tables resolved from them. It holds no per-actor state,
+//! so one (read-only, once setup is concluded) blueprint can drive any
+//! number of machines; see StateMachine and SharedStateMachine.
+//! The template parameters are those of StateMachine.
+//
+template<class Actor, typename StateSpace, const StateSpace first, const StateSpace last, typename SignalSpace, const SignalSpace... signalRange>
+class Blueprint {
+public:
+   using BoundState = State<Actor, StateSpace, Blueprint, SignalSpace>;
+   using ActorType = Actor;
+   using StateSpaceType = StateSpace;
+   using SignalSpaceType = SignalSpace;
+   using SignalTables = SignalTableSelector<SignalSpace, signalRange...>;
+   template<typename Value>
+   using SignalTable = typename SignalTables::template Table<Value>;
+   static const size_t FIRST{static_cast<size_t>(first)};
+   static const size_t LAST{static_cast<size_t>(last)};
+   static const size_t COUNT{LAST - FIRST + 1};
+   static const size_t UNKNOWN{COUNT + 1};
+   //! The smallest type that indexes the states (uint8_t for up to 254 of them).
+   using IndexType = CompactIndex<COUNT>;
+   using MethodPointer = void(Actor::*)();
+   using AllowPointer = bool(Actor::*)()const;
+
+   // Neither the states nor the run time tables hold the bindings (32 bytes
+   // each on most ABIs) but small slots into tables of the distinct handlers
+   // and guards; slot 0 is "none". Every state has up to three handlers of
+   // its own, one action and one guard per signal, and its enter and exit
+   // chains are at most as long as its depth.
+   static const size_t MAX_METHODS{1 + COUNT * (3 + SignalTables::SIGNAL_COUNT)};
+   static const size_t MAX_GUARDS{1 + COUNT * SignalTables::SIGNAL_COUNT};
+   static const size_t MAX_CHAINED{COUNT * (COUNT + 1)};
+   // A dense blueprint keeps the tables of handlers and guards inside the
+   // object, and most machines use a handful of distinct ones, so it makes
+   // room for KV_FHSM_HANDLER_CAPACITY handlers and KV_FHSM_GUARD_CAPACITY
+   // guards rather than for the worst case; a map based one grows them.
+   static const size_t METHOD_CAPACITY{SignalTables::IS_DENSE ? std::min<size_t>(MAX_METHODS, 1 + KV_FHSM_HANDLER_CAPACITY)
+                                                              : std::numeric_limits<std::uint32_t>::max()};
+   static const size_t GUARD_CAPACITY{SignalTables::IS_DENSE ? std::min<size_t>(MAX_GUARDS, 1 + KV_FHSM_GUARD_CAPACITY)
+                                                             : std::numeric_limits<std::uint32_t>::max()};
+   using MethodSlot = typename SignalTables::template Slot<METHOD_CAPACITY>;
+   using GuardSlot = typename SignalTables::template Slot<GUARD_CAPACITY>;
+   using ChainIndex = CompactIndex<MAX_CHAINED>;
+
+   //! A handler or guard as bound: a member function pointer or a function (see Binding).
+   using Action = typename BoundState::Action;
+   using Guard = typename BoundState::Guard;
+   using StateChangeCallback = void(Actor::*)(const StateSpace s);
+   using Timeout = typename BoundState::Timeout;
+
+
+   // Hierarchical states must form trees or forrests: no cycles!
+   //
+   class CyclicGraphException : public std::exception {};
+
+   //! Each signal that is deferred anywhere gets a bit of a 64 bit mask.
+   static const size_t MAX_DEFERRED_SIGNALS{64};
+   class TooManyDeferredSignalsException : public std::exception {};
+
+   //! Concluding a dense definition with more distinct handlers or guards
+   //! than it has room for (see KV_FHSM_HANDLER_CAPACITY) throws this.
+   class TooManyHandlersException : public std::exception {};
+
+   //! What a machine keeps besides its current state: the signals its
+   //! states deferred and the history of its states (see Signal). Without
+   //! capacities both are empty, and together take one byte.
+   template<size_t deferralCapacity, size_t historyCapacity>
+   class Memory : public DeferralQueue<SignalSpace, deferralCapacity>, public StateHistory<Blueprint, historyCapacity> {
+   public:
+      size_t Deferred() const { return this->size(); }
+   };
+
+   //! A run of enter or exit handlers, as [begin, end) into the handler pool.
+   struct Path {
+      ChainIndex begin{0};
+      ChainIndex end{0};
+   };
+
+   //! What a signal resolves to for a given current (leaf) state: the action,
+   //! the guard and the transition of the state that would have consumed it
+   //! when bubbling up the hierarchy, with the (non-null) exit and enter
+   //! handlers the transition runs. A signal the state defers resolves to
+   //! neither an action nor a transition.
+   struct Resolution {
+      IndexType handler{COUNT};
+      IndexType destination{COUNT};
+      MethodSlot action{0};
+      GuardSlot allow{0};
+      Path exits;
+      Path entries;
+   };
+
+private:
+   class ParentSetter {
+      Blueprint& m_blueprint;
+      IndexType m_index;
+      friend Blueprint;
+      ParentSetter(Blueprint& blueprint, IndexType i) : m_blueprint(blueprint), m_index(i) {}
+   public:
+      BoundState& SetParent(StateSpace p) {
+         auto parent = m_blueprint.StateToIndex(p);
+         if (m_blueprint.IsAncestorOf(m_index, parent)) {
+            throw CyclicGraphException();
+         }
+         return m_blueprint.StateRef(m_index).SetParent(parent);
+      }
+      BoundState& SetNoParent() {
+         return m_blueprint.StateRef(m_index).SetParent(COUNT);
+      }
+   };
+
+public:
+   //! Create an empty blueprint; define the states on it next.
+   Blueprint() {
+      m_methods.push_back(Action());
+      m_guards.push_back(Guard());
+      for (IndexType i=0; i<COUNT; i++) {
+         m_states[i].Initialize(IndexToState(i), this);
+      }
+   }
+
+   //! Create a blueprint and have define(blueprint) fill it in, so a
+   //! shared blueprint can be a function local static:
+   //!    static const MyBlueprint blueprint([](MyBlueprint& b) { b.DefineState(...)...; });
+   template<class F>
+   explicit Blueprint(F define) : Blueprint() {
+      define(*this);
+   }
+
+   // The states point back at their blueprint.
+   Blueprint(const Blueprint&) = delete;
+   Blueprint& operator=(const Blueprint&) = delete;
+
+   //! Start the process of defining a state (to be called for each state).
+   //! This returns a helper class that requires you to set a parent state
+   //! or affirm that there is no parent state.
+   ParentSetter DefineState(StateSpace state) {
+      return ParentSetter(*this, StateToIndex(state));
+   }
+
+   //! Once all of the states have been defined, this completes the process.
+   //! Provide an optional method to receive state change notifications.
+   void ConcludeSetupAndSetInitialState(StateSpace initial, StateChangeCallback noteState=nullptr) {
+      m_noteState = noteState;
+      m_initial = StateToIndex(initial);
+      m_isConcluded = true;
+      ResolveDefinition();
+   }
+
+   bool IsConcluded() const { return m_isConcluded; }
+   IndexType GetInitial() const { return m_initial; }
+   StateSpace IndexToState(const IndexType i) const { return static_cast<StateSpace>(i + FIRST); }
+   IndexType StateToIndex(const StateSpace s) const { return static_cast<IndexType>(static_cast<size_t>(s) - FIRST); }
+
+   // The run time half: these are called by the machines with their actor and current state.
+
+   //! Enter the initial state (root first) and return it.
+   IndexType Start(Actor& actor) const {
+      NoInstrumentation<Blueprint> none;
+      return Start(actor, none);
+   }
+   template<class Probe>
+   IndexType Start(Actor& actor, Probe& probe) const {
+      return StartIn(actor, m_initial, probe);
+   }
+   //! Enter state initial (root first) instead of the blueprint's initial
+   //! state, e.g. in each region of an OrthogonalStateMachine.
+   template<class Probe>
+   IndexType StartIn(Actor& actor, const IndexType initial, Probe& probe) const {
+      if (Probe::WALKS_STATES) {
+         for (IndexType level=initial; level!=COUNT; level=m_states[level].GetParent()) {
+            probe.Entered(level);
+         }
+      }
+      probe.Started(initial);
+      InformActorOfCurrentState(actor, initial);
+      RunHandlers(actor, m_entryChain[initial]);
+      return initial;
+   }
+
+   //! The closest tick handler up the hierarchy was resolved during setup,
+   //! as was its period; count is the machine's tick number.
+   void Tick(Actor& actor, const IndexType current, const std::uint32_t count) const {
+      if (auto onTick = m_tick[current]) {
+         const auto period = m_tickPeriod[current];
+         if (period == 1 || count % period == 0) {
+            m_methods[onTick](actor);
+         }
+      }
+   }
+   //! Run the tick handler whatever its period, for machines that are only
+   //! ticked when it is due (FleetStateMachine).
+   void TickDue(Actor& actor, const IndexType current) const {
+      if (auto onTick = m_tick[current]) {
+         m_methods[onTick](actor);
+      }
+   }
+
+   void Signal(Actor& actor, IndexType& current, const SignalSpace s) const {
+      NoInstrumentation<Blueprint> none;
+      Signal(actor, current, s, none);
+   }
+   //! Signal, telling probe (an instrumentation policy) what happens.
+   template<class Probe>
+   void Signal(Actor& actor, IndexType& current, const SignalSpace s, Probe& probe) const {
+      Memory<0, 0> none;
+      Signal(actor, current, s, probe, none);
+   }
+   //! Signal, keeping s in the machine's memory if the current state defers
+   //! it; after a transition, dispatch (oldest first) the kept signals the
+   //! new state no longer defers. Transitions record the states they leave
+   //! in its history and history transitions restore them.
+   template<class Probe, size_t capacity, size_t remembered>
+   void Signal(Actor& actor, IndexType& current, const SignalSpace s, Probe& probe, Memory<capacity, remembered>& memory) const {
+      DeferralQueue<SignalSpace, capacity>& deferrals = memory;
+      StateHistory<Blueprint, remembered>& history = memory;
+      auto r = m_resolved[current].Find(s);
+      if ( NOT r) {
+         probe.Dispatched(current, s, false);
+         return;
+      }
+      const auto source = current;
+      if (r->action) {
+         m_methods[r->action](actor);
+      }
+      if (r->destination != COUNT) {
+         const bool allowed = NOT r->allow || m_guards[r->allow](actor);
+         probe.Guarded(current, r->destination, allowed);
+         if (allowed) {
+            ExecuteTransition(actor, current, s, *r, probe, history);
+         }
+         probe.Dispatched(source, s, true);
+         if (allowed && NOT deferrals.empty()) {
+            Recall(actor, current, probe, memory);
+         }
+      } else {
+         // Only a state that defers s keeps it; an empty action (e.g.
+         // Do(nullptr)) resolves the same way but consumes it.
+         auto bit = m_deferralBits.Find(s);
+         if (bit && ((m_deferring[current] >> *bit) & 1)) {
+            probe.Deferred(current, s);
+            if (capacity != 0) {
+               deferrals.Push(s, *bit);
+            }
+         }
+         probe.Dispatched(source, s, true);
+      }
+   }
+
+   // The hierarchy and the state timeouts, for machines that arm them (TimedStateMachine).
+
+   //! The parent of state i (COUNT for a root).
+   IndexType GetParent(const IndexType i) const { return m_states[i].GetParent(); }
+   //! The root of the tree state i is in.
+   IndexType GetRoot(const IndexType i) const { return m_root[i]; }
+   //! Whether a transition taken in state i leads to another tree.
+   bool LeavesTree(const IndexType i) const { return m_leavesTree[i]; }
+   //! The timeout of state i (nullptr if it has none).
+   const Timeout* GetTimeout(const IndexType i) const { return m_states[i].GetTimeout(); }
+   bool HasTimeouts() const { return m_hasTimeouts; }
+   //! Whether any state defers a signal.
+   bool HasDeferrals() const { return m_hasDeferrals; }
+   //! Whether any transition goes to the history of a state.
+   bool HasHistory() const { return m_hasHistory; }
+   //! The most timeouts that can be armed at once: the most states with a
+   //! timeout on any path from a state up to its root.
+   size_t MaxNestedTimeouts() const {
+      size_t most = 0;
+      for (IndexType i=0; i<COUNT; i++) {
+         size_t nested = 0;
+         for (IndexType level=i; level!=COUNT; level=m_states[level].GetParent()) {
+            if (m_states[level].GetTimeout()) {
+               ++nested;
+            }
+         }
+         most = std::max(most, nested);
+      }
+      return most;
+   }
+
+   // Read access to the resolved tables, for tools such as CodeGenerator.
+
+   StateChangeCallback GetStateChangeCallback() const { return m_noteState; }
+   //! The tick handler a state resolved to (empty if it has none up the hierarchy).
+   const Action& GetResolvedTick(const IndexType i) const { return m_methods[m_tick[i]]; }
+   bool HasTick(const IndexType i) const { return m_tick[i] != 0; }
+   //! Every how many ticks state i runs its tick handler.
+   std::uint32_t GetTickPeriod(const IndexType i) const { return m_tickPeriod[i]; }
+   //! The handler or guard in a slot of a Resolution (empty for slot 0).
+   const Action& GetMethod(const MethodSlot slot) const { return m_methods[slot]; }
+   const Guard& GetGuard(const GuardSlot slot) const { return m_guards[slot]; }
+   //! The enter handlers Start runs for state i (root first).
+   const Path& GetEntryChain(const IndexType i) const { return m_entryChain[i]; }
+   //! What signal s resolves to in state i (nullptr if nothing reacts to it).
+   const Resolution* FindResolution(const IndexType i, const SignalSpace s) const { return m_resolved[i].Find(s); }
+   //! Whether state i defers signal s.
+   bool Defers(const IndexType i, const SignalSpace s) const {
+      auto bit = m_deferralBits.Find(s);
+      return bit && ((m_deferring[i] >> *bit) & 1);
+   }
+   //! Whether state i defers any signal.
+   bool DefersAny(const IndexType i) const { return m_deferring[i] != 0; }
+   //! Call f(signal, resolution) for every signal state i reacts to.
+   template<class F>
+   void ForEachResolution(const IndexType i, F f) const {
+      m_resolved[i].ForEach(f);
+   }
+   //! Call f(handler) for every handler on a path, in the order they run.
+   template<class F>
+   void ForEachHandler(const Path& path, F f) const {
+      for (auto i=path.begin; i<path.end; i++) {
+         f(m_methods[m_handlers[i]]);
+      }
+   }
+
+private:
+   friend BoundState;
+
+   BoundState& StateRef(StateSpace state) {
+      return m_states[StateToIndex(state)];
+   }
+   BoundState& StateRef(IndexType i) {
+      return m_states[i];
+   }
+
+   // Changes made after setup was concluded are folded into the resolved tables right away.
+   void DefinitionChanged() {
+      if (m_isConcluded) {
+         ResolveDefinition();
+      }
+   }
+
+   // The states hold their handlers and guards as slots of these tables.
+   MethodSlot InternMethod(const Action& action) { return Intern<MethodSlot, METHOD_CAPACITY>(m_methods, action); }
+   GuardSlot InternGuard(const Guard& guard) { return Intern<GuardSlot, GUARD_CAPACITY>(m_guards, guard); }
+
+   void ResolveDefinition() {
+      ResolveTicks();
+      ResolveHandlerChains();
+      ResolveSignals();
+      ResolveDeferrals();
+      ResolveTrees();
+      ResolveHistory();
+      m_hasTimeouts = std::any_of(m_states.begin(), m_states.end(), [](const BoundState& state) { return state.GetTimeout(); });
+   }
+
+   // A state without a tick handler uses the one of its closest ancestor (if
+   // any), and likewise for the tick period (every tick if none is set).
+   void ResolveTicks() {
+      for (IndexType i=0; i<COUNT; i++) {
+         MethodSlot onTick = 0;
+         for (IndexType level=i; level!=COUNT && NOT onTick; level=m_states[level].GetParent()) {
+            onTick = m_states[level].GetOnTick();
+         }
+         m_tick[i] = onTick;
+         std::uint32_t period = 0;
+         for (IndexType level=i; level!=COUNT && NOT period; level=m_states[level].GetParent()) {
+            period = m_states[level].GetTickPeriod();
+         }
+         m_tickPeriod[i] = (period ? period : 1);
+      }
+   }
+
+   // For every state, lay out its non-null exit handlers (state up to root)
+   // and its non-null enter handlers (root down to state) in the pool.
+   void ResolveHandlerChains() {
+      m_handlers.clear();
+      for (IndexType i=0; i<COUNT; i++) {
+         m_exitChain[i].begin = m_handlers.size();
+         for (IndexType level=i; level!=COUNT; level=m_states[level].GetParent()) {
+            if (auto onExit = m_states[level].GetOnExit()) {
+               m_handlers.push_back(onExit);
+            }
+         }
+         m_exitChain[i].end = m_handlers.size();
+
+         m_entryChain[i].begin = m_handlers.size();
+         for (IndexType level=i; level!=COUNT; level=m_states[level].GetParent()) {
+            if (auto onEnter = m_states[level].GetOnEnter()) {
+               m_handlers.push_back(onEnter);
+            }
+         }
+         m_entryChain[i].end = m_handlers.size();
+         std::reverse(m_handlers.begin() + m_entryChain[i].begin, m_handlers.end());
+      }
+   }
+
+   // "Compile" the hierarchy: for every (leaf, signal) record what bubbling would find.
+   void ResolveSignals() {
+      for (IndexType leaf=0; leaf<COUNT; leaf++) {
+         auto& resolved = m_resolved[leaf];
+         resolved = SignalTable<Resolution>{};
+         for (IndexType level=leaf; level!=COUNT; level=m_states[level].GetParent()) {
+            auto resolve = [&](SignalSpace s) {
+               if ( NOT resolved.Contains(s)) {
+                  resolved.Set(s, ResolveAt(leaf, level, s));
+               }
+            };
+            m_states[level].ForEachHandledSignal(resolve);
+            m_states[level].ForEachDeferredSignal(resolve);
+         }
+      }
+   }
+   // Give every deferred signal a bit and every state the mask of those it
+   // defers: the ones that resolve, for it, to a state that defers them.
+   void ResolveDeferrals() {
+      m_deferralBits = SignalTable<std::uint8_t>{};
+      size_t bits = 0;
+      for (IndexType i=0; i<COUNT; i++) {
+         m_states[i].ForEachDeferredSignal([&](SignalSpace s) {
+            if ( NOT m_deferralBits.Contains(s)) {
+               if (bits == MAX_DEFERRED_SIGNALS) {
+                  throw TooManyDeferredSignalsException();
+               }
+               m_deferralBits.Set(s, static_cast<std::uint8_t>(bits++));
+            }
+         });
+      }
+      m_hasDeferrals = (bits != 0);
+      for (IndexType i=0; i<COUNT; i++) {
+         m_deferring[i] = 0;
+         m_resolved[i].ForEach([&](SignalSpace s, const Resolution& r) {
+            if (m_states[r.handler].Defers(s)) {
+               m_deferring[i] |= std::uint64_t{1} << *m_deferralBits.Find(s);
+            }
+         });
+      }
+   }
+   Resolution ResolveAt(IndexType leaf, IndexType level, SignalSpace s) {
+      Resolution r;
+      r.handler = level;
+      if (auto action = m_states[level].FindAction(s)) {
+         r.action = *action;
+      }
+      if (auto t = m_states[level].FindTransition(s)) {
+         r.allow = t->allow;
+         r.destination = t->GetDestination();
+         auto lca = LeastCommonAncestor(leaf, r.destination);
+         auto& exits = m_exitChain[leaf];
+         r.exits = Path{exits.begin, static_cast<ChainIndex>(exits.begin + CountHandlersBelow(leaf, lca, &BoundState::GetOnExit))};
+         auto& entries = m_entryChain[r.destination];
+         r.entries = Path{static_cast<ChainIndex>(entries.end - CountHandlersBelow(r.destination, lca, &BoundState::GetOnEnter)), entries.end};
+      }
+      return r;
+   }
+   // The slot of a handler (or guard) in its table, adding it if it is new; an empty one is slot 0.
+   template<typename Slot, size_t capacity, class Table, typename Bound>
+   static Slot Intern(Table& table, const Bound& p) {
+      for (size_t i=0; i<table.size(); i++) {
+         if (table[i] == p) {
+            return static_cast<Slot>(i);
+         }
+      }
+      if (table.size() == capacity) {
+         throw TooManyHandlersException();
+      }
+      table.push_back(p);
+      return static_cast<Slot>(table.size() - 1);
+   }
+   size_t CountHandlersBelow(IndexType here, IndexType ancestor, MethodSlot (BoundState::*handler)() const) const {
+      size_t count = 0;
+      for (IndexType level=here; level!=ancestor && level!=COUNT; level=m_states[level].GetParent()) {
+         if ((m_states[level].*handler)()) {
+            ++count;
+         }
+      }
+      return count;
+   }
+
+   template<class Probe, size_t capacity, size_t remembered>
+   void Recall(Actor& actor, IndexType& current, Probe& probe, Memory<capacity, remembered>& memory) const {
+      SignalSpace recalled;
+      while (memory.Recall(m_deferring[current], recalled)) {
+         Signal(actor, current, recalled, probe, memory);
+      }
+   }
+
+   void ResolveTrees() {
+      for (IndexType i=0; i<COUNT; i++) {
+         m_root[i] = i;
+         while (m_states[m_root[i]].GetParent() != COUNT) {
+            m_root[i] = m_states[m_root[i]].GetParent();
+         }
+      }
+      for (IndexType i=0; i<COUNT; i++) {
+         m_leavesTree[i] = false;
+         m_resolved[i].ForEach([&](SignalSpace, const Resolution& r) {
+            if (r.destination != COUNT && m_root[r.destination] != m_root[i]) {
+               m_leavesTree[i] = true;
+            }
+         });
+      }
+   }
+
+   // Number the states history transitions lead to, and lay out for every
+   // state the slots of those above it (itself included) with their child
+   // on the way down to it.
+   void ResolveHistory() {
+      m_historySlot.fill(static_cast<IndexType>(COUNT));
+      size_t slots = 0;
+      for (IndexType i=0; i<COUNT; i++) {
+         m_states[i].ForEachHandledSignal([&](SignalSpace s) {
+            auto t = m_states[i].FindTransition(s);
+            if (t && t->history != HistoryKind::NONE && m_historySlot[t->GetDestination()] == COUNT) {
+               m_historySlot[t->GetDestination()] = static_cast<IndexType>(slots++);
+            }
+         });
+      }
+      m_hasHistory = (slots != 0);
+      m_historyRecords.clear();
+      for (IndexType i=0; i<COUNT; i++) {
+         m_historyChain[i].begin = m_historyRecords.size();
+         IndexType shallow = i;
+         for (IndexType level=i; level!=COUNT; level=m_states[level].GetParent()) {
+            if (m_historySlot[level] != COUNT) {
+               m_historyRecords.push_back(HistoryRecord{m_historySlot[level], shallow});
+            }
+            shallow = level;
+         }
+         m_historyChain[i].end = m_historyRecords.size();
+         m_takesHistory[i] = false;
+         m_resolved[i].ForEach([&](SignalSpace s, const Resolution& r) {
+            auto t = m_states[r.handler].FindTransition(s);
+            if (t && t->history != HistoryKind::NONE) {
+               m_takesHistory[i] = true;
+            }
+         });
+      }
+   }
+
+   void InformActorOfCurrentState(Actor& actor, IndexType current) const {
+      if (m_noteState) {
+         (actor.*m_noteState)(IndexToState(current));
+      }
+   }
+   void RunHandlers(Actor& actor, const Path& path) const {
+      for (auto i=path.begin; i<path.end; i++) {
+         m_methods[m_handlers[i]](actor);
+      }
+   }
+   template<class Probe, class History>
+   void ExecuteTransition(Actor& actor, IndexType& current, const SignalSpace s, const Resolution& r, Probe& probe, History& history) const {
+      auto destination = r.destination;
+      Path below; // the enter handlers from the destination down to the state history restores
+      if (History::CAPACITY) {
+         RecordHistory(current, history);
+         if (m_takesHistory[current]) {
+            destination = Restore(s, r, history, below);
+         }
+      }
+      if (Probe::WALKS_STATES) {
+         // The paths only hold the handlers; walk the states for the probe.
+         const auto lca = LeastCommonAncestor(current, r.destination);
+         for (IndexType level=current; level!=lca; level=m_states[level].GetParent()) {
+            probe.Exited(level);
+         }
+         for (IndexType level=destination; level!=lca; level=m_states[level].GetParent()) {
+            probe.Entered(level);
+         }
+      }
+      probe.Transitioned(current, destination);
+      RunHandlers(actor, r.exits);
+      RunHandlers(actor, r.entries);
+      RunHandlers(actor, below);
+      current = destination;
+      InformActorOfCurrentState(actor, current);
+   }
+   // Every composite above the state being left that history transitions
+   // lead to remembers it: those that are left now are remembered right, and
+   // the others are remembered again when they are left.
+   template<class History>
+   void RecordHistory(const IndexType current, History& history) const {
+      const auto& chain = m_historyChain[current];
+      for (auto i=chain.begin; i<chain.end; i++) {
+         const auto& record = m_historyRecords[i];
+         history.Record(record.slot, current, record.shallow);
+      }
+   }
+   // The state a history transition to r.destination restores, with the
+   // enter handlers below r.destination that are run to get there; the
+   // handlers of r.destination and above are in r.entries, as for any
+   // transition to it. The entry chain of a state begins with the one of
+   // every ancestor, so those below are the tail of its own.
+   template<class History>
+   IndexType Restore(const SignalSpace s, const Resolution& r, const History& history, Path& below) const {
+      const auto kind = m_states[r.handler].FindTransition(s)->history;
+      if (kind == HistoryKind::NONE) {
+         return r.destination;
+      }
+      const auto restored = history.Find(m_historySlot[r.destination], kind);
+      if (restored == COUNT) {
+         return r.destination;
+      }
+      const auto& to = m_entryChain[restored];
+      const auto& from = m_entryChain[r.destination];
+      below = Path{static_cast<ChainIndex>(to.end - ((to.end - to.begin) - (from.end - from.begin))), to.end};
+      return restored;
+   }
+   // States whose parent was never set are treated as roots.
+   IndexType LeastCommonAncestor(IndexType source, IndexType destination) const {
+      if (source == destination) return source; // Don't care about a parent in this case.
+      if (IsAncestorOf(source, destination)) return source;
+      if (m_states[source].GetParent() == COUNT) return COUNT; // no common ancestor
+      return LeastCommonAncestor(m_states[source].GetParent(), destination);
+   }
+   bool IsAncestorOf(IndexType candidate, IndexType child) const {
+      if (candidate == child) return true;
+      if (m_states[child].GetParent() == COUNT) return false;
+      return IsAncestorOf(candidate, m_states[child].GetParent());
+   }
+
+   std::array<BoundState, COUNT> m_states;
+   // The run time tables, one array per field.
+   std::array<SignalTable<Resolution>, COUNT> m_resolved;
+   std::array<MethodSlot, COUNT> m_tick{};
+   std::array<std::uint32_t, COUNT> m_tickPeriod{};
+   std::array<std::uint64_t, COUNT> m_deferring{}; // state: the bits of the signals it defers
+   // History: the slot of each state history transitions lead to (COUNT
+   // for the others), and for every state the records a transition from it makes.
+   struct HistoryRecord {
+      IndexType slot;
+      IndexType shallow;
+   };
+   std::array<IndexType, COUNT> m_historySlot{};
+   std::array<Path, COUNT> m_historyChain;
+   typename SignalTables::template Pool<HistoryRecord, MAX_CHAINED> m_historyRecords;
+   std::array<bool, COUNT> m_takesHistory{};
+   std::array<IndexType, COUNT> m_root{};
+   std::array<bool, COUNT> m_leavesTree{};
+   SignalTable<std::uint8_t> m_deferralBits;
+   std::array<Path, COUNT> m_exitChain;
+   std::array<Path, COUNT> m_entryChain;
+   typename SignalTables::template Pool<MethodSlot, MAX_CHAINED> m_handlers;
+   typename SignalTables::template Pool<Action, METHOD_CAPACITY> m_methods;
+   typename SignalTables::template Pool<Guard, GUARD_CAPACITY> m_guards;
+   IndexType m_initial{0};
+   StateChangeCallback m_noteState{nullptr};
+   bool m_isConcluded{false};
+   bool m_hasTimeouts{false};
+   bool m_hasDeferrals{false};
+   bool m_hasHistory{false};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef kv_fhsm_CodeGenerator_h
+#define kv_fhsm_CodeGenerator_h
+
+#include "Binding.h"
+
+#include <exception>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Turns a concluded Blueprint into a standalone C++ header: a class with
+//! the interface of RelocatableStateMachine (Start, Tick and Signal take the
+//! actor) whose dispatch is a switch on the current state and then one on
+//! the signal, calling the actor's member functions directly with the exit
+//! and enter handlers of every transition unrolled.
+//! The fluent definition stays the source of truth; regenerate the header
+//! whenever it changes.
+//!
+//! Member function pointers carry no names, so every handler, guard and
+//! state change callback the blueprint uses has to be named, as do the
+//! states, the signals and the types, all spelled the way the generated
+//! code should spell them (it is emitted outside of any namespace).
+//! Generate throws GenerationException if something it needs has no name
+//! (or the setup has not been concluded, or states have timeouts or tick
+//! periods: those need a TimedStateMachine or a machine's tick count, or
+//! defer signals or go to history: those need a machine that remembers).
+//
+template<class Definition>
+class CodeGenerator {
+public:
+   using Actor = typename Definition::ActorType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using IndexType = typename Definition::IndexType;
+   using MethodPointer = typename Definition::MethodPointer;
+   using AllowPointer = typename Definition::AllowPointer;
+   using Action = typename Definition::Action;
+   using Guard = typename Definition::Guard;
+   using StateChangeCallback = typename Definition::StateChangeCallback;
+   using Resolution = typename Definition::Resolution;
+
+   class GenerationException : public std::exception {
+      std::string m_what;
+   public:
+      explicit GenerationException(std::string what) : m_what(std::move(what)) {}
+      const char* what() const noexcept override { return m_what.c_str(); }
+   };
+
+   explicit CodeGenerator(const Definition& definition) : m_definition(definition) {}
+
+   //! Name the actor, state and signal types, e.g. ("Door", "DoorStates", "DoorSignals").
+   CodeGenerator& NameTypes(std::string actor, std::string states, std::string signals) {
+      m_actorName = std::move(actor);
+      m_stateSpaceName = std::move(states);
+      m_signalSpaceName = std::move(signals);
+      return *this;
+   }
+   //! Name a state, e.g. (DoorStates::OPEN, "DoorStates::OPEN").
+   CodeGenerator& NameState(StateSpace s, std::string name) {
+      m_stateNames.emplace_back(s, std::move(name));
+      return *this;
+   }
+   CodeGenerator& NameSignal(SignalSpace s, std::string name) {
+      m_signalNames.emplace_back(s, std::move(name));
+      return *this;
+   }
+   //! Name a handler by its member function name, e.g. (&Door::Creak, "Creak"),
+   //! or, for one bound as a template argument, NameHandler<&Door::Creak>("Creak").
+   //! Lambdas and functors have no name to call them by.
+   CodeGenerator& NameHandler(MethodPointer handler, std::string name) {
+      m_handlerNames.emplace_back(Action(handler), std::move(name));
+      return *this;
+   }
+   template<MethodPointer handler>
+   CodeGenerator& NameHandler(std::string name) {
+      NameHandler(handler, name);
+      m_handlerNames.emplace_back(Action::template Method<handler>(), std::move(name));
+      return *this;
+   }
+   CodeGenerator& NameGuard(AllowPointer guard, std::string name) {
+      m_guardNames.emplace_back(Guard(guard), std::move(name));
+      return *this;
+   }
+   template<AllowPointer guard>
+   CodeGenerator& NameGuard(std::string name) {
+      NameGuard(guard, name);
+      m_guardNames.emplace_back(Guard::template Method<guard>(), std::move(name));
+      return *this;
+   }
+   CodeGenerator& NameCallback(StateChangeCallback callback, std::string name) {
+      m_callbackNames.emplace_back(callback, std::move(name));
+      return *this;
+   }
+
+   //! Write the header defining className to out.
+   void Generate(std::ostream& out, const std::string& className) const {
+      if ( NOT m_definition.IsConcluded()) {
+         throw GenerationException("the blueprint's setup has not been concluded");
+      }
+      if (m_definition.HasTimeouts()) {
+         throw GenerationException("state timeouts need a TimedStateMachine");
+      }
+      for (IndexType i=0; i<Definition::COUNT; i++) {
+         if (m_definition.GetTickPeriod(i) != 1) {
+            throw GenerationException("tick periods are not generated");
+         }
+      }
+      if (m_definition.HasDeferrals()) {
+         throw GenerationException("deferred signals are not generated");
+      }
+      if (m_definition.HasHistory()) {
+         throw GenerationException("history transitions are not generated");
+      }
+      const std::string guard = "generated_" + className + "_h";
+      out << "// Generated by kv::fhsm::CodeGenerator from a fluent definition; do not edit.\n"
+          << "// Include it after " << m_actorName << ", " << m_stateSpaceName
+          << " and " << m_signalSpaceName << " are declared.\n"
+          << "#ifndef " << guard << "\n"
+          << "#define " << guard << "\n\n"
+          << "class " << className << " {\n"
+          << "public:\n"
+          << "   using Actor = " << m_actorName << ";\n"
+          << "   using StateSpace = " << m_stateSpaceName << ";\n"
+          << "   using SignalSpace = " << m_signalSpaceName << ";\n\n";
+      GenerateStart(out);
+      GenerateTick(out);
+      GenerateSignal(out);
+      out << "   StateSpace CurrentState() const { return m_current; }\n\n"
+          << "private:\n"
+          << "   StateSpace m_current{" << StateName(m_definition.GetInitial()) << "};\n"
+          << "};\n\n"
+          << "#endif\n";
+   }
+   std::string Generate(const std::string& className) const {
+      std::ostringstream out;
+      Generate(out, className);
+      return out.str();
+   }
+
+private:
+   template<typename Key>
+   using Names = std::vector<std::pair<Key, std::string>>;
+
+   template<typename Key>
+   static const std::string& Lookup(const Names<Key>& names, Key key, const char* kind, const std::string& which) {
+      for (const auto& entry : names) {
+         if (entry.first == key) {
+            return entry.second;
+         }
+      }
+      throw GenerationException(std::string("unnamed ") + kind + " " + which);
+   }
+   const std::string& StateName(IndexType i) const {
+      return Lookup(m_stateNames, m_definition.IndexToState(i), "state", std::to_string(i));
+   }
+   const std::string& SignalName(SignalSpace s) const {
+      return Lookup(m_signalNames, s, "signal", std::to_string(static_cast<long long>(s)));
+   }
+   const std::string& HandlerName(const Action& m, IndexType in) const {
+      return Lookup(m_handlerNames, m, "handler used by", StateName(in));
+   }
+   const std::string& GuardName(const Guard& g, IndexType in) const {
+      return Lookup(m_guardNames, g, "guard used by", StateName(in));
+   }
+
+   // Unroll the exits, the entries and the state change into straight line calls.
+   void GenerateTransition(std::ostream& out, const std::string& indent, IndexType from, const Resolution& r) const {
+      m_definition.ForEachHandler(r.exits, [&](const Action& m) {
+         out << indent << "actor." << HandlerName(m, from) << "();\n";
+      });
+      m_definition.ForEachHandler(r.entries, [&](const Action& m) {
+         out << indent << "actor." << HandlerName(m, r.destination) << "();\n";
+      });
+      out << indent << "m_current = " << StateName(r.destination) << ";\n";
+      GenerateNotification(out, indent, StateName(r.destination));
+   }
+   void GenerateNotification(std::ostream& out, const std::string& indent, const std::string& state) const {
+      if (auto callback = m_definition.GetStateChangeCallback()) {
+         out << indent << "actor." << Lookup(m_callbackNames, callback, "state change callback", "") << "(" << state << ");\n";
+      }
+   }
+
+   void GenerateStart(std::ostream& out) const {
+      const auto initial = m_definition.GetInitial();
+      std::ostringstream body;
+      GenerateNotification(body, "      ", StateName(initial));
+      m_definition.ForEachHandler(m_definition.GetEntryChain(initial), [&](const Action& m) {
+         body << "      actor." << HandlerName(m, initial) << "();\n";
+      });
+      out << "   void Start(Actor& actor) {\n"
+          << "      m_current = " << StateName(initial) << ";\n";
+      WriteBody(out, body.str(), "actor");
+      out << "   }\n\n";
+   }
+
+   void GenerateTick(std::ostream& out) const {
+      std::ostringstream body;
+      for (IndexType i=0; i<Definition::COUNT; i++) {
+         if (const auto& onTick = m_definition.GetResolvedTick(i)) {
+            body << "      case " << StateName(i) << ": actor." << HandlerName(onTick, i) << "(); return;\n";
+         }
+      }
+      out << "   void Tick(Actor& actor) const {\n";
+      WriteSwitch(out, "m_current", body.str(), "actor");
+      out << "   }\n\n";
+   }
+
+   void GenerateSignal(std::ostream& out) const {
+      std::ostringstream body;
+      for (IndexType i=0; i<Definition::COUNT; i++) {
+         std::ostringstream cases;
+         m_definition.ForEachResolution(i, [&](SignalSpace s, const Resolution& r) {
+            cases << "         case " << SignalName(s) << ":\n";
+            if (r.action) {
+               cases << "            actor." << HandlerName(m_definition.GetMethod(r.action), r.handler) << "();\n";
+            }
+            if (r.destination != Definition::COUNT) {
+               if (r.allow) {
+                  cases << "            if (actor." << GuardName(m_definition.GetGuard(r.allow), r.handler) << "()) {\n";
+                  GenerateTransition(cases, "               ", i, r);
+                  cases << "            }\n";
+               } else {
+                  GenerateTransition(cases, "            ", i, r);
+               }
+            }
+            cases << "            return;\n";
+         });
+         if ( NOT cases.str().empty()) {
+            body << "      case " << StateName(i) << ":\n"
+                 << "         switch (s) {\n"
+                 << cases.str()
+                 << "         default: return;\n"
+                 << "         }\n";
+         }
+      }
+      out << "   void Signal(Actor& actor, const SignalSpace s) {\n";
+      if (body.str().empty()) {
+         out << "      static_cast<void>(s);\n";
+      }
+      WriteSwitch(out, "m_current", body.str(), "actor");
+      out << "   }\n\n";
+   }
+
+   // A machine without any handler of a kind still compiles without warnings.
+   static void WriteBody(std::ostream& out, const std::string& body, const char* parameter) {
+      if (body.empty()) {
+         out << "      static_cast<void>(" << parameter << ");\n";
+      }
+      out << body;
+   }
+   static void WriteSwitch(std::ostream& out, const char* on, const std::string& cases, const char* parameter) {
+      if (cases.empty()) {
+         WriteBody(out, cases, parameter);
+         return;
+      }
+      out << "      switch (" << on << ") {\n"
+          << cases
+          << "      default: return;\n"
+          << "      }\n";
+   }
+
+   const Definition& m_definition;
+   std::string m_actorName{"Actor"};
+   std::string m_stateSpaceName{"StateSpace"};
+   std::string m_signalSpaceName{"SignalSpace"};
+   Names<StateSpace> m_stateNames;
+   Names<SignalSpace> m_signalNames;
+   Names<Action> m_handlerNames;
+   Names<Guard> m_guardNames;
+   Names<StateChangeCallback> m_callbackNames;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
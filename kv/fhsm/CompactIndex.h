@@ -0,0 +1,23 @@
+#ifndef kv_fhsm_CompactIndex_h
+#define kv_fhsm_CompactIndex_h
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace kv {
+namespace fhsm {
+
+//! The smallest unsigned type that holds every value in [0, n + 1], so an
+//! index into n items still has room for a "none" (n) and an "unknown" (n + 1).
+//
+template<size_t n>
+using CompactIndex =
+   typename std::conditional<(n < UINT8_MAX), std::uint8_t,
+   typename std::conditional<(n < UINT16_MAX), std::uint16_t,
+   typename std::conditional<(n < UINT32_MAX), std::uint32_t, size_t>::type>::type>::type;
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
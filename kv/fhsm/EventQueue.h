@@ -0,0 +1,259 @@
+#ifndef kv_fhsm_EventQueue_h
+#define kv_fhsm_EventQueue_h
+
+#include "CompactIndex.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+
+//! The number of signals a StateMachine can queue while it is dispatching.
+#ifndef KV_FHSM_QUEUE_CAPACITY
+#define KV_FHSM_QUEUE_CAPACITY 8
+#endif
+
+//! The number of deferred signals a StateMachine can keep.
+#ifndef KV_FHSM_DEFERRAL_CAPACITY
+#define KV_FHSM_DEFERRAL_CAPACITY 8
+#endif
+
+namespace kv {
+namespace fhsm {
+
+static const size_t DEFAULT_QUEUE_CAPACITY{KV_FHSM_QUEUE_CAPACITY};
+static const size_t DEFAULT_DEFERRAL_CAPACITY{KV_FHSM_DEFERRAL_CAPACITY};
+static const size_t ALL_QUEUED{std::numeric_limits<size_t>::max()};
+
+//! A fixed capacity FIFO ring of signals; it never touches the heap.
+//
+template<typename SignalSpace, size_t capacity>
+class EventQueue {
+   std::array<SignalSpace, capacity> m_items{};
+   CompactIndex<capacity> m_head{0};
+   CompactIndex<capacity> m_size{0};
+
+public:
+   //! Append s; false (and s is dropped) if the queue is full.
+   bool Push(const SignalSpace s) {
+      if (m_size == capacity) {
+         return false;
+      }
+      m_items[(m_head + m_size) % capacity] = s;
+      ++m_size;
+      return true;
+   }
+   //! Take the oldest signal; false if there is none.
+   bool Pop(SignalSpace& s) {
+      if (m_size == 0) {
+         return false;
+      }
+      s = m_items[m_head];
+      m_head = static_cast<CompactIndex<capacity>>((m_head + 1) % capacity);
+      --m_size;
+      return true;
+   }
+   size_t size() const { return m_size; }
+   bool empty() const { return m_size == 0; }
+};
+
+//! The signals a machine's states deferred, oldest first. Every deferrable
+//! signal of a blueprint has a bit (see Blueprint); the queue keeps the bits
+//! of what it holds together, so after a transition one mask test tells
+//! whether the new state lets any of them through, and only then is the
+//! queue walked. Signals deferred beyond the capacity are dropped.
+//
+template<typename SignalSpace, size_t capacity>
+class DeferralQueue {
+   std::array<SignalSpace, capacity> m_items{};
+   std::array<std::uint8_t, capacity> m_bits{};
+   CompactIndex<capacity> m_size{0};
+   std::uint64_t m_held{0};
+
+public:
+   //! Keep s (whose deferral bit is bit); false (and s is dropped) if the queue is full.
+   bool Push(const SignalSpace s, const std::uint8_t bit) {
+      if (m_size == capacity) {
+         return false;
+      }
+      m_items[m_size] = s;
+      m_bits[m_size] = bit;
+      ++m_size;
+      m_held |= std::uint64_t{1} << bit;
+      return true;
+   }
+   //! Take the oldest signal whose bit is not in deferring (the signals
+   //! the current state defers); false if every one is still deferred.
+   bool Recall(const std::uint64_t deferring, SignalSpace& s) {
+      return ((m_held & ~deferring) != 0) && Take(deferring, s);
+   }
+   size_t size() const { return m_size; }
+   bool empty() const { return m_size == 0; }
+
+private:
+   // Out of the way of the test above, which is all most dispatches do.
+   bool Take(const std::uint64_t deferring, SignalSpace& s) {
+      size_t i = 0;
+      while ((deferring >> m_bits[i]) & 1) {
+         ++i;
+      }
+      s = m_items[i];
+      m_held = 0;
+      for (size_t k=0; k<m_size; k++) {
+         if (k > i) {
+            m_items[k - 1] = m_items[k];
+            m_bits[k - 1] = m_bits[k];
+         }
+         if (k != i) {
+            m_held |= std::uint64_t{1} << m_bits[k];
+         }
+      }
+      --m_size;
+      return true;
+   }
+};
+
+//! Without a capacity nothing is deferred: deferred signals are ignored.
+template<typename SignalSpace>
+class DeferralQueue<SignalSpace, 0> {
+public:
+   bool Push(const SignalSpace, const std::uint8_t) { return false; }
+   bool Recall(const std::uint64_t, SignalSpace&) { return false; }
+   size_t size() const { return 0; }
+   bool empty() const { return true; }
+};
+
+//! Run-to-completion for a machine: a signal raised while the machine is
+//! dispatching (by an action, enter, exit or tick handler) is queued and
+//! dispatched after the current step is done, instead of re-entering the
+//! machine half way through a transition. The machines pass in how to
+//! dispatch one signal, so this works the same for all of them.
+//! With a capacity of 0 there is no queue (see below).
+//
+template<typename SignalSpace, size_t capacity>
+class RunToCompletion {
+   EventQueue<SignalSpace, capacity> m_queue;
+   bool m_isBusy{false};
+
+   // Handlers may throw; the machine must not stay busy forever when they do.
+   class Busy {
+      bool& m_isBusy;
+   public:
+      explicit Busy(bool& isBusy) : m_isBusy(isBusy) { m_isBusy = true; }
+      ~Busy() { m_isBusy = false; }
+   };
+
+public:
+   //! Dispatch s (after anything queued before it) and then what the
+   //! handlers raise, or queue s when called from a handler.
+   //! False if s had to be queued and the queue was full.
+   template<class Dispatch>
+   bool Signal(const SignalSpace s, Dispatch dispatch) {
+      if (m_isBusy) {
+         return m_queue.Push(s);
+      }
+      // One loop with a single call of dispatch, so it stays small enough to
+      // be inlined: the queued signals, then s, then what their handlers raise.
+      Busy busy(m_isBusy);
+      bool isSent = false;
+      SignalSpace next;
+      for (;;) {
+         if ( ! m_queue.Pop(next)) {
+            if (isSent) {
+               return true;
+            }
+            next = s;
+            isSent = true;
+         }
+         dispatch(next);
+      }
+   }
+
+   //! Run a step that is not a signal (starting, ticking) the same way.
+   template<class Step, class Dispatch>
+   void Run(Step step, Dispatch dispatch) {
+      if (m_isBusy) {
+         step();
+         return;
+      }
+      {
+         Busy busy(m_isBusy);
+         step();
+      }
+      DispatchQueued(ALL_QUEUED, dispatch);
+   }
+
+   //! Queue s without dispatching it; see DispatchQueued.
+   bool Enqueue(const SignalSpace s) {
+      return m_queue.Push(s);
+   }
+
+   //! Dispatch up to count queued signals (including the ones their
+   //! handlers raise) and return how many were dispatched.
+   //! Does nothing when called from a handler: the running step drains the queue.
+   template<class Dispatch>
+   size_t DispatchQueued(size_t count, Dispatch dispatch) {
+      if (m_isBusy) {
+         return 0;
+      }
+      size_t dispatched = 0;
+      SignalSpace s;
+      while (dispatched < count && m_queue.Pop(s)) {
+         Busy busy(m_isBusy);
+         dispatch(s);
+         ++dispatched;
+      }
+      return dispatched;
+   }
+
+   size_t Queued() const { return m_queue.size(); }
+};
+
+//! Without a capacity there is no queue for a signal raised while the
+//! machine is dispatching to wait in, and rather than re-entering the
+//! machine half way through a step, Signal throws ReentrantSignalException.
+//
+template<typename SignalSpace>
+class RunToCompletion<SignalSpace, 0> {
+   bool m_isBusy{false};
+
+   class Busy {
+      bool& m_isBusy;
+   public:
+      explicit Busy(bool& isBusy) : m_isBusy(isBusy) { m_isBusy = true; }
+      ~Busy() { m_isBusy = false; }
+   };
+
+public:
+   //! A handler signaled a machine that has no queue.
+   class ReentrantSignalException : public std::exception {};
+
+   template<class Dispatch>
+   bool Signal(const SignalSpace s, Dispatch dispatch) {
+      if (m_isBusy) {
+         throw ReentrantSignalException();
+      }
+      Busy busy(m_isBusy);
+      dispatch(s);
+      return true;
+   }
+   template<class Step, class Dispatch>
+   void Run(Step step, Dispatch) {
+      if (m_isBusy) {
+         step();
+         return;
+      }
+      Busy busy(m_isBusy);
+      step();
+   }
+   bool Enqueue(const SignalSpace) { return false; }
+   template<class Dispatch>
+   size_t DispatchQueued(size_t, Dispatch) { return 0; }
+   size_t Queued() const { return 0; }
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
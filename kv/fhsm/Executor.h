@@ -0,0 +1,249 @@
+#ifndef kv_fhsm_Executor_h
+#define kv_fhsm_Executor_h
+
+// Like Mailbox.h, this needs C++17.
+#include "Mailbox.h"
+#include "WorkStealingDeque.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+class Executor;
+
+//! Something an Executor runs: never on two threads at once, and again
+//! (on whichever worker gets to it first) whenever it is notified.
+//
+class Schedulable {
+public:
+   explicit Schedulable(Executor& executor) : m_executor(executor) {}
+   virtual ~Schedulable() = default;
+   Schedulable(const Schedulable&) = delete;
+   Schedulable& operator=(const Schedulable&) = delete;
+
+   //! Have Run called soon (from any thread). Notifying something that is
+   //! already scheduled does nothing; notifying it while it runs has it
+   //! checked for more work when the run is over.
+   void Notify();
+
+protected:
+   //! Do up to budget units of work.
+   virtual void Run(size_t budget) = 0;
+   //! Whether Run has anything (left) to do.
+   virtual bool HasWork() const = 0;
+
+private:
+   friend class Executor;
+   void Execute(size_t budget);
+
+   Executor& m_executor;
+   std::atomic<bool> m_isScheduled{false};
+};
+
+//! Runs Schedulables on a pool of worker threads. Each worker has its own
+//! work-stealing deque: what a worker schedules (e.g. an actor signaling
+//! another) goes on its own deque, and an idle worker steals from the
+//! others, so ready work spreads over the cores without a shared lock.
+//! Work scheduled from other threads goes through a shared Mailbox.
+//! A Schedulable runs for at most `budget` units before it goes to the
+//! back of the line, so a busy actor cannot starve the others.
+//! Destroying the executor stops and joins the workers; whatever they run
+//! must outlive it (or call WaitUntilIdle first).
+//
+class Executor {
+public:
+   static const size_t DEQUE_CAPACITY{1024};
+   static const size_t INJECTOR_CAPACITY{4096};
+   static const size_t DEFAULT_BUDGET{64};
+
+   explicit Executor(size_t threads=std::thread::hardware_concurrency(), size_t budget=DEFAULT_BUDGET)
+      : m_budget(budget) {
+      threads = std::max<size_t>(threads, 1);
+      for (size_t i=0; i<threads; i++) {
+         m_workers.emplace_back(new Worker);
+      }
+      for (size_t i=0; i<threads; i++) {
+         m_workers[i]->thread = std::thread([this, i] { Work(i); });
+      }
+   }
+   ~Executor() {
+      m_isStopping.store(true);
+      m_wakeUp.notify_all();
+      for (auto& worker : m_workers) {
+         worker->thread.join();
+      }
+   }
+   Executor(const Executor&) = delete;
+   Executor& operator=(const Executor&) = delete;
+
+   size_t ThreadCount() const { return m_workers.size(); }
+
+   //! Wait (from outside of the executor) until nothing is scheduled or running.
+   void WaitUntilIdle() const {
+      while (m_outstanding.load(std::memory_order_acquire) != 0) {
+         std::this_thread::yield();
+      }
+   }
+
+private:
+   friend class Schedulable;
+
+   struct Worker {
+      WorkStealingDeque<Schedulable, DEQUE_CAPACITY> deque;
+      std::thread thread;
+   };
+
+   // The worker (of which executor) the calling thread is, if any.
+   struct Current {
+      const Executor* executor;
+      size_t index;
+   };
+   static Current& CurrentWorker() {
+      thread_local Current current{nullptr, 0};
+      return current;
+   }
+
+   // A worker keeps what it schedules on its own deque, which it pops
+   // LIFO; work put BACK (its budget ran out) goes behind whatever waits in
+   // the injector, which is FIFO, so it cannot push back in ahead of it.
+   enum class Placement { NEAR, BACK };
+
+   void Schedule(Schedulable& work, Placement placement) {
+      m_outstanding.fetch_add(1, std::memory_order_acq_rel);
+      const auto& current = CurrentWorker();
+      bool isQueued = false;
+      if (current.executor == this) {
+         auto& deque = m_workers[current.index]->deque;
+         // A worker must not wait for room in the injector it may have to make itself.
+         isQueued = (placement == Placement::BACK) ? (m_injector.Post(&work) || deque.Push(&work)) : deque.Push(&work);
+      }
+      while ( NOT isQueued) {
+         isQueued = static_cast<bool>(m_injector.Post(&work));
+         if ( NOT isQueued) {
+            std::this_thread::yield();
+         }
+      }
+      if (m_sleeping.load() != 0) {
+         m_wakeUp.notify_one();
+      }
+   }
+
+   Schedulable* Find(size_t self) {
+      if (auto work = m_workers[self]->deque.Pop()) {
+         return work;
+      }
+      Schedulable* injected = nullptr;
+      if (m_injector.Drain([&injected](Schedulable* s) { injected = s; }, 1)) {
+         return injected;
+      }
+      for (size_t k=1; k<m_workers.size(); k++) {
+         if (auto work = m_workers[(self + k) % m_workers.size()]->deque.Steal()) {
+            return work;
+         }
+      }
+      return nullptr;
+   }
+
+   void Work(size_t self) {
+      CurrentWorker() = Current{this, self};
+      size_t idleRounds = 0;
+      while ( NOT m_isStopping.load(std::memory_order_relaxed)) {
+         if (auto work = Find(self)) {
+            work->Execute(m_budget);
+            m_outstanding.fetch_sub(1, std::memory_order_acq_rel);
+            idleRounds = 0;
+         } else if (++idleRounds < SPIN_ROUNDS) {
+            std::this_thread::yield();
+         } else {
+            // The timeout covers a wake up sent just before this worker went to sleep.
+            std::unique_lock<std::mutex> lock(m_sleep);
+            m_sleeping.fetch_add(1);
+            m_wakeUp.wait_for(lock, std::chrono::milliseconds(1));
+            m_sleeping.fetch_sub(1);
+         }
+      }
+   }
+
+   static const size_t SPIN_ROUNDS{64};
+
+   const size_t m_budget;
+   std::vector<std::unique_ptr<Worker>> m_workers;
+   Mailbox<Schedulable*, INJECTOR_CAPACITY> m_injector; // Schedule waits for room itself
+   std::atomic<size_t> m_outstanding{0};
+   std::atomic<bool> m_isStopping{false};
+   std::atomic<size_t> m_sleeping{0};
+   std::mutex m_sleep;
+   std::condition_variable m_wakeUp;
+};
+
+inline void Schedulable::Notify() {
+   if ( NOT m_isScheduled.exchange(true, std::memory_order_acq_rel)) {
+      m_executor.Schedule(*this, Executor::Placement::NEAR);
+   }
+}
+
+inline void Schedulable::Execute(size_t budget) {
+   Run(budget);
+   // Whoever notified while this ran saw it scheduled and left it to this check.
+   m_isScheduled.exchange(false, std::memory_order_acq_rel);
+   if (HasWork() && NOT m_isScheduled.exchange(true, std::memory_order_acq_rel)) {
+      m_executor.Schedule(*this, Executor::Placement::BACK);
+   }
+}
+
+//! An actor's state machine and mailbox, run by an Executor: signals
+//! posted from any thread are dispatched on one of the workers, one at a
+//! time, with the handlers never running on two threads at once.
+//! Machine is a StateMachine or SharedStateMachine (anything with Signal(s)).
+//! A handler posting to another activity runs on a worker, so BLOCK is only
+//! safe there if the receiver is sure to make room.
+//!
+//!    Activity<MySignals, decltype(m_hsm), 64> m_activity{executor, m_hsm};
+//!    m_activity.Post(MySignals::DATA);   // from anywhere
+//
+template<typename SignalSpace, class Machine, size_t capacity, OverflowPolicy policy=OverflowPolicy::REJECT>
+class Activity : public Schedulable {
+public:
+   Activity(Executor& executor, Machine& hsm) : Schedulable(executor), m_hsm(hsm) {}
+
+   //! Queue a signal for the machine and make sure it is dispatched.
+   kv::embedded::Status Post(const SignalSpace s) {
+      auto status = m_mailbox.Post(s);
+      if (status) {
+         Notify();
+      }
+      return status;
+   }
+
+   size_t Dropped() const { return m_mailbox.Dropped(); }
+
+protected:
+   void Run(size_t budget) override {
+      m_mailbox.Pump(m_hsm, budget);
+   }
+   bool HasWork() const override {
+      return NOT m_mailbox.IsEmpty();
+   }
+
+private:
+   Machine& m_hsm;
+   Mailbox<SignalSpace, capacity, policy> m_mailbox;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef kv_fhsm_FixedVector_h
+#define kv_fhsm_FixedVector_h
+
+#include "CompactIndex.h"
+
+#include <array>
+#include <cstddef>
+
+namespace kv {
+namespace fhsm {
+
+//! A vector with a fixed capacity that lives entirely inside the object,
+//! so it never touches the heap. It has the (small) part of the std::vector
+//! interface the state machine uses, so the two can be swapped.
+//! Items pushed beyond the capacity are dropped; push_back reports it.
+//
+template<typename T, size_t N>
+class FixedVector {
+   std::array<T, N> m_items{};
+   CompactIndex<N> m_size{0};
+
+public:
+   using value_type = T;
+   using iterator = T*;
+   using const_iterator = const T*;
+
+   bool push_back(const T& item) {
+      if (m_size >= N) {
+         return false;
+      }
+      m_items[m_size++] = item;
+      return true;
+   }
+   void clear() { m_size = 0; }
+   size_t size() const { return m_size; }
+   bool empty() const { return m_size == 0; }
+   static constexpr size_t capacity() { return N; }
+
+   T& operator[](size_t i) { return m_items[i]; }
+   const T& operator[](size_t i) const { return m_items[i]; }
+   iterator begin() { return m_items.data(); }
+   iterator end() { return m_items.data() + m_size; }
+   const_iterator begin() const { return m_items.data(); }
+   const_iterator end() const { return m_items.data() + m_size; }
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
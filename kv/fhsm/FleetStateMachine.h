@@ -0,0 +1,102 @@
+#ifndef kv_fhsm_FleetStateMachine_h
+#define kv_fhsm_FleetStateMachine_h
+
+#include "Blueprint.h"
+#include "EventQueue.h"
+#include "FleetTicker.h"
+#include "SharedStateMachine.h"
+
+namespace kv {
+namespace fhsm {
+
+//! The probe a FleetStateMachine runs its blueprint with: it keeps the
+//! machine in the ticker's active set, with the tick period of its state,
+//! while that state resolves to a tick handler and out of it otherwise.
+//
+template<class Definition>
+class FleetProbe : public NoInstrumentation<Definition> {
+public:
+   using IndexType = typename Definition::IndexType;
+
+   FleetProbe(FleetTicker::Member& member, const Definition& definition, FleetTicker& ticker)
+      : m_member(member), m_definition(definition), m_ticker(ticker) {}
+   ~FleetProbe() {
+      m_ticker.Leave(m_member);
+   }
+   FleetProbe(const FleetProbe&) = delete;
+   FleetProbe& operator=(const FleetProbe&) = delete;
+
+   void Started(const IndexType initial) { Follow(initial); }
+   void Transitioned(const IndexType, const IndexType to) { Follow(to); }
+
+private:
+   void Follow(const IndexType state) {
+      if (m_definition.HasTick(state)) {
+         m_ticker.Join(m_member, m_definition.GetTickPeriod(state));
+      } else {
+         m_ticker.Leave(m_member);
+      }
+   }
+
+   FleetTicker::Member& m_member;
+   const Definition& m_definition;
+   FleetTicker& m_ticker;
+};
+
+//! A SharedStateMachine that is ticked by a FleetTicker instead of by its
+//! actor: it is in the ticker's active set while its current state
+//! resolves to a tick handler (its own or an ancestor's) and out of it
+//! while it does not, so a machine waiting in a passive state is skipped.
+//! Membership (and the tick period the ticker schedules the machine with)
+//! is updated by Start and by every transition, and the ticker staggers
+//! the phase of the machine's tick periods.
+//!
+//!    static FleetTicker ticker;
+//!    FleetStateMachine<MyBlueprint> m_hsm{*this, Blueprint(), ticker};
+//!    ...
+//!    ticker.Tick();   // from the loop that owns the machines
+//!
+//! The machine is linked into the ticker by address, so it can be neither
+//! copied nor moved. queueCapacity is as for SharedStateMachine; like
+//! StateMachine it keeps up to KV_FHSM_DEFERRAL_CAPACITY deferred signals
+//! and the history of every state unless given another deferralCapacity or
+//! historyCapacity.
+//
+template<class Definition, size_t queueCapacity=0,
+         size_t deferralCapacity=DEFAULT_DEFERRAL_CAPACITY, size_t historyCapacity=Definition::COUNT>
+class FleetStateMachine
+   : public FleetTicker::Member,
+     private BasicSharedStateMachine<Definition, queueCapacity, FleetProbe<Definition>, deferralCapacity, historyCapacity> {
+   using Machine = BasicSharedStateMachine<Definition, queueCapacity, FleetProbe<Definition>, deferralCapacity, historyCapacity>;
+
+public:
+   using typename Machine::Actor;
+   using typename Machine::IndexType;
+   using typename Machine::StateSpace;
+   using typename Machine::SignalSpace;
+   using typename Machine::ReentrantSignalException;
+
+   //! The blueprint and the ticker must outlive the machine.
+   FleetStateMachine(Actor& actor, const Definition& definition, FleetTicker& ticker)
+      : FleetTicker::Member(ticker.NextPhase()), Machine(actor, definition, *this, definition, ticker) {}
+
+   //! Enter the initial state of the blueprint (joining the active set if it ticks).
+   using Machine::Start;
+
+   //! Tick the current active state; the ticker does so on the frames its tick handler is due.
+   void Tick() override {
+      this->Run([this](Actor& actor, IndexType current) { this->GetDefinition().TickDue(actor, current); });
+   }
+
+   using Machine::Signal;
+   using Machine::Enqueue;
+   using Machine::DispatchQueued;
+   using Machine::Queued;
+   using Machine::Deferred;
+   using Machine::CurrentState;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
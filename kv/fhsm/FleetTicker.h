@@ -0,0 +1,157 @@
+#ifndef kv_fhsm_FleetTicker_h
+#define kv_fhsm_FleetTicker_h
+
+#include "TimingWheel.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Ticks the active set of a fleet of machines: only those that have
+//! joined it, which FleetStateMachine does whenever its current state (or
+//! one of its ancestors) has a tick handler and leaves it otherwise. A
+//! fleet of mostly waiting actors then costs a Tick in proportion to the
+//! few that have something to do, not to the fleet.
+//! A member joins with the tick period of its state (see
+//! State::SetTickPeriod). Members with a period of 1 are in a list that
+//! every Tick walks; the others are scheduled on a timing wheel for the
+//! next frame they are due on, so a frame costs nothing for a member that
+//! is not due on it. Each member has a phase, and is due on the frames
+//! whose number plus its phase is a multiple of its period; the ticker
+//! hands out consecutive phases (NextPhase), so the handlers of a hundred
+//! members with a period of 10 are spread evenly over the frames of the
+//! period instead of all running on the same one.
+//! Joining and leaving are O(1) and never allocate. A ticker is not
+//! thread safe; use it from the thread that owns the machines.
+//
+class FleetTicker {
+public:
+   //! Something a FleetTicker can tick; it is the list node and the timer.
+   class Member : private TimerEntry {
+   public:
+      explicit Member(const std::uint32_t phase=0) : m_phase(phase) {}
+
+      bool IsActive() const { return m_period != 0; }
+
+      //! Tick (or step if you like) the member.
+      virtual void Tick() = 0;
+
+   private:
+      friend FleetTicker;
+      void Expire() override { m_ticker->Due(*this); }
+
+      FleetTicker* m_ticker{nullptr};
+      Member* m_previous{nullptr};
+      Member* m_next{nullptr};
+      std::uint32_t m_phase;
+      std::uint32_t m_period{0}; // 0 while it is not in the active set
+   };
+
+   FleetTicker() = default;
+   FleetTicker(const FleetTicker&) = delete;
+   FleetTicker& operator=(const FleetTicker&) = delete;
+
+   //! Add a member to the active set with a tick period (at least 1), or
+   //! change its period if it is in it already.
+   void Join(Member& member, const std::uint32_t period=1) {
+      if (member.m_period == period) {
+         return;
+      }
+      Leave(member);
+      member.m_ticker = this;
+      member.m_period = period;
+      if (period == 1) {
+         member.m_previous = nullptr;
+         member.m_next = m_head;
+         if (m_head) {
+            m_head->m_previous = &member;
+         }
+         m_head = &member;
+      } else {
+         Schedule(member);
+      }
+      ++m_size;
+   }
+
+   //! Remove a member from the active set (if it is in it).
+   void Leave(Member& member) {
+      if ( NOT member.IsActive()) {
+         return;
+      }
+      if (member.m_period == 1) {
+         if (m_cursor == &member) {
+            m_cursor = member.m_next;
+         }
+         if (member.m_previous) {
+            member.m_previous->m_next = member.m_next;
+         } else {
+            m_head = member.m_next;
+         }
+         if (member.m_next) {
+            member.m_next->m_previous = member.m_previous;
+         }
+         member.m_previous = nullptr;
+         member.m_next = nullptr;
+      } else {
+         m_wheel.Cancel(member);
+      }
+      member.m_period = 0;
+      --m_size;
+   }
+
+   //! Tick every member of the active set that is due on this frame once.
+   //! Members may join or leave (themselves or each other) while they are
+   //! ticked; those that join are first ticked by the next Tick.
+   void Tick() {
+      const auto frame = m_frame++;
+      m_cursor = m_head;
+      while (m_cursor) {
+         Member* member = m_cursor;
+         m_cursor = member->m_next;
+         member->Tick();
+      }
+      m_wheel.AdvanceTo(frame + 1); // the periodic members due on this frame
+   }
+
+   //! The phase for the next machine: consecutive machines get consecutive
+   //! phases, whatever their periods turn out to be.
+   std::uint32_t NextPhase() { return m_nextPhase++; }
+
+   //! How many members are in the active set.
+   size_t Size() const { return m_size; }
+
+private:
+   using Frame = TimerEntry::Time;
+
+   // A member due on frame f has its deadline at f + 1, which is where
+   // the Tick of frame f advances the wheel to; the first frame it can be
+   // due on is the next one to start.
+   void Schedule(Member& member) {
+      const Frame period = member.m_period;
+      const Frame due = m_frame + (period - (m_frame + member.m_phase) % period) % period;
+      m_wheel.Arm(member, due + 1 - m_wheel.Now());
+   }
+   // Scheduled again before it is ticked, so the member can leave or change its period in its Tick.
+   void Due(Member& member) {
+      m_wheel.Arm(member, member.m_period);
+      member.Tick();
+   }
+
+   Member* m_head{nullptr}; // the members with a period of 1
+   Member* m_cursor{nullptr}; // the next member Tick will tick
+   TimingWheel<> m_wheel; // the others, by the frame they are due on next
+   Frame m_frame{0}; // the frames started so far
+   size_t m_size{0};
+   std::uint32_t m_nextPhase{0};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
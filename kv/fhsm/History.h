@@ -0,0 +1,67 @@
+#ifndef kv_fhsm_History_h
+#define kv_fhsm_History_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace kv {
+namespace fhsm {
+
+//! Where a transition into a composite state leads: to the state itself,
+//! to its child that was active when it was last left (SHALLOW) or to the
+//! state that was active below it then (DEEP).
+enum class HistoryKind : std::uint8_t { NONE, SHALLOW, DEEP };
+
+//! What a machine remembers of the states that history transitions lead
+//! to: per such state (numbered by the Blueprint), the state that was
+//! active below it when it was last left and the child of it on the way
+//! there. States numbered beyond the capacity are not remembered, and
+//! neither is a state that was never left; history transitions to them
+//! enter the state itself.
+//
+template<class Definition, size_t capacity>
+class StateHistory {
+public:
+   using IndexType = typename Definition::IndexType;
+   static const size_t CAPACITY{capacity};
+
+   StateHistory() {
+      m_deep.fill(static_cast<IndexType>(Definition::COUNT));
+      m_shallow.fill(static_cast<IndexType>(Definition::COUNT));
+   }
+
+   void Record(const size_t slot, const IndexType deep, const IndexType shallow) {
+      if (slot < capacity) {
+         m_deep[slot] = deep;
+         m_shallow[slot] = shallow;
+      }
+   }
+   //! The state to restore for the slot (COUNT if there is none).
+   IndexType Find(const size_t slot, const HistoryKind kind) const {
+      if (slot >= capacity) {
+         return static_cast<IndexType>(Definition::COUNT);
+      }
+      return (kind == HistoryKind::DEEP) ? m_deep[slot] : m_shallow[slot];
+   }
+
+private:
+   std::array<IndexType, capacity> m_deep;
+   std::array<IndexType, capacity> m_shallow;
+};
+
+//! Without a capacity nothing is remembered: history transitions enter their state.
+template<class Definition>
+class StateHistory<Definition, 0> {
+public:
+   using IndexType = typename Definition::IndexType;
+   static const size_t CAPACITY{0};
+
+   void Record(const size_t, const IndexType, const IndexType) {}
+   IndexType Find(const size_t, const HistoryKind) const { return static_cast<IndexType>(Definition::COUNT); }
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
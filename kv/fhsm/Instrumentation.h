@@ -0,0 +1,213 @@
+#ifndef kv_fhsm_Instrumentation_h
+#define kv_fhsm_Instrumentation_h
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifndef KV_FHSM_COUNTED_SIGNALS
+#define KV_FHSM_COUNTED_SIGNALS 64
+#endif
+
+namespace kv {
+namespace fhsm {
+
+// An instrumentation policy is handed to the Blueprint's Start and Signal
+// and told what they do: for every transition, what its guard said and the
+// edge it takes and, if WALKS_STATES, the states it exits and enters (which
+// the blueprint then has to walk); for every signal a state defers, that
+// it did; and last, once the signal has been dealt with (and before any
+// deferred one is dispatched again), the state it was dispatched to and
+// whether anything consumed it. The policy is a template of the definition
+// (see BasicStateMachine and SharedStateMachine).
+
+//! The default policy: every hook is empty, so it compiles to nothing.
+//
+template<class Definition>
+class NoInstrumentation {
+public:
+   using IndexType = typename Definition::IndexType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   static const bool WALKS_STATES{false};
+
+   void Started(const IndexType) {}
+   void Dispatched(const IndexType, const SignalSpace, const bool) {}
+   void Guarded(const IndexType, const IndexType, const bool) {}
+   void Deferred(const IndexType, const SignalSpace) {}
+   void Exited(const IndexType) {}
+   void Entered(const IndexType) {}
+   void Transitioned(const IndexType, const IndexType) {}
+};
+
+// Where CountingInstrumentation counts the dispatches of a signal: at its
+// offset in the signal range if the definition has one, else in a column
+// given out on its first dispatch, from a table reserved up front (kept
+// sorted by signal). Both give `columns` for a signal without a column.
+template<class SignalTables, typename SignalSpace, size_t columns, bool dense = SignalTables::IS_DENSE>
+class SignalColumns {
+   using Column = std::pair<int, size_t>; // signal, column
+   std::vector<Column> m_signals;
+
+   static int Key(const SignalSpace s) { return static_cast<int>(s); }
+   typename std::vector<Column>::const_iterator Lookup(const SignalSpace s) const {
+      return std::lower_bound(m_signals.begin(), m_signals.end(), Key(s), [](const Column& c, int key) { return c.first < key; });
+   }
+
+public:
+   SignalColumns() { m_signals.reserve(columns); }
+
+   size_t Find(const SignalSpace s) const {
+      auto at = Lookup(s);
+      return (at != m_signals.end() && at->first == Key(s)) ? at->second : columns;
+   }
+   size_t Take(const SignalSpace s) {
+      auto at = Lookup(s);
+      if (at != m_signals.end() && at->first == Key(s)) {
+         return at->second;
+      }
+      if (m_signals.size() == columns) {
+         return columns;
+      }
+      const auto column = m_signals.size();
+      m_signals.insert(m_signals.begin() + (at - m_signals.cbegin()), Column(Key(s), column));
+      return column;
+   }
+};
+
+template<class SignalTables, typename SignalSpace, size_t columns>
+class SignalColumns<SignalTables, SignalSpace, columns, true> {
+public:
+   size_t Find(const SignalSpace s) const {
+      const auto i = SignalTables::SignalToIndex(s);
+      return (i < columns) ? i : columns;
+   }
+   size_t Take(const SignalSpace s) { return Find(s); }
+};
+
+//! Counts what a machine does: dispatches per (state, signal), consumed
+//! and unhandled signals, transitions per edge, entries and exits per
+//! state, and how long it has been in each (leaf) state.
+//! The per signal and per edge counts are kept out of line, in tables
+//! allocated once with the policy, so counting never allocates. Without a
+//! signal range the first KV_FHSM_COUNTED_SIGNALS distinct signals get
+//! their dispatches counted per state, and those of any others only in
+//! `uncounted` (and consumed or unhandled).
+//! Snapshot and Reset do not stop the machine; like the machine itself
+//! they are to be called from the thread that owns it (from a handler or
+//! between signals), e.g. to export the counts periodically.
+//
+template<class Definition>
+class CountingInstrumentation {
+public:
+   using IndexType = typename Definition::IndexType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using Clock = std::chrono::steady_clock;
+   using Count = std::uint64_t;
+   static const bool WALKS_STATES{true};
+   static const size_t COUNT{Definition::COUNT};
+   //! How many distinct signals have their dispatches counted per state.
+   static const size_t SIGNALS{Definition::SignalTables::IS_DENSE ? Definition::SignalTables::SIGNAL_COUNT : KV_FHSM_COUNTED_SIGNALS};
+
+   //! The counts, all zero after a Reset.
+   class Counts {
+   public:
+      Count consumed{0};
+      Count unhandled{0};
+      Count uncounted{0}; // dispatches of signals beyond the SIGNALS that are counted per state
+      std::array<Count, COUNT> entries{};
+      std::array<Count, COUNT> exits{};
+      std::array<Clock::duration, COUNT> timeInState{};
+
+      Counts() : m_dispatched(COUNT * SIGNALS), m_transitions(COUNT * COUNT) {}
+
+      //! How often signal s was dispatched while state i was current.
+      Count Dispatched(const IndexType i, const SignalSpace s) const {
+         const auto column = m_columns.Find(s);
+         return (column != SIGNALS) ? m_dispatched[i * SIGNALS + column] : 0;
+      }
+      //! How many transitions went from state `from` to state `to`.
+      Count Transitions(const IndexType from, const IndexType to) const { return m_transitions[from * COUNT + to]; }
+
+   private:
+      friend class CountingInstrumentation;
+
+      // Zero the counts, keeping the tables and the columns given out.
+      void Clear() {
+         consumed = unhandled = uncounted = 0;
+         entries.fill(0);
+         exits.fill(0);
+         timeInState.fill(Clock::duration::zero());
+         std::fill(m_dispatched.begin(), m_dispatched.end(), 0);
+         std::fill(m_transitions.begin(), m_transitions.end(), 0);
+      }
+
+      SignalColumns<typename Definition::SignalTables, SignalSpace, SIGNALS> m_columns;
+      std::vector<Count> m_dispatched;  // [state * SIGNALS + column]
+      std::vector<Count> m_transitions; // [from * COUNT + to]
+   };
+
+   void Started(const IndexType initial) {
+      m_current = initial;
+      m_since = Clock::now();
+   }
+   void Dispatched(const IndexType current, const SignalSpace s, const bool consumed) {
+      const auto column = m_counts.m_columns.Take(s);
+      ++((column != SIGNALS) ? m_counts.m_dispatched[current * SIGNALS + column] : m_counts.uncounted);
+      ++(consumed ? m_counts.consumed : m_counts.unhandled);
+   }
+   void Guarded(const IndexType, const IndexType, const bool) {}
+   void Deferred(const IndexType, const SignalSpace) {}
+   void Exited(const IndexType i) { ++m_counts.exits[i]; }
+   void Entered(const IndexType i) { ++m_counts.entries[i]; }
+   void Transitioned(const IndexType from, const IndexType to) {
+      ++m_counts.m_transitions[from * COUNT + to];
+      const auto now = Clock::now();
+      m_counts.timeInState[from] += now - m_since;
+      m_since = now;
+      m_current = to;
+   }
+
+   //! The counts so far, including the time in the current state up to now.
+   Counts Snapshot() const {
+      Counts counts = m_counts;
+      if (m_current != COUNT) {
+         counts.timeInState[m_current] += Clock::now() - m_since;
+      }
+      return counts;
+   }
+
+   //! Start counting from zero again (time in the current state included).
+   void Reset() {
+      m_counts.Clear();
+      m_since = Clock::now();
+   }
+
+   //! Snapshot then Reset, losing nothing in between.
+   Counts SnapshotAndReset() {
+      const auto now = Clock::now();
+      Counts counts = m_counts;
+      if (m_current != COUNT) {
+         counts.timeInState[m_current] += now - m_since;
+      }
+      m_counts.Clear();
+      m_since = now;
+      return counts;
+   }
+
+private:
+   Counts m_counts;
+   IndexType m_current{COUNT};
+   Clock::time_point m_since{};
+};
+
+template<class Definition>
+const size_t CountingInstrumentation<Definition>::SIGNALS;
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef kv_fhsm_MachineFleet_h
+#define kv_fhsm_MachineFleet_h
+
+#include "Blueprint.h"
+#include "SignalIndex.h"
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Many machines of one Blueprint kept as a structure of arrays: the current
+//! states side by side (a byte each for up to 254 states) and the actors in
+//! an array of their own, touched only when a handler has to run.
+//!
+//! Broadcast sends one signal to every machine with a table driven kernel.
+//! For each state the blueprint says what the signal does there: nothing,
+//! a transition that runs no handler (no action, guard, exit or enter
+//! handler and no state change callback) or something else. The first two
+//! are a next state lookup done for all the machines in one pass over the
+//! states (with SSSE3, sixteen machines per shuffle when there are at most
+//! 16 states), so broadcasting them runs at memory bandwidth. Only the
+//! machines for which the signal has handlers take the usual dispatch.
+//!
+//! An indexed fleet also keeps a SignalIndex up to date with every state
+//! change, and Publish sends a signal to only the machines whose state
+//! handles it, in time proportional to them rather than to the fleet.
+//! Broadcasts then take the portable loop, which reports the changes.
+//!
+//! There are no queues, so signals raised by handlers are dispatched right
+//! away, and deferred signals are ignored; a handler must not signal the fleet while it
+//! broadcasts or publishes.
+//
+template<class Definition, bool indexed=false>
+class MachineFleet {
+public:
+   using Actor = typename Definition::ActorType;
+   using IndexType = typename Definition::IndexType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+
+   //! The blueprint must outlive the fleet and be concluded before Add().
+   explicit MachineFleet(const Definition& definition) : m_definition(definition), m_index(definition) {}
+
+   // The actors are referred to by their place in the fleet.
+   MachineFleet(const MachineFleet&) = delete;
+   MachineFleet& operator=(const MachineFleet&) = delete;
+
+   void Reserve(size_t machines) {
+      m_current.reserve(machines);
+      m_actors.reserve(machines);
+   }
+
+   //! Start a machine for actor (which must outlive the fleet); returns its place in the fleet.
+   size_t Add(Actor& actor) {
+      const auto initial = m_definition.Start(actor);
+      m_actors.push_back(&actor);
+      m_current.push_back(initial);
+      if (indexed) {
+         m_index.Move(static_cast<typename Index::Machine>(m_current.size() - 1), Index::NONE, initial);
+      }
+      return m_current.size() - 1;
+   }
+
+   size_t Size() const { return m_current.size(); }
+
+   StateSpace CurrentState(size_t machine) const { return m_definition.IndexToState(m_current[machine]); }
+
+   //! Signal one machine.
+   void Signal(size_t machine, const SignalSpace s) {
+      const auto previous = m_current[machine];
+      m_definition.Signal(*m_actors[machine], m_current[machine], s);
+      Moved(machine, previous);
+   }
+
+   //! Signal every machine, in the order they were added. Returns how many
+   //! took the usual dispatch (because the signal has handlers in their state).
+   size_t Broadcast(const SignalSpace s) {
+      Plan(s);
+#if defined(__SSSE3__)
+      if ( NOT indexed && sizeof(IndexType) == 1 && Definition::COUNT <= LANES) {
+         return BroadcastShuffled(s);
+      }
+#endif
+      return BroadcastFrom(0, s);
+   }
+
+   //! Signal the machines whose current state handles s (in no particular
+   //! order); returns how many that was. Only an indexed fleet publishes.
+   size_t Publish(const SignalSpace s) {
+      static_assert(indexed, "Only a MachineFleet<Definition, true> keeps the index to publish with");
+      // Dispatching changes the sets, so walk a copy.
+      m_publishing = m_index.Subscribers(s);
+      for (auto machine : m_publishing) {
+         Signal(machine, s);
+      }
+      return m_publishing.size();
+   }
+
+private:
+   static const size_t LANES{16};
+   // Padded so the first sixteen entries can always be loaded at once.
+   static const size_t PLAN_SIZE{(Definition::COUNT + LANES - 1) / LANES * LANES};
+   // What the plan says for the states where the signal runs handlers.
+   static const IndexType DISPATCH{static_cast<IndexType>(Definition::UNKNOWN)};
+   using Index = SignalIndex<Definition>;
+   // What an unindexed fleet keeps instead of the index: nothing.
+   struct NoIndex {
+      explicit NoIndex(const Definition&) {}
+      void Move(typename Index::Machine, IndexType, IndexType) {}
+   };
+
+   void Moved(size_t machine, const IndexType previous) {
+      if (indexed && m_current[machine] != previous) {
+         m_index.Move(static_cast<typename Index::Machine>(machine), previous, m_current[machine]);
+      }
+   }
+
+   // The next state of every state for s, or DISPATCH.
+   void Plan(const SignalSpace s) {
+      const bool notes = m_definition.GetStateChangeCallback() != nullptr;
+      for (IndexType i=0; i<Definition::COUNT; i++) {
+         auto r = m_definition.FindResolution(i, s);
+         // A fleet keeps no deferred signals: those are ignored.
+         if ( NOT r || ( NOT r->action && r->destination == Definition::COUNT)) {
+            m_plan[i] = i;
+         } else if ( NOT notes && NOT r->action && NOT r->allow && r->destination != Definition::COUNT
+                    && r->exits.begin == r->exits.end && r->entries.begin == r->entries.end) {
+            m_plan[i] = r->destination;
+         } else {
+            m_plan[i] = DISPATCH;
+         }
+      }
+   }
+
+   size_t BroadcastFrom(size_t first, const SignalSpace s) {
+      size_t dispatched = 0;
+      for (size_t m=first; m<m_current.size(); m++) {
+         const IndexType previous = m_current[m];
+         const IndexType next = m_plan[previous];
+         if (next != DISPATCH) {
+            m_current[m] = next;
+            Moved(m, previous);
+         } else {
+            Signal(m, s);
+            ++dispatched;
+         }
+      }
+      return dispatched;
+   }
+
+#if defined(__SSSE3__)
+   // The plan fits in one register: looking up sixteen machines is one shuffle.
+   size_t BroadcastShuffled(const SignalSpace s) {
+      const __m128i plan = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_plan.data()));
+      const __m128i dispatch = _mm_set1_epi8(static_cast<char>(DISPATCH));
+      size_t dispatched = 0;
+      size_t m = 0;
+      for (; m + LANES <= m_current.size(); m += LANES) {
+         auto lanes = reinterpret_cast<__m128i*>(&m_current[m]);
+         const __m128i current = _mm_loadu_si128(lanes);
+         const __m128i next = _mm_shuffle_epi8(plan, current);
+         const __m128i isDispatched = _mm_cmpeq_epi8(next, dispatch);
+         _mm_storeu_si128(lanes, _mm_or_si128(_mm_and_si128(isDispatched, current), _mm_andnot_si128(isDispatched, next)));
+         for (auto mask = static_cast<unsigned>(_mm_movemask_epi8(isDispatched)); mask; mask &= mask - 1) {
+            const size_t k = m + static_cast<size_t>(__builtin_ctz(mask));
+            m_definition.Signal(*m_actors[k], m_current[k], s);
+            ++dispatched;
+         }
+      }
+      return dispatched + BroadcastFrom(m, s);
+   }
+#endif
+
+   const Definition& m_definition;
+   std::vector<IndexType> m_current;
+   std::vector<Actor*> m_actors;
+   std::array<IndexType, PLAN_SIZE> m_plan{};
+   typename std::conditional<indexed, Index, NoIndex>::type m_index; // built only for an indexed fleet
+   std::vector<typename Index::Machine> m_publishing;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
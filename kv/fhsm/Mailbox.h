@@ -0,0 +1,173 @@
+#ifndef kv_fhsm_Mailbox_h
+#define kv_fhsm_Mailbox_h
+
+// Unlike the rest of kv/fhsm this needs C++17 (for kv/embedded/status.hpp).
+#include "EventQueue.h"
+#include "../embedded/status.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! What Mailbox::Post does when the mailbox is full.
+enum class OverflowPolicy {
+   REJECT,    //!< drop the new signal and return kv::embedded::Rejected
+   OVERWRITE, //!< drop the oldest queued signal to make room
+   BLOCK,     //!< wait (yielding) until the owner has made room
+};
+
+//! A bounded, lock-free mailbox through which any thread can post signals
+//! to a state machine that is owned (signaled and ticked) by one thread.
+//! The owner drains it into its machine with Pump or Tick; the handlers
+//! run on the owner's thread, so the actor needs no locks.
+//!
+//!    Mailbox<MySignals, 64> m_mailbox;        // next to m_hsm in the actor
+//!    m_mailbox.Post(MySignals::DATA);         // from an I/O thread
+//!    m_mailbox.Tick(m_hsm);                   // from the owner's loop
+//!
+//! Each slot carries a sequence number (D. Vyukov's bounded queue), so
+//! producers only contend on one atomic counter and never wait for each
+//! other. The consumer side is safe for several threads as well, which is
+//! what lets OVERWRITE producers drop the oldest signal.
+//! The capacity must be a power of two.
+//
+template<typename SignalSpace, size_t capacity, OverflowPolicy policy=OverflowPolicy::REJECT>
+class Mailbox {
+   static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "The capacity must be a power of two");
+   static const size_t MASK{capacity - 1};
+   // Keep the producers' and the consumer's counters on separate cache lines.
+   static const size_t CACHE_LINE{64};
+
+   struct Slot {
+      std::atomic<size_t> sequence;
+      SignalSpace signal;
+   };
+
+public:
+   Mailbox() {
+      for (size_t i=0; i<capacity; i++) {
+         m_slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+   }
+   Mailbox(const Mailbox&) = delete;
+   Mailbox& operator=(const Mailbox&) = delete;
+
+   //! Queue a signal for the owner (from any thread).
+   //! Returns kv::embedded::Rejected if the mailbox is full and the policy is REJECT.
+   kv::embedded::Status Post(const SignalSpace s) {
+      if (TryPush(s)) {
+         return kv::embedded::Success;
+      }
+      if constexpr (policy == OverflowPolicy::REJECT) {
+         m_dropped.fetch_add(1, std::memory_order_relaxed);
+         return kv::embedded::Rejected;
+      } else if constexpr (policy == OverflowPolicy::OVERWRITE) {
+         SignalSpace oldest;
+         do {
+            if (TryPop(oldest)) {
+               m_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+         } while ( NOT TryPush(s));
+         return kv::embedded::Success;
+      } else {
+         while ( NOT TryPush(s)) {
+            std::this_thread::yield();
+         }
+         return kv::embedded::Success;
+      }
+   }
+
+   //! Call f(signal) for up to count posted signals, oldest first, and
+   //! return how many there were (owner only).
+   template<class F>
+   size_t Drain(F f, size_t count=ALL_QUEUED) {
+      size_t drained = 0;
+      SignalSpace s;
+      while (drained < count && TryPop(s)) {
+         f(s);
+         ++drained;
+      }
+      return drained;
+   }
+
+   //! Signal the machine with up to count posted signals (owner only).
+   template<class Machine>
+   size_t Pump(Machine& hsm, size_t count=ALL_QUEUED) {
+      return Drain([&hsm](const SignalSpace s) { hsm.Signal(s); }, count);
+   }
+
+   //! Pump everything posted so far, then tick the machine (owner only).
+   template<class Machine>
+   void Tick(Machine& hsm) {
+      Pump(hsm);
+      hsm.Tick();
+   }
+
+   //! True if nothing has been posted since the last drain (any thread; a
+   //! signal that is being posted counts as posted).
+   bool IsEmpty() const {
+      return m_dequeue.load(std::memory_order_acquire) == m_enqueue.load(std::memory_order_acquire);
+   }
+
+   //! How many signals REJECT or OVERWRITE have dropped so far.
+   size_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+   bool TryPush(const SignalSpace s) {
+      size_t position = m_enqueue.load(std::memory_order_relaxed);
+      for (;;) {
+         Slot& slot = m_slots[position & MASK];
+         const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+         const auto lag = static_cast<std::ptrdiff_t>(sequence - position);
+         if (lag == 0) {
+            if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+               slot.signal = s;
+               slot.sequence.store(position + 1, std::memory_order_release);
+               return true;
+            }
+         } else if (lag < 0) {
+            return false; // full
+         } else {
+            position = m_enqueue.load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   bool TryPop(SignalSpace& s) {
+      size_t position = m_dequeue.load(std::memory_order_relaxed);
+      for (;;) {
+         Slot& slot = m_slots[position & MASK];
+         const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+         const auto lag = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+         if (lag == 0) {
+            if (m_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+               s = slot.signal;
+               slot.sequence.store(position + capacity, std::memory_order_release);
+               return true;
+            }
+         } else if (lag < 0) {
+            return false; // empty
+         } else {
+            position = m_dequeue.load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   std::array<Slot, capacity> m_slots;
+   alignas(CACHE_LINE) std::atomic<size_t> m_enqueue{0};
+   alignas(CACHE_LINE) std::atomic<size_t> m_dequeue{0};
+   alignas(CACHE_LINE) std::atomic<size_t> m_dropped{0};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef kv_fhsm_OrthogonalStateMachine_h
+#define kv_fhsm_OrthogonalStateMachine_h
+
+#include "Blueprint.h"
+#include "EventQueue.h"
+
+#include <array>
+#include <exception>
+
+namespace kv {
+namespace fhsm {
+
+//! A hierarchical state machine with orthogonal regions: one active state
+//! in each of several trees of a shared Blueprint, like a SharedStateMachine
+//! per tree but in one machine. Its configuration is an array of one state
+//! index per region, and Signal dispatches the signal to every region,
+//! region 0 first: a lookup in the blueprint's resolved table of each
+//! region's current state, as one SharedStateMachine per region would do.
+//!
+//! A region is a whole tree of the blueprint (the trees of a forest are
+//! defined as usual, with SetNoParent() for their roots) and is named by
+//! the state it starts in; transitions must stay within their tree, and
+//! its states may not defer signals (the machine has nowhere to keep them).
+//! Every region has an instrumentation policy object of its own, as a
+//! machine of its own would.
+//!
+//! Run to completion holds for the whole machine: a signal raised by a
+//! handler in one region is queued until every region has had the current
+//! signal; without a queueCapacity Signal throws ReentrantSignalException
+//! instead.
+//
+template<class Definition, size_t regions, size_t queueCapacity=0, template<class> class Instrumentation=NoInstrumentation>
+class OrthogonalStateMachine {
+public:
+   using Probe = Instrumentation<Definition>;
+   using Actor = typename Definition::ActorType;
+   using IndexType = typename Definition::IndexType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using ReentrantSignalException = typename RunToCompletion<SignalSpace, 0>::ReentrantSignalException;
+
+   //! Two regions start in the same tree, a transition leaves a region's
+   //! tree, or a state of a region defers a signal.
+   class InvalidRegionsException : public std::exception {};
+
+   //! The blueprint must outlive the machine and be concluded before the
+   //! machine is created; initial holds the state each region starts in.
+   OrthogonalStateMachine(Actor& actor, const Definition& definition, const std::array<StateSpace, regions>& initial)
+      : m_definition(definition), m_actor(actor) {
+      for (size_t r=0; r<regions; r++) {
+         m_current[r] = definition.StateToIndex(initial[r]);
+      }
+      CheckRegions();
+   }
+
+   //! Enter the initial state of every region, region 0 first.
+   void Start() {
+      m_queue.Run([this] {
+         for (size_t r=0; r<regions; r++) {
+            m_current[r] = m_definition.StartIn(m_actor, m_current[r], m_probes[r]);
+         }
+      }, Dispatcher());
+   }
+
+   //! Tick the current state of every region.
+   void Tick() {
+      m_queue.Run([this] {
+         for (auto current : m_current) {
+            m_definition.Tick(m_actor, current, m_ticks);
+         }
+         ++m_ticks;
+      }, Dispatcher());
+   }
+
+   //! Send a signal to every region (false if it had to be queued and the queue was full).
+   bool Signal(const SignalSpace s) {
+      return m_queue.Signal(s, Dispatcher());
+   }
+
+   //! Queue a signal without dispatching it (false if the queue is full).
+   bool Enqueue(const SignalSpace s) {
+      return m_queue.Enqueue(s);
+   }
+
+   //! Dispatch up to count queued signals in one go; returns how many were.
+   size_t DispatchQueued(size_t count=ALL_QUEUED) {
+      return m_queue.DispatchQueued(count, Dispatcher());
+   }
+
+   size_t Queued() const { return m_queue.Queued(); }
+
+   //! The current (leaf) state of a region.
+   StateSpace CurrentState(size_t region) const { return m_definition.IndexToState(m_current[region]); }
+
+   //! Whether state is active: the current state of a region or one of its ancestors.
+   bool IsIn(const StateSpace state) const {
+      const auto i = m_definition.StateToIndex(state);
+      for (auto current : m_current) {
+         for (IndexType level=current; level!=Definition::COUNT; level=m_definition.GetParent(level)) {
+            if (level == i) {
+               return true;
+            }
+         }
+      }
+      return false;
+   }
+
+   //! The instrumentation policy object of a region, e.g. for Snapshot and Reset.
+   Probe& GetInstrumentation(size_t region) { return m_probes[region]; }
+   const Probe& GetInstrumentation(size_t region) const { return m_probes[region]; }
+
+private:
+   auto Dispatcher() {
+      return [this](const SignalSpace s) {
+         for (size_t r=0; r<regions; r++) {
+            m_definition.Signal(m_actor, m_current[r], s, m_probes[r]);
+         }
+      };
+   }
+
+   // Each region is a tree of its own that no transition leaves and no state defers in.
+   void CheckRegions() const {
+      for (size_t r=0; r<regions; r++) {
+         const auto root = m_definition.GetRoot(m_current[r]);
+         for (size_t other=0; other<r; other++) {
+            if (m_definition.GetRoot(m_current[other]) == root) {
+               throw InvalidRegionsException();
+            }
+         }
+         for (IndexType i=0; i<Definition::COUNT; i++) {
+            if (m_definition.GetRoot(i) == root && (m_definition.LeavesTree(i) || m_definition.DefersAny(i))) {
+               throw InvalidRegionsException();
+            }
+         }
+      }
+   }
+
+   const Definition& m_definition;
+   Actor& m_actor;
+   std::array<IndexType, regions> m_current{};
+   RunToCompletion<SignalSpace, queueCapacity> m_queue;
+   std::array<Probe, regions> m_probes;
+   std::uint32_t m_ticks{0};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
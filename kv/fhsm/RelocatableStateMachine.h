@@ -0,0 +1,82 @@
+#ifndef kv_fhsm_RelocatableStateMachine_h
+#define kv_fhsm_RelocatableStateMachine_h
+
+#include "Blueprint.h"
+#include "EventQueue.h"
+
+namespace kv {
+namespace fhsm {
+
+//! A hierarchical state machine that runs a shared Blueprint and holds no
+//! pointer to its actor: the actor is passed in with every call instead.
+//! It is a plain value (the blueprint and the current state), so an actor
+//! owning one can be copied, moved and kept in a reallocating container
+//! such as std::vector.
+//! queueCapacity, deferralCapacity and historyCapacity are as for SharedStateMachine.
+//
+template<class Definition, size_t queueCapacity=0, size_t deferralCapacity=0, size_t historyCapacity=0>
+class RelocatableStateMachine {
+public:
+   using Actor = typename Definition::ActorType;
+   using IndexType = typename Definition::IndexType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using ReentrantSignalException = typename RunToCompletion<SignalSpace, 0>::ReentrantSignalException;
+
+   //! The blueprint must outlive the machine and be concluded before Start().
+   explicit RelocatableStateMachine(const Definition& definition)
+      : m_definition(&definition), m_current(definition.GetInitial()) {}
+
+   //! Enter the initial state of the blueprint.
+   void Start(Actor& actor) {
+      m_queue.Run([&] { m_current = m_definition->Start(actor); }, Dispatcher(actor));
+   }
+
+   //! Tick (or step if you like) the current active state.
+   void Tick(Actor& actor) {
+      m_queue.Run([&] { m_definition->Tick(actor, m_current, m_ticks++); }, Dispatcher(actor));
+   }
+
+   //! Send a state transition event/signal to the current active state
+   //! (false if it had to be queued and the queue was full).
+   bool Signal(Actor& actor, const SignalSpace s) {
+      return m_queue.Signal(s, Dispatcher(actor));
+   }
+
+   //! Queue a signal without dispatching it (false if the queue is full).
+   bool Enqueue(const SignalSpace s) {
+      return m_queue.Enqueue(s);
+   }
+
+   //! Dispatch up to count queued signals in one go; returns how many were.
+   size_t DispatchQueued(Actor& actor, size_t count=ALL_QUEUED) {
+      return m_queue.DispatchQueued(count, Dispatcher(actor));
+   }
+
+   size_t Queued() const { return m_queue.Queued(); }
+
+   //! How many deferred signals the machine keeps.
+   size_t Deferred() const { return m_memory.Deferred(); }
+
+   StateSpace CurrentState() const { return m_definition->IndexToState(m_current); }
+
+private:
+   auto Dispatcher(Actor& actor) {
+      return [this, &actor](const SignalSpace s) {
+         NoInstrumentation<Definition> none;
+         m_definition->Signal(actor, m_current, s, none, m_memory);
+      };
+   }
+
+   const Definition* m_definition;
+   IndexType m_current;
+   // Next to the (byte sized) current state when there is no queue, so the tick count fits in the padding.
+   RunToCompletion<SignalSpace, queueCapacity> m_queue;
+   typename Definition::template Memory<deferralCapacity, historyCapacity> m_memory; // deferred signals and history
+   std::uint32_t m_ticks{0};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef kv_fhsm_SharedStateMachine_h
+#define kv_fhsm_SharedStateMachine_h
+
+#include "Blueprint.h"
+#include "EventQueue.h"
+
+#include <utility>
+
+namespace kv {
+namespace fhsm {
+
+//! A hierarchical state machine that runs a shared Blueprint.
+//! The blueprint is built (and concluded) once per actor type; each
+//! machine only holds its actor, the blueprint and its current state,
+//! so constructing one costs next to nothing.
+//! Give a queueCapacity to have signals raised by handlers queued and
+//! dispatched once the current step has run to completion (as StateMachine
+//! does); without one a handler must not signal its own machine, and
+//! Signal throws ReentrantSignalException if it does.
+//! Give a deferralCapacity to keep the signals states defer (see
+//! Defer()); without one they are ignored.
+//! Give a historyCapacity (Definition::COUNT always suffices) to have the
+//! machine remember the history of that many of the states history
+//! transitions lead to; without one those transitions enter the state itself.
+//! Probe is an instrumentation policy object (see Instrumentation.h) the
+//! blueprint tells what the machine does; it is made from whatever
+//! arguments the constructor is given after the blueprint. Machines that
+//! need to follow the states a machine enters and leaves are built on
+//! this one with a probe of their own (TimedStateMachine, FleetStateMachine);
+//! use it as SharedStateMachine otherwise.
+//
+template<class Definition, size_t queueCapacity, class Probe, size_t deferralCapacity, size_t historyCapacity>
+class BasicSharedStateMachine {
+public:
+   using Actor = typename Definition::ActorType;
+   using IndexType = typename Definition::IndexType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using ReentrantSignalException = typename RunToCompletion<SignalSpace, 0>::ReentrantSignalException;
+
+   //! The blueprint must outlive the machine and be concluded before Start().
+   template<class... ProbeArguments>
+   BasicSharedStateMachine(Actor& actor, const Definition& definition, ProbeArguments&&... probe)
+      : m_definition(definition), m_actor(actor), m_current(definition.GetInitial()), m_probe(std::forward<ProbeArguments>(probe)...) {}
+
+   //! Enter the initial state of the blueprint (typically called at the end of the actor's constructor).
+   void Start() {
+      m_queue.Run([this] { m_current = m_definition.Start(m_actor, m_probe); }, Dispatcher());
+   }
+
+   //! Tick (or step if you like) the current active state.
+   void Tick() {
+      m_queue.Run([this] { m_definition.Tick(m_actor, m_current, m_ticks++); }, Dispatcher());
+   }
+
+   //! Send a state transition event/signal to the current active state
+   //! (false if it had to be queued and the queue was full).
+   bool Signal(const SignalSpace s) {
+      return m_queue.Signal(s, Dispatcher());
+   }
+
+   //! Queue a signal without dispatching it (false if the queue is full).
+   bool Enqueue(const SignalSpace s) {
+      return m_queue.Enqueue(s);
+   }
+
+   //! Dispatch up to count queued signals in one go; returns how many were.
+   size_t DispatchQueued(size_t count=ALL_QUEUED) {
+      return m_queue.DispatchQueued(count, Dispatcher());
+   }
+
+   size_t Queued() const { return m_queue.Queued(); }
+
+   //! How many deferred signals the machine keeps.
+   size_t Deferred() const { return m_memory.Deferred(); }
+
+   StateSpace CurrentState() const { return m_definition.IndexToState(m_current); }
+
+   //! The instrumentation policy object, e.g. for Snapshot and Reset.
+   Probe& GetInstrumentation() { return m_probe; }
+   const Probe& GetInstrumentation() const { return m_probe; }
+
+protected:
+   //! Run step(actor, current state) the way Start and Tick are run.
+   template<class Step>
+   void Run(Step step) {
+      m_queue.Run([this, &step] { step(m_actor, m_current); }, Dispatcher());
+   }
+   const Definition& GetDefinition() const { return m_definition; }
+
+private:
+   auto Dispatcher() {
+      return [this](const SignalSpace s) { m_definition.Signal(m_actor, m_current, s, m_probe, m_memory); };
+   }
+
+   const Definition& m_definition;
+   Actor& m_actor;
+   IndexType m_current;
+   RunToCompletion<SignalSpace, queueCapacity> m_queue;
+   typename Definition::template Memory<deferralCapacity, historyCapacity> m_memory; // deferred signals and history
+   Probe m_probe;
+   std::uint32_t m_ticks{0};
+};
+
+//! A BasicSharedStateMachine with an instrumentation policy: give
+//! CountingInstrumentation (or a policy of your own) to have what the
+//! machine does counted.
+template<class Definition, size_t queueCapacity=0, template<class> class Instrumentation=NoInstrumentation, size_t deferralCapacity=0,
+         size_t historyCapacity=0>
+using SharedStateMachine = BasicSharedStateMachine<Definition, queueCapacity, Instrumentation<Definition>, deferralCapacity, historyCapacity>;
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef kv_fhsm_SignalIndex_h
+#define kv_fhsm_SignalIndex_h
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! For every signal, the set of machines (numbered 0 to n-1, as in a
+//! MachineFleet) whose current state handles it: it, or one of its
+//! ancestors, has an action or a transition for the signal. The machines
+//! report their state changes with Move, so finding the machines that
+//! care about a signal costs in proportion to them and not to the fleet.
+//! Each set is an array with the position of every member kept aside, so
+//! joining and leaving are O(1); that is one uint32_t per machine and
+//! signal handled anywhere in the blueprint.
+//! The blueprint must be concluded and must not change afterwards.
+//
+template<class Definition>
+class SignalIndex {
+public:
+   using IndexType = typename Definition::IndexType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   using Machine = std::uint32_t;
+   static const IndexType NONE{static_cast<IndexType>(Definition::COUNT)};
+
+   explicit SignalIndex(const Definition& definition) {
+      for (IndexType i=0; i<Definition::COUNT; i++) {
+         definition.ForEachResolution(i, [&](SignalSpace s, const typename Definition::Resolution& r) {
+            if ( NOT r.action && r.destination == Definition::COUNT) {
+               return; // deferred, which for a fleet is ignored
+            }
+            auto slot = m_slots.Find(s);
+            if (slot == nullptr) {
+               m_slots.Set(s, static_cast<std::uint32_t>(m_subscribers.size()));
+               m_subscribers.emplace_back();
+               slot = m_slots.Find(s);
+            }
+            m_handled[i].push_back(*slot);
+         });
+         std::sort(m_handled[i].begin(), m_handled[i].end());
+      }
+   }
+
+   //! Machine m went from state `from` to state `to` (NONE when it joins
+   //! or leaves the index); a machine must join before it moves.
+   void Move(const Machine m, const IndexType from, const IndexType to) {
+      if (from == to) {
+         return;
+      }
+      if (from == NONE && (static_cast<size_t>(m) + 1) * Signals() > m_positions.size()) {
+         m_positions.resize((static_cast<size_t>(m) + 1) * Signals());
+      }
+      const auto& left = Handled(from);
+      const auto& joined = Handled(to);
+      // Both are sorted: walk them side by side and touch only the difference.
+      auto l = left.begin();
+      auto j = joined.begin();
+      while (l != left.end() || j != joined.end()) {
+         if (j == joined.end() || (l != left.end() && *l < *j)) {
+            Remove(m, *l++);
+         } else if (l == left.end() || *j < *l) {
+            Insert(m, *j++);
+         } else {
+            ++l;
+            ++j;
+         }
+      }
+   }
+
+   //! The machines whose state handles s, in no particular order.
+   const std::vector<Machine>& Subscribers(const SignalSpace s) const {
+      auto slot = m_slots.Find(s);
+      return slot ? m_subscribers[*slot] : m_none;
+   }
+
+private:
+   size_t Signals() const { return m_subscribers.size(); }
+   const std::vector<std::uint32_t>& Handled(const IndexType i) const {
+      return (i == NONE) ? m_noSignals : m_handled[i];
+   }
+   void Insert(const Machine m, const std::uint32_t slot) {
+      m_positions[m * Signals() + slot] = static_cast<Machine>(m_subscribers[slot].size());
+      m_subscribers[slot].push_back(m);
+   }
+   // Fill the hole with the last member.
+   void Remove(const Machine m, const std::uint32_t slot) {
+      auto& members = m_subscribers[slot];
+      const auto position = m_positions[m * Signals() + slot];
+      const auto last = members.back();
+      members[position] = last;
+      m_positions[last * Signals() + slot] = position;
+      members.pop_back();
+   }
+
+   typename Definition::template SignalTable<std::uint32_t> m_slots; // signal: its set
+   std::array<std::vector<std::uint32_t>, Definition::COUNT> m_handled; // state: the sets it is in, sorted
+   std::vector<std::vector<Machine>> m_subscribers;
+   std::vector<Machine> m_positions; // machine * sets + set: where the machine is in the set
+   const std::vector<Machine> m_none;
+   const std::vector<std::uint32_t> m_noSignals;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
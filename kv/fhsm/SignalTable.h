@@ -0,0 +1,147 @@
+#ifndef kv_fhsm_SignalTable_h
+#define kv_fhsm_SignalTable_h
+
+#include "CompactIndex.h"
+#include "FixedVector.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Signal-indexed storage for per-state handlers.
+//! The sparse table is used when the signal range is not known to the
+//! state machine; it costs one tree walk per lookup.
+//
+template<typename SignalSpace, typename Value>
+class SparseSignalTable {
+   std::map<int, Value> m_values;
+
+   static int SignalToInt(SignalSpace s) { return static_cast<int>(s); }
+
+public:
+   Value* Find(SignalSpace s) {
+      auto found = m_values.find(SignalToInt(s));
+      return (found == m_values.end()) ? nullptr : &found->second;
+   }
+   const Value* Find(SignalSpace s) const {
+      auto found = m_values.find(SignalToInt(s));
+      return (found == m_values.end()) ? nullptr : &found->second;
+   }
+   bool Contains(SignalSpace s) const { return Find(s) != nullptr; }
+
+   //! Set (or replace) the value for a signal.
+   void Set(SignalSpace s, const Value& v) { m_values[SignalToInt(s)] = v; }
+   //! Set the value for a signal only if it has none yet.
+   void SetIfAbsent(SignalSpace s, const Value& v) { m_values.insert(std::make_pair(SignalToInt(s), v)); }
+
+   //! Call f(signal, value) for every signal that has a value.
+   template<class F>
+   void ForEach(F f) const {
+      for (const auto& entry : m_values) {
+         f(static_cast<SignalSpace>(entry.first), entry.second);
+      }
+   }
+};
+
+//! The dense table is used when the state machine is given the first and
+//! last signal; it is a flat array indexed by signal (O(1), no allocation).
+//
+template<typename SignalSpace, const SignalSpace first, const SignalSpace last, typename Value>
+class DenseSignalTable {
+public:
+   using IndexType = size_t;
+   static const IndexType FIRST{static_cast<IndexType>(first)};
+   static const IndexType LAST{static_cast<IndexType>(last)};
+   static_assert(FIRST <= LAST, "The first signal must not come after the last signal");
+   static const IndexType COUNT{LAST - FIRST + 1};
+
+private:
+   std::array<Value, COUNT> m_values{};
+   std::array<bool, COUNT> m_present{};
+
+   // Signals outside of [first, last] wrap around to a huge index and are rejected by one compare.
+   static IndexType SignalToIndex(SignalSpace s) { return static_cast<IndexType>(s) - FIRST; }
+
+public:
+   Value* Find(SignalSpace s) {
+      auto i = SignalToIndex(s);
+      return (i < COUNT && m_present[i]) ? &m_values[i] : nullptr;
+   }
+   const Value* Find(SignalSpace s) const {
+      auto i = SignalToIndex(s);
+      return (i < COUNT && m_present[i]) ? &m_values[i] : nullptr;
+   }
+   bool Contains(SignalSpace s) const { return Find(s) != nullptr; }
+
+   void Set(SignalSpace s, const Value& v) {
+      auto i = SignalToIndex(s);
+      if (i < COUNT) {
+         m_values[i] = v;
+         m_present[i] = true;
+      }
+   }
+   void SetIfAbsent(SignalSpace s, const Value& v) {
+      if ( NOT Contains(s)) {
+         Set(s, v);
+      }
+   }
+
+   template<class F>
+   void ForEach(F f) const {
+      for (IndexType i=0; i<COUNT; i++) {
+         if (m_present[i]) {
+            f(static_cast<SignalSpace>(i + FIRST), m_values[i]);
+         }
+      }
+   }
+};
+
+//! Picks the table type from the (optional) signal range given to the
+//! state machine: no range selects the sparse table, first/last selects
+//! the dense one.
+//! The dense mode is also the zero-heap mode: its other variable sized
+//! storage (Pool) has a fixed capacity, so constructing, setting up and
+//! running such a machine never allocates.
+//! Slot is the type of an index into a Pool of the given capacity; without a
+//! signal range the capacity is not known, so it is the widest one.
+//
+template<typename SignalSpace, SignalSpace... range>
+struct SignalTableSelector {
+   static_assert(sizeof...(range) == 0, "Give either no signal range or exactly the first and last signal");
+   template<typename Value>
+   using Table = SparseSignalTable<SignalSpace, Value>;
+   template<typename Value, size_t capacity>
+   using Pool = std::vector<Value>;
+   template<size_t capacity>
+   using Slot = std::uint32_t;
+   static const size_t SIGNAL_COUNT{0}; // not known
+   static const bool IS_DENSE = false;
+};
+
+template<typename SignalSpace, SignalSpace first, SignalSpace last>
+struct SignalTableSelector<SignalSpace, first, last> {
+   template<typename Value>
+   using Table = DenseSignalTable<SignalSpace, first, last, Value>;
+   template<typename Value, size_t capacity>
+   using Pool = FixedVector<Value, capacity>;
+   template<size_t capacity>
+   using Slot = CompactIndex<capacity>;
+   static const size_t SIGNAL_COUNT{DenseSignalTable<SignalSpace, first, last, bool>::COUNT};
+   static const bool IS_DENSE = true;
+   //! The offset of signal s in the range (SIGNAL_COUNT or more if it is outside of it).
+   static size_t SignalToIndex(SignalSpace s) { return static_cast<size_t>(s) - static_cast<size_t>(first); }
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -2,50 +2,77 @@
 #ifndef kv_fhsm_State_h
 #define kv_fhsm_State_h
 
-#include <map>
+#include "Binding.h"
+#include "History.h"
+#include "SignalTable.h"
+
+#include <cstdint>
+#include <type_traits>
 
 #define NOT !
 
 namespace kv {
 namespace fhsm {
    
-template<class Actor, typename StateSpace, class StateMachine, typename SignalSpace>
+template<class Actor, typename StateSpace, class Definition, typename SignalSpace>
 class State {
 public:
    using MethodPointer = void(Actor::*)();
    using AllowPointer = bool(Actor::*)()const;
-   using BoundState = State<Actor, StateSpace, StateMachine, SignalSpace>;
-   using IndexType = typename StateMachine::IndexType;
-
-private:
-   StateMachine* m_sm;
-   Actor* m_actor;
-   StateSpace m_value;
-   IndexType m_parent{StateMachine::COUNT}; //TODO(djk): figure out why this can't be UNKNOWN
-   bool m_hasParent = false;
-   bool m_parentIsSet = false;
-   MethodPointer m_onEnter = nullptr;
-   MethodPointer m_onTick = nullptr;
-   MethodPointer m_onExit = nullptr;
+   //! What the handlers and guards are held as; see Binding.
+   using Action = Binding<MethodPointer, void(*)(Actor&)>;
+   using Guard = Binding<AllowPointer, bool(*)(const Actor&)>;
+   using BoundState = State<Actor, StateSpace, Definition, SignalSpace>;
+   using IndexType = typename Definition::IndexType;
+   //! The handlers and guards are kept once, in the definition; a state
+   //! holds their slots there (see Blueprint::GetMethod).
+   using MethodSlot = typename Definition::MethodSlot;
+   using GuardSlot = typename Definition::GuardSlot;
 
    struct Trans {
       IndexType m_destination;
-      IndexType leastCommonAncestor;
-      AllowPointer allow = nullptr;
+      GuardSlot allow{0};
+      HistoryKind history{HistoryKind::NONE};
 
-      Trans() : m_destination(StateMachine::COUNT), leastCommonAncestor(StateMachine::UNKNOWN), allow(nullptr) {}
-      Trans(IndexType d) : m_destination(d), leastCommonAncestor(StateMachine::UNKNOWN), allow(nullptr) {}
-      Trans(IndexType d, AllowPointer allow) : m_destination(d), leastCommonAncestor(StateMachine::UNKNOWN), allow(allow) {}
+      Trans() : m_destination(Definition::COUNT) {}
+      Trans(IndexType d) : m_destination(d) {}
+      Trans(IndexType d, GuardSlot allow) : m_destination(d), allow(allow) {}
+      Trans(IndexType d, GuardSlot allow, HistoryKind history) : m_destination(d), allow(allow), history(history) {}
       IndexType GetDestination() const { return m_destination; }
-      IndexType GetLCA() const { return leastCommonAncestor; }
-      void SetLCA(IndexType lca) { leastCommonAncestor = lca; }
    };
 
-   std::map<int, Trans> m_transitions;
-   std::map<int, MethodPointer> m_actions;
-    
-   SignalSpace IntToSignal(int s) const { return static_cast<SignalSpace>(s); }
-   int SignalToInt(SignalSpace s) const { return static_cast<int>(s); }
+   //! A signal the state gets after it has been active for `after` ticks
+   //! (of the TimingWheel driving the machine).
+   struct Timeout {
+      std::uint64_t after;
+      SignalSpace signal;
+   };
+
+private:
+   // Widest members first so the small ones pack together at the end.
+   Definition* m_definition;
+   Timeout m_timeout{0, SignalSpace{}};
+
+   typename Definition::template SignalTable<Trans> m_transitions;
+   typename Definition::template SignalTable<MethodSlot> m_actions;
+   typename Definition::template SignalTable<bool> m_deferrals;
+   std::uint32_t m_tickPeriod{0}; // 0: not set, use the parent's
+   MethodSlot m_onEnter{0};
+   MethodSlot m_onTick{0};
+   MethodSlot m_onExit{0};
+
+   StateSpace m_value;
+   IndexType m_parent{Definition::COUNT}; //TODO(djk): figure out why this can't be UNKNOWN
+   bool m_parentIsSet = false;
+   bool m_hasTimeout = false;
+
+   // Handlers given as template arguments or as class type callables.
+   template<MethodPointer method>
+   static Action Bind() { return Action::template Method<method>(); }
+   template<AllowPointer allow>
+   static Guard Bind() { return Guard::template Method<allow>(); }
+   template<class F>
+   using IfFunctor = typename std::enable_if<std::is_class<F>::value, BoundState&>::type;
 
    class SignalSetter {
       BoundState& m_s;
@@ -56,34 +83,101 @@ private:
       BoundState& GoTo(StateSpace dest) {
          return m_s.AddTransition(m_signal, dest, nullptr);
       }
-      BoundState& GoToIf(StateSpace dest, AllowPointer allow) {
+      BoundState& GoToIf(StateSpace dest, Guard allow) {
          return m_s.AddTransition(m_signal, dest, allow);
       }
-      BoundState& Do(MethodPointer action) {
+      template<AllowPointer allow>
+      BoundState& GoToIf(StateSpace dest) {
+         return GoToIf(dest, Bind<allow>());
+      }
+      template<class F>
+      IfFunctor<F> GoToIf(StateSpace dest, F allow) {
+         return GoToIf(dest, Guard::Functor(allow));
+      }
+      //! Go to the child of dest that was active when dest was last left
+      //! (to dest itself if there is none, or the machine keeps no history).
+      BoundState& GoToShallowHistory(StateSpace dest) {
+         return m_s.AddTransition(m_signal, dest, nullptr, HistoryKind::SHALLOW);
+      }
+      //! Go to the state that was active below dest when dest was last left.
+      BoundState& GoToDeepHistory(StateSpace dest) {
+         return m_s.AddTransition(m_signal, dest, nullptr, HistoryKind::DEEP);
+      }
+      BoundState& Do(Action action) {
          return m_s.AddAction(m_signal, action);
       }
+      template<MethodPointer action>
+      BoundState& Do() {
+         return Do(Bind<action>());
+      }
+      template<class F>
+      IfFunctor<F> Do(F action) {
+         return Do(Action::Functor(action));
+      }
+      //! Keep the signal, while this state (or a state below it that does
+      //! not handle the signal) is active, and dispatch it again once a
+      //! transition leads to a state that does not defer it. An action or
+      //! transition of this state for the same signal takes precedence.
+      BoundState& Defer() {
+         return m_s.AddDeferral(m_signal);
+      }
    };
 
 public:
    State() {}
-   virtual ~State() = default;
-   void Initialize(Actor* actor, const StateSpace value, StateMachine* hsm) {
-      m_actor = actor;
+   void Initialize(const StateSpace value, Definition* definition) {
       m_value = value;
-      m_sm = hsm;
+      m_definition = definition;
    }
 
    // Initialization methods return self reference so they can be chained.
-   BoundState& SetOnEnter(MethodPointer onEnter) {
-      m_onEnter = onEnter;
+   // Each handler can be given as a member function pointer, as a template
+   // argument (SetOnEnter<&Actor::Count>(), which the compiler can inline)
+   // or as a captureless lambda or stateless functor taking the actor.
+   BoundState& SetOnEnter(Action onEnter) {
+      m_onEnter = m_definition->InternMethod(onEnter);
+      m_definition->DefinitionChanged();
+      return *this;
+   }
+   template<MethodPointer onEnter>
+   BoundState& SetOnEnter() { return SetOnEnter(Bind<onEnter>()); }
+   template<class F>
+   IfFunctor<F> SetOnEnter(F onEnter) { return SetOnEnter(Action::Functor(onEnter)); }
+
+   BoundState& SetOnTick(Action onTick) {
+      m_onTick = m_definition->InternMethod(onTick);
+      m_definition->DefinitionChanged();
       return *this;
    }
-   BoundState& SetOnTick(MethodPointer onTick) {
-      m_onTick = onTick;
+   template<MethodPointer onTick>
+   BoundState& SetOnTick() { return SetOnTick(Bind<onTick>()); }
+   template<class F>
+   IfFunctor<F> SetOnTick(F onTick) { return SetOnTick(Action::Functor(onTick)); }
+
+   //! Run the tick handler on every period-th tick only (for this state
+   //! and those below it that do not set their own period).
+   BoundState& SetTickPeriod(std::uint32_t period) {
+      m_tickPeriod = (period ? period : 1);
+      m_definition->DefinitionChanged();
       return *this;
    }
-   BoundState& SetOnExit(MethodPointer onExit) {
-      m_onExit = onExit;
+
+   BoundState& SetOnExit(Action onExit) {
+      m_onExit = m_definition->InternMethod(onExit);
+      m_definition->DefinitionChanged();
+      return *this;
+   }
+   template<MethodPointer onExit>
+   BoundState& SetOnExit() { return SetOnExit(Bind<onExit>()); }
+   template<class F>
+   IfFunctor<F> SetOnExit(F onExit) { return SetOnExit(Action::Functor(onExit)); }
+
+   //! Have the state signaled after it has been active for `after` ticks.
+   //! Only machines with a TimingWheel (TimedStateMachine) arm it.
+   BoundState& SetTimeout(std::uint64_t after, SignalSpace signal) {
+      m_timeout = Timeout{after, signal};
+      m_hasTimeout = true;
+      m_definition->DefinitionChanged();
       return *this;
    }
 
@@ -94,85 +188,59 @@ public:
 private:
    friend SignalSetter;
 
-   BoundState& AddTransition(SignalSpace signal, StateSpace destination, AllowPointer allow) {
-      auto there = m_sm->StateToIndex(destination);
-      auto here = m_sm->StateToIndex(m_value);
-      Trans t{there, allow};
-      t.SetLCA(m_sm->LeastCommonAncestor(here, there));
-      auto s = SignalToInt(signal);
-      m_transitions[s] = t;
+   BoundState& AddTransition(SignalSpace signal, StateSpace destination, Guard allow, HistoryKind history=HistoryKind::NONE) {
+      Trans t{m_definition->StateToIndex(destination), m_definition->InternGuard(allow), history};
+      m_transitions.Set(signal, t);
+      m_definition->DefinitionChanged();
+      return *this;
+   }
+   BoundState& AddAction(SignalSpace signal, Action onSignal) {
+      m_actions.SetIfAbsent(signal, m_definition->InternMethod(onSignal));
+      m_definition->DefinitionChanged();
       return *this;
    }
-   BoundState& AddAction(SignalSpace signal, MethodPointer onSignal) {
-      m_actions.insert(std::pair<int, MethodPointer>(SignalToInt(signal), onSignal));
+   BoundState& AddDeferral(SignalSpace signal) {
+      m_deferrals.Set(signal, true);
+      m_definition->DefinitionChanged();
       return *this;
    }
 
 public:
-   // Methods called by StateMachine; could be private if "friend StateMachine;"
+   // Methods called by the Definition; could be private if "friend Definition;"
    BoundState& SetParent(IndexType p) {
       m_parent = p;
-      m_hasParent = (p != StateMachine::COUNT);
       m_parentIsSet = true;
+      m_definition->DefinitionChanged();
       return *this;
    }
 
-   bool HasParent() const { return m_hasParent; }
+   bool HasParent() const { return m_parent != Definition::COUNT; }
    bool IsParentSet() const { return m_parentIsSet; }
    IndexType GetParent() const { return m_parent; }
 
-   void OnEnter() {
-      if (m_onEnter) {
-         (m_actor->*m_onEnter)();
-      }
-   }
-   void OnExit() {
-      if (m_onExit) {
-         (m_actor->*m_onExit)();
-      }
-   }
-   void OnTick() {
-      if (m_onTick) {
-         (m_actor->*m_onTick)();
-      } else if (HasParent()) {
-         m_sm->StateRef(GetParent()).OnTick();
-      }
-   }
-   void OnSignal(const SignalSpace sig) {
-      auto s = SignalToInt(sig);
-      auto consumed = false;
-      OnSignalDoActionIf(s, consumed);
-      OnSignalDoTransitionIf(s, consumed);
-      ElevateIfNotConsumed(sig, consumed);
-   }
-private:
-   void OnSignalDoActionIf(int s, bool& consumed) {
-      if (m_actions.count(s)) {
-         auto action = m_actions[s];
-         if (action) {
-            (m_actor->*(action))();
-         }
-         consumed = true;
-      }
+   MethodSlot GetOnEnter() const { return m_onEnter; }
+   MethodSlot GetOnExit() const { return m_onExit; }
+   MethodSlot GetOnTick() const { return m_onTick; }
+   std::uint32_t GetTickPeriod() const { return m_tickPeriod; }
+   const Timeout* GetTimeout() const { return m_hasTimeout ? &m_timeout : nullptr; }
+   const MethodSlot* FindAction(SignalSpace s) const { return m_actions.Find(s); }
+   const Trans* FindTransition(SignalSpace s) const { return m_transitions.Find(s); }
+   bool Defers(SignalSpace s) const { return m_deferrals.Contains(s) && NOT FindAction(s) && NOT FindTransition(s); }
+
+   //! Call f(signal) for every signal this state consumes (may repeat a signal).
+   template<class F>
+   void ForEachHandledSignal(F f) const {
+      m_actions.ForEach([&](SignalSpace s, const MethodSlot&) { f(s); });
+      m_transitions.ForEach([&](SignalSpace s, const Trans&) { f(s); });
    }
-   void OnSignalDoTransitionIf(int s, bool& consumed) {
-      if (m_transitions.count(s)) {
-         auto t = m_transitions[s];
-         auto isAllowed = true;
-         if (t.allow) { // If a guard was set, check it
-            isAllowed = (m_actor->*(t.allow))();
-         }
-         if (isAllowed) {
-            t.SetLCA(m_sm->ExecuteTransition(t.GetDestination(), t.GetLCA()));
+   //! Call f(signal) for every signal this state defers.
+   template<class F>
+   void ForEachDeferredSignal(F f) const {
+      m_deferrals.ForEach([&](SignalSpace s, const bool) {
+         if (Defers(s)) {
+            f(s);
          }
-         consumed = true;
-      }
-   }
-   void ElevateIfNotConsumed(SignalSpace sig, bool consumed) {
-      if ( NOT consumed && HasParent()) {
-         // Try parent
-         m_sm->StateRef(GetParent()).OnSignal(sig);
-      }
+      });
    }
 };
   
@@ -1,13 +1,8 @@
-
 #ifndef kv_fhsm_StateMachine_h
 #define kv_fhsm_StateMachine_h
 
-#include "State.h"
-
-#include <array>
-#include <exception>
-
-#define NOT !
+#include "Blueprint.h"
+#include "EventQueue.h"
 
 namespace kv {
 namespace fhsm {
@@ -16,150 +11,103 @@ namespace fhsm {
 //! Actor is the class using the state machine.
 //! StateSpace is the type (convertable to size_t) that defines the states.
 //! SignalSpace is the type (convertable to int) that defines state transition events.
+//! The first and last signal may optionally be given (the same way as the states);
+//! handlers are then kept in flat arrays indexed by signal instead of in maps.
+//! Each StateMachine owns its own Blueprint; see SharedStateMachine for
+//! machines that share one.
+//! Signals raised by handlers are queued (up to KV_FHSM_QUEUE_CAPACITY of
+//! them) and dispatched once the current step has run to completion.
+//! Deferred signals are kept (up to KV_FHSM_DEFERRAL_CAPACITY of them)
+//! until a state that does not defer them is entered, and the machine
+//! remembers the history of every state history transitions lead to.
+//! BasicStateMachine takes an instrumentation policy first (the signal
+//! range, being last, leaves no room for it after the others); use it
+//! through StateMachine (none) or InstrumentedStateMachine (counting).
 //
-template<class Actor, typename StateSpace, const StateSpace first, const StateSpace last, typename SignalSpace>
-class StateMachine {
+template<template<class> class Instrumentation, class Actor, typename StateSpace, const StateSpace first, const StateSpace last, typename SignalSpace, const SignalSpace... signalRange>
+class BasicStateMachine {
 public:
-   using BoundState = State<Actor, StateSpace, StateMachine, SignalSpace>;
-   using IndexType = size_t;
-   static const IndexType FIRST{static_cast<IndexType>(first)};
-   static const IndexType LAST{static_cast<IndexType>(last)};
-   static const IndexType COUNT{LAST - FIRST + 1};
-   static const IndexType UNKNOWN{COUNT + 1};
-   using MethodPointer = void(Actor::*)();
-   using StateChangeCallback = void(Actor::*)(const StateSpace s);
-
-   // Hierarchical states must form trees or forrests: no cycles!
-   //
-   class CyclicGraphException : public std::exception {};
+   using Definition = Blueprint<Actor, StateSpace, first, last, SignalSpace, signalRange...>;
+   using Probe = Instrumentation<Definition>;
+   using BoundState = typename Definition::BoundState;
+   using IndexType = typename Definition::IndexType;
+   using MethodPointer = typename Definition::MethodPointer;
+   using StateChangeCallback = typename Definition::StateChangeCallback;
+   using CyclicGraphException = typename Definition::CyclicGraphException;
 
-private:
-   class ParentSetter {
-      StateMachine& m_sm;
-      IndexType m_index;
-      friend StateMachine;
-      ParentSetter(StateMachine& sm, IndexType i) : m_sm(sm), m_index(i) {}
-   public:
-      BoundState& SetParent(StateSpace p) {
-         auto parent = m_sm.StateToIndex(p);
-         if (m_sm.IsAncestorOf(m_index, parent)) {
-            throw CyclicGraphException();
-         }
-         return m_sm.StateRef(m_index).SetParent(parent);
-      }
-      BoundState& SetNoParent() {
-         return m_sm.StateRef(m_index).SetParent(COUNT);
-      }
-   };
-
-public:
    //! Create a state machine object.
-   StateMachine(Actor& actor) : m_actor(actor), m_current(StateToIndex(first)) {
-      for (IndexType i=0; i<COUNT; i++) {
-         m_states[i].Initialize(&m_actor, IndexToState(i), this);
-      }
-   }
+   BasicStateMachine(Actor& actor) : m_actor(actor), m_current(m_definition.StateToIndex(first)) {}
 
    //! Start the process of defining a state (to be called for each state).
    //! This returns a helper class that requires you to set a parent state
    //! or affirm that there is no parent state.
-   ParentSetter DefineState(StateSpace state) {
-      return ParentSetter(*this, StateToIndex(state));
+   auto DefineState(StateSpace state) {
+      return m_definition.DefineState(state);
    }
 
    //! Once all of the states have been defined, this completes the process.
    //! Provide an optional method to receive state change notifications.
    void ConcludeSetupAndSetInitialState(StateSpace initial, StateChangeCallback noteState=nullptr) {
-      m_noteState = noteState;
-      m_current = StateToIndex(initial);
-      InformActorOfCurrentState();
-      EnterParentOf(m_current);
+      m_definition.ConcludeSetupAndSetInitialState(initial, noteState);
+      m_queue.Run([this] { m_current = m_definition.Start(m_actor, m_probe); }, Dispatcher());
    }
 
    //! Tick (or step if you like) the current active state.
    void Tick() {
-      StateRef(m_current).OnTick();
+      m_queue.Run([this] { m_definition.Tick(m_actor, m_current, m_ticks++); }, Dispatcher());
    }
 
    //! Send a state transition event/signal to the current active state.
-   void Signal(const SignalSpace s) {
-      StateRef(m_current).OnSignal(s);
+   //! Called from a handler, the signal is queued until the current step is
+   //! done; false if the queue was full and the signal was dropped.
+   bool Signal(const SignalSpace s) {
+      return m_queue.Signal(s, Dispatcher());
    }
 
-private:
-   friend BoundState;
-    
-   StateSpace IndexToState(const IndexType i) const { return static_cast<StateSpace>(i + FIRST); }
-   IndexType StateToIndex(const StateSpace s) const { return static_cast<IndexType>(s) - FIRST; }
-   BoundState& StateRef(StateSpace state) {
-      return m_states[StateToIndex(state)];
-   }
-   BoundState& StateRef(IndexType i) {
-      return m_states[i];
+   //! Queue a signal without dispatching it (false if the queue is full).
+   bool Enqueue(const SignalSpace s) {
+      return m_queue.Enqueue(s);
    }
 
-   void InformActorOfCurrentState() {
-      if (m_noteState) {
-         (m_actor.*m_noteState)(IndexToState(m_current));
-      }
-   }
-   void EnterParentOf(IndexType i) {
-      auto current = m_states[i];
-      if (current.HasParent()) {
-         EnterParentOf(current.GetParent());
-      }
-      current.OnEnter();
-   }
-   IndexType ExecuteTransition(IndexType destination, IndexType leastCommonAncestor=UNKNOWN) {
-      IndexType lca = leastCommonAncestor;
-      if (UNKNOWN == lca) {
-         lca = LeastCommonAncestor(m_current, destination);
-      }
-      ExitHereToLCA(m_current, lca);
-      EnterLCAToHere(lca, destination);
-      m_current = destination;
-      InformActorOfCurrentState();
-      return lca;
-   }
-   IndexType LeastCommonAncestor(IndexType source, IndexType destination) {
-      if (source == destination) return source; // Don't care about a parent in this case.
-      if ( NOT m_states[source].IsParentSet()) return UNKNOWN;
-      if ( NOT m_states[destination].IsParentSet()) return UNKNOWN;
-      if (IsAncestorOf(source, destination)) return source;
-      if (m_states[source].GetParent() == COUNT) return COUNT; // no common ancestor
-      return LeastCommonAncestor(m_states[source].GetParent(), destination);
+   //! Dispatch up to count queued signals in one go; returns how many were.
+   size_t DispatchQueued(size_t count=ALL_QUEUED) {
+      return m_queue.DispatchQueued(count, Dispatcher());
    }
-   bool IsAncestorOf(IndexType candidate, IndexType child) {
-      if (candidate == child) return true;
-      if (m_states[child].GetParent() == COUNT) return false;
-      return IsAncestorOf(candidate, m_states[child].GetParent());
-   }
-   void ExitHereToLCA(IndexType here, IndexType lca) {
-      if (here == COUNT) return;
-      if (here == lca) return;
-      m_states[here].OnExit();
-      if (m_states[here].GetParent() != lca) {
-         ExitHereToLCA(m_states[here].GetParent(), lca);
-      }
-   }
-   void EnterLCAToHere(IndexType lca, IndexType here) {
-      if (here == COUNT) return;
-      if (here == lca) return;
-      if (m_states[here].GetParent() != lca) {
-         EnterLCAToHere(lca, m_states[here].GetParent());
-      }
-      m_states[here].OnEnter();
+
+   size_t Queued() const { return m_queue.Queued(); }
+
+   //! How many deferred signals the machine keeps.
+   size_t Deferred() const { return m_memory.Deferred(); }
+
+   //! The definition behind this machine (e.g. for CodeGenerator).
+   const Definition& GetDefinition() const { return m_definition; }
+
+   //! The instrumentation policy object, e.g. for Snapshot and Reset.
+   Probe& GetInstrumentation() { return m_probe; }
+   const Probe& GetInstrumentation() const { return m_probe; }
+
+private:
+   auto Dispatcher() {
+      return [this](const SignalSpace s) { m_definition.Signal(m_actor, m_current, s, m_probe, m_memory); };
    }
 
+   Definition m_definition;
    Actor& m_actor;
-   std::array<BoundState, COUNT> m_states;
    IndexType m_current;
-   StateChangeCallback m_noteState{nullptr};
+   std::uint32_t m_ticks{0};
+   RunToCompletion<SignalSpace, DEFAULT_QUEUE_CAPACITY> m_queue;
+   typename Definition::template Memory<DEFAULT_DEFERRAL_CAPACITY, Definition::COUNT> m_memory; // deferred signals and history
+   Probe m_probe;
 };
 
+template<class Actor, typename StateSpace, const StateSpace first, const StateSpace last, typename SignalSpace, const SignalSpace... signalRange>
+using StateMachine = BasicStateMachine<NoInstrumentation, Actor, StateSpace, first, last, SignalSpace, signalRange...>;
+
+//! A StateMachine that counts what it does (see CountingInstrumentation).
+template<class Actor, typename StateSpace, const StateSpace first, const StateSpace last, typename SignalSpace, const SignalSpace... signalRange>
+using InstrumentedStateMachine = BasicStateMachine<CountingInstrumentation, Actor, StateSpace, first, last, SignalSpace, signalRange...>;
+
 } // namespace fhsm
 } // namespace kv
 
-#undef NOT
-
 #endif
@@ -0,0 +1,494 @@
+#ifndef kv_fhsm_StaticStateMachine_h
+#define kv_fhsm_StaticStateMachine_h
+
+#include <cstddef>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Problems found in a compile time definition (each one is a static_assert
+//! in StaticStateMachine).
+enum class StaticError {
+   NONE,
+   STATE_OUT_OF_RANGE,
+   SIGNAL_OUT_OF_RANGE,
+   DUPLICATE_STATE,
+   UNDEFINED_STATE,
+   CYCLE,
+   DUPLICATE_TRANSITION,
+   DUPLICATE_ACTION,
+};
+
+template<class Space, class Initial, class... States>
+struct StaticDefinition;
+
+//! The building blocks of a compile time (type level) state machine
+//! definition. They mirror the fluent API of Blueprint:
+//!
+//!    using S = StaticBlueprint<Door, DoorStates, DoorStates::CLOSED, DoorStates::WIDE,
+//!                              DoorSignals, DoorSignals::PUSH, DoorSignals::CREAK>;
+//!    using DoorDefinition = S::Machine<
+//!       S::Initial<DoorStates::SHUT, &Door::NewState>,
+//!       S::DefineState<DoorStates::CLOSED, S::NoParent,
+//!          S::OnEnter<&Door::Count>,
+//!          S::GoTo<DoorSignals::PULL, DoorStates::AJAR>>,
+//!       S::DefineState<DoorStates::SHUT, S::Parent<DoorStates::CLOSED>,
+//!          S::GoToIf<DoorSignals::LOCK, DoorStates::LOCKED, &Door::HasKey>,
+//!          S::Do<DoorSignals::CREAK, &Door::Count>>,
+//!       ...>;
+//!    StaticStateMachine<DoorDefinition> m_hsm;
+//!
+//! The whole definition is resolved by the compiler into constant tables;
+//! cycles, undefined states and duplicate transitions do not compile.
+//! Both the state and the signal range must be given.
+//
+template<class Actor, typename StateSpace, const StateSpace first, const StateSpace last,
+         typename SignalSpace, const SignalSpace firstSignal, const SignalSpace lastSignal>
+struct StaticBlueprint {
+   using ActorType = Actor;
+   using StateSpaceType = StateSpace;
+   using SignalSpaceType = SignalSpace;
+   using IndexType = size_t;
+   static const IndexType FIRST{static_cast<IndexType>(first)};
+   static const IndexType LAST{static_cast<IndexType>(last)};
+   static const IndexType COUNT{LAST - FIRST + 1};
+   static const IndexType FIRST_SIGNAL{static_cast<IndexType>(firstSignal)};
+   static const IndexType LAST_SIGNAL{static_cast<IndexType>(lastSignal)};
+   static const IndexType SIGNAL_COUNT{LAST_SIGNAL - FIRST_SIGNAL + 1};
+
+   // Member functions are bound as template arguments and called through
+   // these thunks, so the compiler sees (and can inline) the actual call.
+   using Handler = void(*)(Actor&);
+   using Guard = bool(*)(const Actor&);
+   using Notifier = void(*)(Actor&, StateSpace);
+   template<void (Actor::*method)()>
+   static void Call(Actor& actor) { (actor.*method)(); }
+   template<bool (Actor::*allow)() const>
+   static bool Ask(const Actor& actor) { return (actor.*allow)(); }
+   template<void (Actor::*noteState)(const StateSpace)>
+   static void Note(Actor& actor, StateSpace s) { (actor.*noteState)(s); }
+
+   static constexpr IndexType StateToIndex(StateSpace s) { return static_cast<IndexType>(s) - FIRST; }
+   static constexpr IndexType SignalToIndex(SignalSpace s) { return static_cast<IndexType>(s) - FIRST_SIGNAL; }
+
+   //! Everything one DefineState says about its state.
+   struct StateRecord {
+      StaticError error;
+      IndexType index;
+      IndexType parent;
+      Handler enter;
+      Handler tick;
+      Handler exit;
+      bool hasAction[SIGNAL_COUNT];
+      Handler action[SIGNAL_COUNT];
+      IndexType destination[SIGNAL_COUNT];
+      Guard allow[SIGNAL_COUNT];
+   };
+
+   static constexpr void Fail(StateRecord& r, StaticError e) {
+      if (r.error == StaticError::NONE) {
+         r.error = e;
+      }
+   }
+   static constexpr void AddTransition(StateRecord& r, IndexType signal, IndexType destination, Guard allow) {
+      if (signal >= SIGNAL_COUNT) {
+         Fail(r, StaticError::SIGNAL_OUT_OF_RANGE);
+      } else if (r.destination[signal] != COUNT) {
+         Fail(r, StaticError::DUPLICATE_TRANSITION);
+      } else if (destination >= COUNT) {
+         Fail(r, StaticError::STATE_OUT_OF_RANGE);
+      } else {
+         r.destination[signal] = destination;
+         r.allow[signal] = allow;
+      }
+   }
+
+   // State level clauses.
+
+   template<StateSpace parent>
+   struct Parent {
+      static constexpr void Apply(StateRecord& r) {
+         r.parent = StateToIndex(parent);
+         if (r.parent >= COUNT) {
+            Fail(r, StaticError::STATE_OUT_OF_RANGE);
+         }
+      }
+   };
+   struct NoParent {
+      static constexpr void Apply(StateRecord& r) { r.parent = COUNT; }
+   };
+   template<void (Actor::*onEnter)()>
+   struct OnEnter {
+      static constexpr void Apply(StateRecord& r) { r.enter = &Call<onEnter>; }
+   };
+   template<void (Actor::*onTick)()>
+   struct OnTick {
+      static constexpr void Apply(StateRecord& r) { r.tick = &Call<onTick>; }
+   };
+   template<void (Actor::*onExit)()>
+   struct OnExit {
+      static constexpr void Apply(StateRecord& r) { r.exit = &Call<onExit>; }
+   };
+
+   // Signal level clauses (ForSignal(signal).GoTo(...) and friends).
+
+   template<SignalSpace signal, StateSpace destination>
+   struct GoTo {
+      static constexpr void Apply(StateRecord& r) {
+         AddTransition(r, SignalToIndex(signal), StateToIndex(destination), nullptr);
+      }
+   };
+   template<SignalSpace signal, StateSpace destination, bool (Actor::*allow)() const>
+   struct GoToIf {
+      static constexpr void Apply(StateRecord& r) {
+         AddTransition(r, SignalToIndex(signal), StateToIndex(destination), &Ask<allow>);
+      }
+   };
+   template<SignalSpace signal, void (Actor::*action)()>
+   struct Do {
+      static constexpr void Apply(StateRecord& r) {
+         auto s = SignalToIndex(signal);
+         if (s >= SIGNAL_COUNT) {
+            Fail(r, StaticError::SIGNAL_OUT_OF_RANGE);
+         } else if (r.hasAction[s]) {
+            Fail(r, StaticError::DUPLICATE_ACTION);
+         } else {
+            r.hasAction[s] = true;
+            r.action[s] = &Call<action>;
+         }
+      }
+   };
+
+   //! One state: its parent (Parent<> or NoParent) followed by any clauses.
+   template<StateSpace state, class ParentClause, class... Clauses>
+   struct DefineState {
+      static constexpr StateRecord Record() {
+         StateRecord r{};
+         r.index = StateToIndex(state);
+         if (r.index >= COUNT) {
+            Fail(r, StaticError::STATE_OUT_OF_RANGE);
+         }
+         for (IndexType s=0; s<SIGNAL_COUNT; s++) {
+            r.destination[s] = COUNT;
+         }
+         ParentClause::Apply(r);
+         int unused[] = {0, (Clauses::Apply(r), 0)...};
+         (void)unused;
+         return r;
+      }
+   };
+
+   //! The initial state and an optional method to receive state change notifications.
+   template<StateSpace initial, void (Actor::*noteState)(const StateSpace) = nullptr>
+   struct Initial {
+      static constexpr IndexType Index() { return StateToIndex(initial); }
+      static constexpr Notifier GetNotifier() { return (noteState != nullptr) ? &Note<noteState> : nullptr; }
+   };
+
+   template<class InitialClause, class... States>
+   using Machine = StaticDefinition<StaticBlueprint, InitialClause, States...>;
+};
+
+//! The constant tables resolved from a compile time definition; see StaticBlueprint.
+//
+template<class Space, class InitialClause, class... States>
+struct StaticDefinition {
+   using SpaceType = Space;
+   using ActorType = typename Space::ActorType;
+   using StateSpaceType = typename Space::StateSpaceType;
+   using SignalSpaceType = typename Space::SignalSpaceType;
+   using IndexType = typename Space::IndexType;
+   using Handler = typename Space::Handler;
+   using Guard = typename Space::Guard;
+   using Notifier = typename Space::Notifier;
+   using StateRecord = typename Space::StateRecord;
+   static const IndexType COUNT{Space::COUNT};
+   static const IndexType SIGNAL_COUNT{Space::SIGNAL_COUNT};
+   static const size_t DEFINED{sizeof...(States)};
+   static_assert(DEFINED > 0, "Define at least one state");
+
+   //! What a signal resolves to for a given current (leaf) state, with the
+   //! exit and enter handlers of the transition as slices of the handler pool.
+   struct Entry {
+      bool handled;
+      Handler action;
+      Guard allow;
+      IndexType destination;
+      size_t exitBegin;
+      size_t exitEnd;
+      size_t entryBegin;
+      size_t entryEnd;
+   };
+
+   template<size_t POOL>
+   struct Tables {
+      StaticError error;
+      IndexType initial;
+      Notifier noteState;
+      IndexType parent[COUNT];
+      Handler tick[COUNT];
+      size_t entryBegin[COUNT];
+      size_t entryEnd[COUNT];
+      Entry entries[COUNT][SIGNAL_COUNT];
+      Handler handlers[POOL];
+   };
+
+   // Where each state's record is in the pack (DEFINED if the state was not defined).
+   struct Layout {
+      StaticError error;
+      size_t recordOf[COUNT];
+      IndexType parent[COUNT];
+   };
+
+   static constexpr bool IsDefined(const Layout& l, IndexType i) { return i < COUNT && l.recordOf[i] != DEFINED; }
+
+   static constexpr Layout Place(const StateRecord (&records)[DEFINED]) {
+      Layout l{};
+      for (IndexType i=0; i<COUNT; i++) {
+         l.recordOf[i] = DEFINED;
+         l.parent[i] = COUNT;
+      }
+      for (size_t r=0; r<DEFINED; r++) {
+         if (records[r].error != StaticError::NONE) {
+            l.error = records[r].error;
+            return l;
+         }
+         if (IsDefined(l, records[r].index)) {
+            l.error = StaticError::DUPLICATE_STATE;
+            return l;
+         }
+         l.recordOf[records[r].index] = r;
+         l.parent[records[r].index] = records[r].parent;
+      }
+      for (size_t r=0; r<DEFINED; r++) {
+         const auto& record = records[r];
+         if (record.parent != COUNT && NOT IsDefined(l, record.parent)) {
+            l.error = StaticError::UNDEFINED_STATE;
+            return l;
+         }
+         for (IndexType s=0; s<SIGNAL_COUNT; s++) {
+            if (record.destination[s] != COUNT && NOT IsDefined(l, record.destination[s])) {
+               l.error = StaticError::UNDEFINED_STATE;
+               return l;
+            }
+         }
+      }
+      if (NOT IsDefined(l, InitialClause::Index())) {
+         l.error = StaticError::UNDEFINED_STATE;
+         return l;
+      }
+      for (IndexType i=0; i<COUNT; i++) {
+         IndexType steps = 0;
+         for (IndexType level=i; level!=COUNT; level=l.parent[level]) {
+            if (++steps > COUNT) {
+               l.error = StaticError::CYCLE;
+               return l;
+            }
+         }
+      }
+      return l;
+   }
+
+   static constexpr const StateRecord* RecordOf(const StateRecord (&records)[DEFINED], const Layout& l, IndexType i) {
+      return IsDefined(l, i) ? &records[l.recordOf[i]] : nullptr;
+   }
+   static constexpr Handler EnterOf(const StateRecord (&records)[DEFINED], const Layout& l, IndexType i) {
+      return IsDefined(l, i) ? records[l.recordOf[i]].enter : nullptr;
+   }
+   static constexpr Handler ExitOf(const StateRecord (&records)[DEFINED], const Layout& l, IndexType i) {
+      return IsDefined(l, i) ? records[l.recordOf[i]].exit : nullptr;
+   }
+
+   // The handlers up a state's ancestry, stopping below ancestor (COUNT for the whole ancestry).
+   static constexpr size_t CountExits(const StateRecord (&records)[DEFINED], const Layout& l, IndexType here, IndexType ancestor) {
+      size_t count = 0;
+      for (IndexType level=here; level!=ancestor && level!=COUNT; level=l.parent[level]) {
+         count += ExitOf(records, l, level) ? 1 : 0;
+      }
+      return count;
+   }
+   static constexpr size_t CountEnters(const StateRecord (&records)[DEFINED], const Layout& l, IndexType here, IndexType ancestor) {
+      size_t count = 0;
+      for (IndexType level=here; level!=ancestor && level!=COUNT; level=l.parent[level]) {
+         count += EnterOf(records, l, level) ? 1 : 0;
+      }
+      return count;
+   }
+   static constexpr bool IsAncestorOf(const Layout& l, IndexType candidate, IndexType child) {
+      for (IndexType level=child; level!=COUNT; level=l.parent[level]) {
+         if (level == candidate) return true;
+      }
+      return false;
+   }
+   static constexpr IndexType LeastCommonAncestor(const Layout& l, IndexType source, IndexType destination) {
+      for (IndexType level=source; level!=COUNT; level=l.parent[level]) {
+         if (IsAncestorOf(l, level, destination)) return level;
+      }
+      return COUNT;
+   }
+
+   static constexpr size_t PoolSize() {
+      const StateRecord records[DEFINED] = { States::Record()... };
+      const Layout l = Place(records);
+      size_t size = 0;
+      if (l.error == StaticError::NONE) {
+         for (IndexType i=0; i<COUNT; i++) {
+            size += CountExits(records, l, i, COUNT) + CountEnters(records, l, i, COUNT);
+         }
+      }
+      return size;
+   }
+   static const size_t POOL{PoolSize() ? PoolSize() : 1};
+   using TableType = Tables<POOL>;
+
+   static constexpr TableType Build() {
+      const StateRecord records[DEFINED] = { States::Record()... };
+      const Layout l = Place(records);
+      TableType t{};
+      t.error = l.error;
+      t.initial = InitialClause::Index();
+      t.noteState = InitialClause::GetNotifier();
+      if (t.error != StaticError::NONE) {
+         return t;
+      }
+      size_t exitBegin[COUNT] = {};
+      size_t size = 0;
+      for (IndexType i=0; i<COUNT; i++) {
+         t.parent[i] = l.parent[i];
+         t.tick[i] = nullptr;
+         for (IndexType level=i; level!=COUNT && NOT t.tick[i]; level=l.parent[level]) {
+            t.tick[i] = IsDefined(l, level) ? records[l.recordOf[level]].tick : nullptr;
+         }
+
+         exitBegin[i] = size;
+         for (IndexType level=i; level!=COUNT; level=l.parent[level]) {
+            if (auto onExit = ExitOf(records, l, level)) {
+               t.handlers[size++] = onExit;
+            }
+         }
+         t.entryBegin[i] = size;
+         t.entryEnd[i] = size + CountEnters(records, l, i, COUNT);
+         auto slot = t.entryEnd[i];
+         for (IndexType level=i; level!=COUNT; level=l.parent[level]) {
+            if (auto onEnter = EnterOf(records, l, level)) {
+               t.handlers[--slot] = onEnter; // root first
+            }
+         }
+         size = t.entryEnd[i];
+      }
+      for (IndexType leaf=0; leaf<COUNT; leaf++) {
+         for (IndexType s=0; s<SIGNAL_COUNT; s++) {
+            Entry e{};
+            e.destination = COUNT;
+            for (IndexType level=leaf; level!=COUNT && NOT e.handled; level=l.parent[level]) {
+               auto r = RecordOf(records, l, level);
+               if (r && (r->hasAction[s] || r->destination[s] != COUNT)) {
+                  e.handled = true;
+                  e.action = r->hasAction[s] ? r->action[s] : nullptr;
+                  e.allow = r->allow[s];
+                  e.destination = r->destination[s];
+               }
+            }
+            if (e.destination != COUNT) {
+               auto lca = LeastCommonAncestor(l, leaf, e.destination);
+               e.exitBegin = exitBegin[leaf];
+               e.exitEnd = exitBegin[leaf] + CountExits(records, l, leaf, lca);
+               e.entryEnd = t.entryEnd[e.destination];
+               e.entryBegin = e.entryEnd - CountEnters(records, l, e.destination, lca);
+            }
+            t.entries[leaf][s] = e;
+         }
+      }
+      return t;
+   }
+
+   static constexpr TableType TABLES = Build();
+   static constexpr StaticError ERROR = TABLES.error;
+};
+
+template<class Space, class InitialClause, class... States>
+constexpr typename StaticDefinition<Space, InitialClause, States...>::TableType StaticDefinition<Space, InitialClause, States...>::TABLES;
+
+//! A hierarchical state machine running a compile time definition (see
+//! StaticBlueprint). An instance is only its current state; the actor is
+//! passed in with every call, as with RelocatableStateMachine.
+//
+template<class Definition>
+class StaticStateMachine {
+   static_assert(Definition::ERROR != StaticError::STATE_OUT_OF_RANGE, "A state is outside of the declared state range");
+   static_assert(Definition::ERROR != StaticError::SIGNAL_OUT_OF_RANGE, "A signal is outside of the declared signal range");
+   static_assert(Definition::ERROR != StaticError::DUPLICATE_STATE, "A state is defined more than once");
+   static_assert(Definition::ERROR != StaticError::UNDEFINED_STATE, "A parent, destination or initial state is not defined");
+   static_assert(Definition::ERROR != StaticError::CYCLE, "Hierarchical states must form trees or forests: no cycles!");
+   static_assert(Definition::ERROR != StaticError::DUPLICATE_TRANSITION, "A state has more than one transition for a signal");
+   static_assert(Definition::ERROR != StaticError::DUPLICATE_ACTION, "A state has more than one action for a signal");
+
+public:
+   using Actor = typename Definition::ActorType;
+   using IndexType = typename Definition::IndexType;
+   using StateSpace = typename Definition::StateSpaceType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   static const IndexType COUNT{Definition::COUNT};
+
+   constexpr StaticStateMachine() : m_current(Definition::TABLES.initial) {}
+
+   //! Enter the initial state (root first).
+   void Start(Actor& actor) {
+      m_current = Definition::TABLES.initial;
+      InformActorOfCurrentState(actor);
+      RunHandlers(actor, Definition::TABLES.entryBegin[m_current], Definition::TABLES.entryEnd[m_current]);
+   }
+
+   //! Tick (or step if you like) the current active state.
+   void Tick(Actor& actor) const {
+      if (auto onTick = Definition::TABLES.tick[m_current]) {
+         onTick(actor);
+      }
+   }
+
+   //! Send a state transition event/signal to the current active state.
+   void Signal(Actor& actor, const SignalSpace s) {
+      auto signal = Definition::SpaceType::SignalToIndex(s);
+      if (signal >= Definition::SIGNAL_COUNT) {
+         return;
+      }
+      const auto& e = Definition::TABLES.entries[m_current][signal];
+      if ( NOT e.handled) {
+         return;
+      }
+      if (e.action) {
+         e.action(actor);
+      }
+      if (e.destination != COUNT && ( NOT e.allow || e.allow(actor))) {
+         RunHandlers(actor, e.exitBegin, e.exitEnd);
+         RunHandlers(actor, e.entryBegin, e.entryEnd);
+         m_current = e.destination;
+         InformActorOfCurrentState(actor);
+      }
+   }
+
+   StateSpace CurrentState() const { return static_cast<StateSpace>(m_current + Definition::SpaceType::FIRST); }
+
+private:
+   void RunHandlers(Actor& actor, size_t begin, size_t end) const {
+      for (auto i=begin; i<end; i++) {
+         Definition::TABLES.handlers[i](actor);
+      }
+   }
+   void InformActorOfCurrentState(Actor& actor) const {
+      if (auto noteState = Definition::TABLES.noteState) {
+         noteState(actor, CurrentState());
+      }
+   }
+
+   IndexType m_current;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
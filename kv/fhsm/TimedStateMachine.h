@@ -0,0 +1,162 @@
+#ifndef kv_fhsm_TimedStateMachine_h
+#define kv_fhsm_TimedStateMachine_h
+
+#include "Blueprint.h"
+#include "EventQueue.h"
+#include "SharedStateMachine.h"
+#include "TimingWheel.h"
+
+#include <array>
+#include <exception>
+
+namespace kv {
+namespace fhsm {
+
+//! The probe a TimedStateMachine runs its blueprint with: it holds the
+//! machine's timers, arms one for every state with a timeout that the
+//! machine enters and cancels it when the machine leaves the state, so a
+//! state that is left and entered again by one transition is armed again.
+//! A timer stays claimed after it expires, so a state times out only once
+//! per entry.
+//
+template<class Machine, class Definition, class Wheel, size_t timers>
+class TimeoutProbe : public NoInstrumentation<Definition> {
+public:
+   using IndexType = typename Definition::IndexType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   static const bool WALKS_STATES{true};
+
+   TimeoutProbe(Machine& machine, const Definition& definition, Wheel& wheel) : m_definition(definition), m_wheel(wheel) {
+      for (auto& timer : m_timers) {
+         timer.m_machine = &machine;
+      }
+   }
+   ~TimeoutProbe() {
+      for (auto& timer : m_timers) {
+         m_wheel.Cancel(timer);
+      }
+   }
+   TimeoutProbe(const TimeoutProbe&) = delete;
+   TimeoutProbe& operator=(const TimeoutProbe&) = delete;
+
+   void Entered(const IndexType state) {
+      if (auto timeout = m_definition.GetTimeout(state)) {
+         Arm(state, *timeout);
+      }
+   }
+   void Exited(const IndexType state) {
+      for (auto& timer : m_timers) {
+         if (timer.m_state == state) {
+            m_wheel.Cancel(timer);
+            timer.m_state = Definition::COUNT;
+         }
+      }
+   }
+
+   //! How many of the timers are armed.
+   size_t Armed() const {
+      size_t armed = 0;
+      for (auto& timer : m_timers) {
+         if (timer.IsArmed()) {
+            ++armed;
+         }
+      }
+      return armed;
+   }
+
+private:
+   // A timer belongs to an active state from its entry to its exit.
+   class Timer : public TimerEntry {
+   public:
+      Machine* m_machine{nullptr};
+      IndexType m_state{Definition::COUNT};
+      SignalSpace m_signal{};
+   protected:
+      void Expire() override {
+         m_machine->Signal(m_signal);
+      }
+   };
+
+   // TimedStateMachine::Start made sure there is a timer for every state that can be active at once.
+   void Arm(const IndexType state, const typename Definition::Timeout& timeout) {
+      for (auto& timer : m_timers) {
+         if (timer.m_state == Definition::COUNT) {
+            timer.m_state = state;
+            timer.m_signal = timeout.signal;
+            m_wheel.Arm(timer, timeout.after);
+            return;
+         }
+      }
+   }
+
+   const Definition& m_definition;
+   Wheel& m_wheel;
+   std::array<Timer, timers> m_timers;
+};
+
+//! A SharedStateMachine whose states may time out (see State::SetTimeout).
+//! Entering a state with a timeout arms a timer on the wheel; leaving it
+//! cancels the timer, and if it expires first the state gets its timeout
+//! signal. One wheel is shared by any number of machines, so a machine
+//! that is only waiting costs nothing until its timer is due: nothing
+//! needs to be ticked, and advancing the wheel skips the quiet stretches.
+//!
+//!    static TimingWheel<> wheel;
+//!    TimedStateMachine<MyBlueprint> m_hsm{*this, Blueprint(), wheel};
+//!    ...
+//!    wheel.Poll(clock);   // from the loop that owns the machines
+//!
+//! The machine holds up to `timers` armed timeouts at once (one per active
+//! state that has one); Start throws TooManyTimeoutsException if the
+//! blueprint can need more. Timers link into the wheel by address, so the
+//! machine can be neither copied nor moved, and timeouts are signaled
+//! (run to completion) from whichever thread advances the wheel.
+//! Like StateMachine it keeps up to KV_FHSM_DEFERRAL_CAPACITY deferred
+//! signals and the history of every state unless given another
+//! deferralCapacity or historyCapacity.
+//
+template<class Definition, class Wheel=TimingWheel<>, size_t timers=2,
+         size_t deferralCapacity=DEFAULT_DEFERRAL_CAPACITY, size_t historyCapacity=Definition::COUNT>
+class TimedStateMachine
+   : private BasicSharedStateMachine<Definition, DEFAULT_QUEUE_CAPACITY,
+                                     TimeoutProbe<TimedStateMachine<Definition, Wheel, timers, deferralCapacity, historyCapacity>, Definition, Wheel, timers>,
+                                     deferralCapacity, historyCapacity> {
+   using Machine = BasicSharedStateMachine<Definition, DEFAULT_QUEUE_CAPACITY, TimeoutProbe<TimedStateMachine, Definition, Wheel, timers>,
+                                           deferralCapacity, historyCapacity>;
+
+public:
+   using typename Machine::Actor;
+   using typename Machine::IndexType;
+   using typename Machine::StateSpace;
+   using typename Machine::SignalSpace;
+
+   class TooManyTimeoutsException : public std::exception {};
+
+   //! The blueprint and the wheel must outlive the machine.
+   TimedStateMachine(Actor& actor, const Definition& definition, Wheel& wheel)
+      : Machine(actor, definition, *this, definition, wheel) {}
+
+   //! Enter the initial state of the blueprint, arming its timeouts.
+   void Start() {
+      if (this->GetDefinition().MaxNestedTimeouts() > timers) {
+         throw TooManyTimeoutsException();
+      }
+      Machine::Start();
+   }
+
+   using Machine::Tick;
+   using Machine::Signal;
+   using Machine::Enqueue;
+   using Machine::DispatchQueued;
+   using Machine::Queued;
+   using Machine::Deferred;
+   using Machine::CurrentState;
+
+   //! How many of this machine's timeouts are armed.
+   size_t ArmedTimeouts() const { return this->GetInstrumentation().Armed(); }
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#endif
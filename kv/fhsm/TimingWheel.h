@@ -0,0 +1,227 @@
+#ifndef kv_fhsm_TimingWheel_h
+#define kv_fhsm_TimingWheel_h
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+template<size_t levels> class TimingWheel;
+
+//! A timer that can be armed on a TimingWheel. The entry itself is the
+//! list node (nothing is allocated) and knows where it is linked, so
+//! arming and cancelling are O(1). Derive from it and implement Expire.
+//
+class TimerEntry {
+public:
+   using Time = std::uint64_t;
+
+   TimerEntry() = default;
+   virtual ~TimerEntry() = default;
+   // It is linked into a wheel by address.
+   TimerEntry(const TimerEntry&) = delete;
+   TimerEntry& operator=(const TimerEntry&) = delete;
+
+   bool IsArmed() const { return m_link != nullptr; }
+   Time Deadline() const { return m_deadline; }
+
+protected:
+   //! Called by TimingWheel::AdvanceTo when the deadline is reached; the
+   //! timer is no longer armed by then and may be armed again.
+   virtual void Expire() = 0;
+
+private:
+   template<size_t levels> friend class TimingWheel;
+   TimerEntry* m_next{nullptr};
+   TimerEntry** m_link{nullptr}; // what points at this entry
+   Time m_deadline{0};
+   std::uint8_t m_level{0};
+   std::uint8_t m_slot{0};
+};
+
+//! A hierarchical timing wheel (after Varghese and Lauck): `levels` rings
+//! of 64 slots, level l covering 64^(l+1) ticks, so arming and cancelling
+//! are O(1) and advancing costs one step per occupied tick or cascade,
+//! however many timers are waiting further out. Empty stretches of time
+//! are skipped, so a (virtual) clock may jump far ahead at little cost.
+//! Timers further out than 64^levels ticks wait on the last level and are
+//! cascaded again until they are in range.
+//! Time is in ticks of whatever resolution the clock driving the wheel has
+//! (see VirtualClock and SteadyClock). A wheel is not thread safe; advance
+//! it from the thread that owns the machines using it.
+//
+template<size_t levels=4>
+class TimingWheel {
+   static_assert(levels > 0 && levels <= 10, "64^levels ticks must fit in 64 bits");
+   static const unsigned SLOT_BITS{6};
+   static const size_t SLOTS{size_t(1) << SLOT_BITS};
+   static const std::uint64_t MASK{SLOTS - 1};
+
+public:
+   using Time = TimerEntry::Time;
+   //! The longest time a timer can wait before it is cascaded.
+   static const Time SPAN{Time(1) << (SLOT_BITS * levels)};
+
+   TimingWheel() = default;
+   TimingWheel(const TimingWheel&) = delete;
+   TimingWheel& operator=(const TimingWheel&) = delete;
+
+   Time Now() const { return m_now; }
+   size_t Pending() const { return m_pending; }
+
+   //! Have timer expire after the given number of ticks (at least one),
+   //! re-arming it if it already is.
+   void Arm(TimerEntry& timer, Time after) {
+      Cancel(timer);
+      timer.m_deadline = m_now + (after ? after : 1);
+      Insert(timer);
+      ++m_pending;
+   }
+
+   void Cancel(TimerEntry& timer) {
+      if (timer.IsArmed()) {
+         Unlink(timer);
+         --m_pending;
+      }
+   }
+
+   //! Move time forward to `to`, expiring every timer whose deadline is
+   //! reached, in deadline order (and with Now() equal to the deadline).
+   void AdvanceTo(Time to) {
+      while (m_now < to) {
+         const auto next = NextEvent();
+         if (next > to) {
+            m_now = to;
+            return;
+         }
+         m_now = next - 1;
+         Step();
+      }
+   }
+   void AdvanceBy(Time ticks) { AdvanceTo(m_now + ticks); }
+
+   //! Advance to the clock's time.
+   template<class Clock>
+   void Poll(const Clock& clock) { AdvanceTo(clock.Now()); }
+
+private:
+   // The first tick at which Step has something to do: the deadline in the
+   // next occupied slot of level 0 or the next cascade of the lowest other
+   // occupied level, whichever comes first (never, if nothing is armed).
+   Time NextEvent() const {
+      Time next = ~Time(0);
+      if (m_occupied[0] != 0) {
+         // Level 0 only holds deadlines of the coming 64 ticks, each in its own slot.
+         const auto first = static_cast<unsigned>((m_now + 1) & MASK);
+         const auto ahead = first ? (m_occupied[0] >> first) | (m_occupied[0] << (SLOTS - first)) : m_occupied[0];
+         next = m_now + 1 + static_cast<Time>(__builtin_ctzll(ahead));
+      }
+      for (size_t level=1; level<levels; level++) {
+         if (m_occupied[level] != 0) {
+            const auto shift = SLOT_BITS * level;
+            const Time cascade = ((m_now >> shift) + 1) << shift;
+            return (cascade < next) ? cascade : next;
+         }
+      }
+      return next;
+   }
+
+   void Step() {
+      ++m_now;
+      // Higher levels first: what they cascade may land in a lower level's current slot.
+      for (size_t level=levels-1; level>0; level--) {
+         const auto shift = SLOT_BITS * level;
+         if ((m_now & ((Time(1) << shift) - 1)) == 0) {
+            const auto slot = (m_now >> shift) & MASK;
+            while (auto timer = m_slots[level][slot]) {
+               Unlink(*timer);
+               Insert(*timer);
+            }
+         }
+      }
+      const auto slot = m_now & MASK;
+      while (auto timer = m_slots[0][slot]) {
+         Unlink(*timer);
+         --m_pending;
+         timer->Expire(); // may arm timers, never in this slot
+      }
+   }
+
+   void Insert(TimerEntry& timer) {
+      const Time delta = timer.m_deadline - m_now;
+      size_t level = 0;
+      while (level < levels - 1 && delta >= (Time(1) << (SLOT_BITS * (level + 1)))) {
+         ++level;
+      }
+      // Out of range: wait as long as possible and look again when cascaded.
+      const Time when = (delta >= SPAN) ? m_now + SPAN - 1 : timer.m_deadline;
+      const auto slot = (when >> (SLOT_BITS * level)) & MASK;
+      auto& head = m_slots[level][slot];
+      timer.m_next = head;
+      if (head) {
+         head->m_link = &timer.m_next;
+      }
+      head = &timer;
+      timer.m_link = &head;
+      timer.m_level = static_cast<std::uint8_t>(level);
+      timer.m_slot = static_cast<std::uint8_t>(slot);
+      m_occupied[level] |= std::uint64_t(1) << slot;
+   }
+
+   void Unlink(TimerEntry& timer) {
+      *timer.m_link = timer.m_next;
+      if (timer.m_next) {
+         timer.m_next->m_link = timer.m_link;
+      }
+      if ( NOT m_slots[timer.m_level][timer.m_slot]) {
+         m_occupied[timer.m_level] &= ~(std::uint64_t(1) << timer.m_slot);
+      }
+      timer.m_next = nullptr;
+      timer.m_link = nullptr;
+   }
+
+   Time m_now{0};
+   size_t m_pending{0};
+   std::array<std::array<TimerEntry*, SLOTS>, levels> m_slots{};
+   std::array<std::uint64_t, levels> m_occupied{};
+};
+
+template<size_t levels>
+const TimerEntry::Time TimingWheel<levels>::SPAN;
+
+//! A clock for tests: time only moves when it is told to, as far as it is
+//! told to, at once.
+//
+class VirtualClock {
+public:
+   using Time = TimerEntry::Time;
+   Time Now() const { return m_now; }
+   void Advance(Time ticks) { m_now += ticks; }
+private:
+   Time m_now{0};
+};
+
+//! Ticks of the given resolution since the clock was created.
+//
+template<class Resolution=std::chrono::milliseconds>
+class SteadyClock {
+public:
+   using Time = TimerEntry::Time;
+   Time Now() const {
+      return static_cast<Time>(std::chrono::duration_cast<Resolution>(std::chrono::steady_clock::now() - m_start).count());
+   }
+private:
+   std::chrono::steady_clock::time_point m_start{std::chrono::steady_clock::now()};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef kv_fhsm_Trace_h
+#define kv_fhsm_Trace_h
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! What a TraceRecord records.
+enum class TraceKind : std::uint8_t {
+   START,      //!< the machine entered its initial state (destination)
+   UNHANDLED,  //!< nothing in source's hierarchy reacts to the signal
+   ACTION,     //!< the signal ran an action and no transition
+   TRANSITION, //!< the signal took source to destination (its guard, if any, allowed it)
+   BLOCKED,    //!< the guard of the transition to destination said no
+   DEFERRED,   //!< source deferred the signal (kept if the machine has room for it)
+};
+
+//! One event of a traced machine, as written to a TraceBuffer.
+struct TraceRecord {
+   std::uint64_t time;        //!< nanoseconds on the steady clock
+   std::uint32_t machine;     //!< the id the machine's tracer was attached with
+   std::uint16_t signal;
+   std::uint16_t source;      //!< state indices (see Blueprint::StateToIndex)
+   std::uint16_t destination;
+   TraceKind kind;
+};
+
+//! The ring of records a TraceBuffer owns, without its capacity in the
+//! type, so tracers can point at any buffer. Claiming a record is one
+//! atomic increment, so machines on different threads may share a buffer
+//! (records are then in claim order, which is nearly time order). Once the
+//! ring is full the oldest records are overwritten. Dump while no machine
+//! writes to the buffer (or accept that the newest records may be torn).
+//
+class TraceSink {
+public:
+   //! Dumps start with these bytes, then the record size and count as
+   //! uint32_t, then the records, in the byte order of the machine.
+   static constexpr const char* MAGIC = "FHSMTRC1";
+   static const size_t MAGIC_SIZE{8};
+
+   TraceSink(const TraceSink&) = delete;
+   TraceSink& operator=(const TraceSink&) = delete;
+
+   //! The record to fill in for the next event (overwriting the oldest one).
+   TraceRecord& Claim() {
+      return m_records[m_written.fetch_add(1, std::memory_order_relaxed) & m_mask];
+   }
+
+   //! How many records were written in all (some may have been overwritten).
+   std::uint64_t Written() const { return m_written.load(std::memory_order_relaxed); }
+
+   //! Call f(record) for the records still in the buffer, oldest first.
+   template<class F>
+   void ForEach(F f) const {
+      const auto written = Written();
+      const std::uint64_t kept = (written < m_mask + 1) ? written : m_mask + 1;
+      for (auto i=written - kept; i<written; i++) {
+         f(m_records[i & m_mask]);
+      }
+   }
+
+   //! Write the records still in the buffer, oldest first, for the decoder.
+   void Dump(std::ostream& out) const {
+      const auto written = Written();
+      const auto kept = static_cast<std::uint32_t>((written < m_mask + 1) ? written : m_mask + 1);
+      const auto size = static_cast<std::uint32_t>(sizeof(TraceRecord));
+      out.write(MAGIC, MAGIC_SIZE);
+      out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      out.write(reinterpret_cast<const char*>(&kept), sizeof(kept));
+      ForEach([&out](const TraceRecord& record) {
+         out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+      });
+   }
+
+   //! Forget all records.
+   void Clear() { m_written.store(0, std::memory_order_relaxed); }
+
+protected:
+   TraceSink(TraceRecord* records, size_t capacity) : m_records(records), m_mask(capacity - 1) {}
+
+private:
+   TraceRecord* const m_records;
+   const size_t m_mask;
+   std::atomic<std::uint64_t> m_written{0};
+};
+
+// The records of a TraceBuffer, in a base of their own so they exist before the TraceSink that points at them.
+template<size_t capacity>
+struct TraceStorage {
+   std::array<TraceRecord, capacity> m_storage;
+};
+
+//! A TraceSink of a fixed number of records (a power of two); it never allocates.
+//
+template<size_t capacity>
+class TraceBuffer : private TraceStorage<capacity>, public TraceSink {
+   static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "The capacity must be a power of two");
+public:
+   TraceBuffer() : TraceSink(this->m_storage.data(), capacity) {}
+};
+
+//! An instrumentation policy that writes one record per start and per
+//! signal (with its outcome) to the TraceSink it is attached to: a clock
+//! read, an atomic increment and a handful of stores, cheap enough to
+//! leave on. A signal's record is written whole once the signal has been
+//! dealt with, so its time is when its handlers were done; a transition
+//! records the state it ended in (the restored one for a history
+//! transition). Until it is attached it records nothing.
+//!
+//!    static TraceBuffer<4096> trace;   // shared by all the machines
+//!    m_hsm.GetInstrumentation().Attach(trace, id);
+//
+template<class Definition>
+class TracingInstrumentation {
+public:
+   using IndexType = typename Definition::IndexType;
+   using SignalSpace = typename Definition::SignalSpaceType;
+   static const bool WALKS_STATES{false};
+
+   //! Trace to sink (nullptr to stop), tagging the records with machine.
+   void Attach(TraceSink* sink, std::uint32_t machine) {
+      m_sink = sink;
+      m_machine = machine;
+   }
+   void Attach(TraceSink& sink, std::uint32_t machine) { Attach(&sink, machine); }
+
+   void Started(const IndexType initial) {
+      Write(TraceKind::START, 0, initial, initial);
+   }
+   // The hooks before Dispatched note the outcome; Dispatched writes it.
+   void Dispatched(const IndexType current, const SignalSpace s, const bool consumed) {
+      if ( NOT m_isNoted) {
+         m_kind = consumed ? TraceKind::ACTION : TraceKind::UNHANDLED;
+         m_destination = current;
+      }
+      m_isNoted = false;
+      Write(m_kind, static_cast<std::uint16_t>(s), current, m_destination);
+   }
+   void Guarded(const IndexType, const IndexType to, const bool allowed) {
+      Note(allowed ? TraceKind::TRANSITION : TraceKind::BLOCKED, to);
+   }
+   void Deferred(const IndexType current, const SignalSpace) {
+      Note(TraceKind::DEFERRED, current);
+   }
+   void Exited(const IndexType) {}
+   void Entered(const IndexType) {}
+   void Transitioned(const IndexType, const IndexType to) {
+      m_destination = to;
+   }
+
+private:
+   void Note(TraceKind kind, IndexType destination) {
+      m_kind = kind;
+      m_destination = destination;
+      m_isNoted = true;
+   }
+   void Write(TraceKind kind, std::uint16_t signal, IndexType source, IndexType destination) {
+      if (m_sink) {
+         TraceRecord& record = m_sink->Claim();
+         // Clear the padding too, so dumps do not carry stale bytes.
+         std::memset(&record, 0, sizeof(record));
+         record.time = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+         record.machine = m_machine;
+         record.signal = signal;
+         record.source = source;
+         record.destination = destination;
+         record.kind = kind;
+      }
+   }
+
+   TraceSink* m_sink{nullptr};
+   std::uint32_t m_machine{0};
+   TraceKind m_kind{TraceKind::UNHANDLED}; // the outcome noted for the signal being dispatched
+   IndexType m_destination{0};
+   bool m_isNoted{false};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef kv_fhsm_TraceDecoder_h
+#define kv_fhsm_TraceDecoder_h
+
+#include "Trace.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! Turns trace records (read back from TraceSink::Dump) into text, or into
+//! Chrome trace event JSON (for chrome://tracing and ui.perfetto.dev) with
+//! one track per machine and one span per stay in a state.
+//! Records only hold numbers; name the states (by index) and the signals
+//! (by value) to have them spelled out.
+//
+class TraceDecoder {
+public:
+   class FormatException : public std::exception {
+   public:
+      const char* what() const noexcept override { return "not a kv::fhsm trace dump"; }
+   };
+
+   TraceDecoder& NameState(std::uint16_t index, std::string name) {
+      m_stateNames[index] = std::move(name);
+      return *this;
+   }
+   TraceDecoder& NameSignal(std::uint16_t value, std::string name) {
+      m_signalNames[value] = std::move(name);
+      return *this;
+   }
+
+   //! Read a dump; throws FormatException if it is not one (of this build's records).
+   static std::vector<TraceRecord> Read(std::istream& in) {
+      char magic[TraceSink::MAGIC_SIZE];
+      std::uint32_t size = 0;
+      std::uint32_t count = 0;
+      in.read(magic, sizeof(magic));
+      in.read(reinterpret_cast<char*>(&size), sizeof(size));
+      in.read(reinterpret_cast<char*>(&count), sizeof(count));
+      if ( NOT in || std::memcmp(magic, TraceSink::MAGIC, sizeof(magic)) != 0 || size != sizeof(TraceRecord)) {
+         throw FormatException();
+      }
+      std::vector<TraceRecord> records(count);
+      in.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(count * sizeof(TraceRecord)));
+      if ( NOT in) {
+         throw FormatException();
+      }
+      return records;
+   }
+
+   //! One line per record, with times in microseconds from the first one.
+   void WriteText(std::ostream& out, const std::vector<TraceRecord>& records) const {
+      const auto origin = records.empty() ? 0 : records.front().time;
+      for (auto& r : records) {
+         out << Microseconds(r.time - origin) << " us  #" << r.machine << "  ";
+         switch (r.kind) {
+            case TraceKind::START:
+               out << "start in " << State(r.destination);
+               break;
+            case TraceKind::UNHANDLED:
+               out << State(r.source) << " ignores " << Signal(r.signal);
+               break;
+            case TraceKind::ACTION:
+               out << State(r.source) << " handles " << Signal(r.signal);
+               break;
+            case TraceKind::TRANSITION:
+               out << State(r.source) << " --" << Signal(r.signal) << "--> " << State(r.destination);
+               break;
+            case TraceKind::BLOCKED:
+               out << State(r.source) << " --" << Signal(r.signal) << "--| " << State(r.destination) << " (guard)";
+               break;
+            case TraceKind::DEFERRED:
+               out << State(r.source) << " defers " << Signal(r.signal);
+               break;
+         }
+         out << "\n";
+      }
+   }
+
+   //! A Chrome trace event file: a complete ("X") event for every stay in a
+   //! state, on the machine's track, and an instant event for every signal.
+   //! The stays still open at the last record end there.
+   void WriteChromeTrace(std::ostream& out, const std::vector<TraceRecord>& records) const {
+      const auto origin = records.empty() ? 0 : records.front().time;
+      const auto end = records.empty() ? 0 : records.back().time;
+      std::map<std::uint32_t, std::pair<std::uint16_t, std::uint64_t>> stays; // machine: (state, since)
+      const char* separator = "\n";
+      out << "{\"traceEvents\":[";
+      auto span = [&](std::uint32_t machine, std::uint16_t state, std::uint64_t from, std::uint64_t to) {
+         out << separator << "{\"name\":\"" << Json(State(state)) << "\",\"cat\":\"state\",\"ph\":\"X\",\"pid\":0,\"tid\":" << machine
+             << ",\"ts\":" << Microseconds(from - origin) << ",\"dur\":" << Microseconds(to - from) << "}";
+         separator = ",\n";
+      };
+      for (auto& r : records) {
+         if (r.kind != TraceKind::START) {
+            out << separator << "{\"name\":\"" << Json(Signal(r.signal)) << "\",\"cat\":\"signal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << r.machine
+                << ",\"ts\":" << Microseconds(r.time - origin) << ",\"args\":{\"outcome\":\"" << Outcome(r.kind) << "\"}}";
+            separator = ",\n";
+         }
+         if (r.kind == TraceKind::START || r.kind == TraceKind::TRANSITION) {
+            auto stay = stays.find(r.machine);
+            if (stay != stays.end()) {
+               span(r.machine, stay->second.first, stay->second.second, r.time);
+            }
+            stays[r.machine] = std::make_pair(r.destination, r.time);
+         }
+      }
+      for (auto& stay : stays) {
+         span(stay.first, stay.second.first, stay.second.second, end);
+      }
+      out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+   }
+
+private:
+   static std::string Microseconds(std::uint64_t nanoseconds) {
+      std::string fraction = std::to_string(nanoseconds % 1000);
+      return std::to_string(nanoseconds / 1000) + "." + std::string(3 - fraction.size(), '0') + fraction;
+   }
+   // The text of a JSON string: quotes, backslashes and control characters escaped.
+   static std::string Json(const std::string& text) {
+      std::string escaped;
+      for (char c : text) {
+         if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+         } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+            escaped += code;
+         } else {
+            escaped += c;
+         }
+      }
+      return escaped;
+   }
+   static const char* Outcome(TraceKind kind) {
+      switch (kind) {
+         case TraceKind::UNHANDLED: return "unhandled";
+         case TraceKind::ACTION: return "action";
+         case TraceKind::TRANSITION: return "transition";
+         case TraceKind::BLOCKED: return "blocked";
+         case TraceKind::DEFERRED: return "deferred";
+         default: return "start";
+      }
+   }
+   std::string State(std::uint16_t index) const {
+      auto name = m_stateNames.find(index);
+      return (name != m_stateNames.end()) ? name->second : "state " + std::to_string(index);
+   }
+   std::string Signal(std::uint16_t value) const {
+      auto name = m_signalNames.find(value);
+      return (name != m_signalNames.end()) ? name->second : "signal " + std::to_string(value);
+   }
+
+   std::map<std::uint16_t, std::string> m_stateNames;
+   std::map<std::uint16_t, std::string> m_signalNames;
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
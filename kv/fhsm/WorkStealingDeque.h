@@ -0,0 +1,97 @@
+#ifndef kv_fhsm_WorkStealingDeque_h
+#define kv_fhsm_WorkStealingDeque_h
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define NOT !
+
+namespace kv {
+namespace fhsm {
+
+//! A fixed capacity Chase-Lev deque of pointers (after Le, Pop, Cohen and
+//! Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+//! Models"). Its owner pushes and pops at the bottom (LIFO, so recently
+//! scheduled work runs while it is still in cache); any other thread may
+//! steal from the top (FIFO). Neither side takes a lock; the owner only
+//! synchronizes with thieves when one item is left.
+//! The capacity must be a power of two.
+//
+template<typename T, size_t capacity>
+class WorkStealingDeque {
+   static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "The capacity must be a power of two");
+   static const size_t MASK{capacity - 1};
+   static const size_t CACHE_LINE{64};
+
+public:
+   WorkStealingDeque() {
+      for (auto& item : m_items) {
+         item.store(nullptr, std::memory_order_relaxed);
+      }
+   }
+   WorkStealingDeque(const WorkStealingDeque&) = delete;
+   WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+   //! Owner only; false if the deque is full.
+   bool Push(T* item) {
+      const auto bottom = m_bottom.load(std::memory_order_relaxed);
+      const auto top = m_top.load(std::memory_order_acquire);
+      if (bottom - top >= static_cast<std::int64_t>(capacity)) {
+         return false;
+      }
+      m_items[bottom & MASK].store(item, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      return true;
+   }
+
+   //! Owner only; the most recently pushed item, or nullptr.
+   T* Pop() {
+      const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+      m_bottom.store(bottom, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto top = m_top.load(std::memory_order_relaxed);
+      if (top > bottom) {
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+         return nullptr; // empty
+      }
+      T* item = m_items[bottom & MASK].load(std::memory_order_relaxed);
+      if (top == bottom) {
+         // The last item: race the thieves for it.
+         if ( NOT m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            item = nullptr;
+         }
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      }
+      return item;
+   }
+
+   //! Any thread; the oldest item, or nullptr if there is none (or another thief got it first).
+   T* Steal() {
+      auto top = m_top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const auto bottom = m_bottom.load(std::memory_order_acquire);
+      if (top >= bottom) {
+         return nullptr;
+      }
+      T* item = m_items[top & MASK].load(std::memory_order_relaxed);
+      if ( NOT m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+         return nullptr;
+      }
+      return item;
+   }
+
+private:
+   std::array<std::atomic<T*>, capacity> m_items;
+   alignas(CACHE_LINE) std::atomic<std::int64_t> m_top{0};
+   alignas(CACHE_LINE) std::atomic<std::int64_t> m_bottom{0};
+};
+
+} // namespace fhsm
+} // namespace kv
+
+#undef NOT
+
+#endif
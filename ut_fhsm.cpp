@@ -1,6 +1,15 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "kv/fhsm/StateMachine.h"
+#include "kv/fhsm/SharedStateMachine.h"
+#include "kv/fhsm/RelocatableStateMachine.h"
+#include "kv/fhsm/OrthogonalStateMachine.h"
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 using namespace kv::fhsm;
 
@@ -390,3 +399,1065 @@ SCENARIO("Usage errors", "[fhsm]") {
       }
    }
 }
+
+class DenseController {
+   MyStates m_state = INVALID;
+   StateMachine<DenseController, MyStates, WHOLE, NNW, MySignals, GO_NORTH, DO_ACTION> m_hsm;
+public:
+   DenseController() : m_hsm(*this) {
+      m_hsm.DefineState(WHOLE)
+         .SetNoParent()
+         .SetOnTick(&DenseController::CountTick)
+         .ForSignal(GO_HOME).GoTo(SOUTH);
+
+      m_hsm.DefineState(NORTH)
+         .SetParent(WHOLE)
+         .ForSignal(GO_WEST).GoTo(NORTH_WEST)
+         .ForSignal(DO_ACTION).Do(&DenseController::CountAction);
+
+      m_hsm.DefineState(SOUTH)
+         .SetParent(WHOLE)
+         .ForSignal(GO_NORTH).GoTo(NORTH)
+         .ForSignal(GO_EAST).GoToIf(EAST, &DenseController::IsEastOpen);
+
+      m_hsm.DefineState(EAST)
+         .SetParent(WHOLE);
+
+      m_hsm.DefineState(NORTH_WEST)
+         .SetParent(NORTH)
+         .ForSignal(GO_NORTH).GoTo(NNW);
+
+      m_hsm.DefineState(NNW)
+         .SetParent(NORTH_WEST);
+
+      m_hsm.ConcludeSetupAndSetInitialState(SOUTH, &DenseController::NewState);
+   }
+   int CurrentState() const { return static_cast<int>(m_state); }
+   void NewState(const MyStates s) { m_state = s; }
+   void Tick() { m_hsm.Tick(); }
+   void Signal(const MySignals s) { m_hsm.Signal(s); }
+   void AddShortcutFromNNW() {
+      m_hsm.DefineState(NNW)
+         .SetParent(NORTH_WEST)
+         .ForSignal(GO_HOME).GoTo(EAST);
+   }
+   void CountTick() { ++tick_count; }
+   void CountAction() { ++action_count; }
+   bool IsEastOpen() const { return m_eastIsOpen; }
+
+   bool m_eastIsOpen = true;
+   int tick_count = 0;
+   int action_count = 0;
+};
+
+SCENARIO("A state machine with a dense signal range", "[fhsm]") {
+   DenseController uut;
+   GIVEN("We are in a third level sub-state") {
+      uut.Signal(GO_NORTH);
+      uut.Signal(GO_WEST);
+      uut.Signal(GO_NORTH);
+      REQUIRE(NNW == uut.CurrentState());
+      WHEN("Signals handled by ancestors are sent") {
+         uut.Signal(DO_ACTION);
+         uut.Tick();
+         uut.Signal(GO_HOME);
+         THEN("They are handled by the ancestors") {
+            CHECK(1 == uut.action_count);
+            CHECK(1 == uut.tick_count);
+            CHECK(SOUTH == uut.CurrentState());
+         }
+      }
+   }
+   GIVEN("A transition added after setup was concluded") {
+      uut.AddShortcutFromNNW();
+      WHEN("The signal is sent from the state that overrides its ancestor") {
+         uut.Signal(GO_NORTH);
+         uut.Signal(GO_WEST);
+         uut.Signal(GO_NORTH);
+         uut.Signal(GO_HOME);
+         THEN("The new transition wins") {
+            CHECK(EAST == uut.CurrentState());
+         }
+      }
+      WHEN("The signal is sent from a state that does not see the new transition") {
+         uut.Signal(GO_NORTH);
+         uut.Signal(GO_HOME);
+         THEN("The ancestor still handles it") {
+            CHECK(SOUTH == uut.CurrentState());
+         }
+      }
+   }
+   GIVEN("A guarded transition") {
+      WHEN("The guard blocks") {
+         uut.m_eastIsOpen = false;
+         uut.Signal(GO_EAST);
+         THEN("No transition happens") {
+            CHECK(SOUTH == uut.CurrentState());
+         }
+      }
+      WHEN("The guard allows") {
+         uut.Signal(GO_EAST);
+         THEN("The transition happens") {
+            CHECK(EAST == uut.CurrentState());
+         }
+      }
+   }
+   GIVEN("A signal outside of the declared range") {
+      uut.Signal(static_cast<MySignals>(DO_ACTION + 1));
+      THEN("It is ignored") {
+         CHECK(SOUTH == uut.CurrentState());
+      }
+   }
+}
+
+TEST_CASE( "Dense signal table lookups", "[fhsm]" ) {
+   DenseSignalTable<MySignals, GO_SOUTH, GO_HOME, int> table;
+   static_assert(4 == decltype(table)::COUNT, "four signals in range");
+   CHECK(nullptr == table.Find(GO_EAST));
+   table.Set(GO_EAST, 7);
+   table.SetIfAbsent(GO_EAST, 8);
+   REQUIRE(table.Find(GO_EAST));
+   CHECK(7 == *table.Find(GO_EAST));
+   table.Set(GO_NORTH, 1); // below the range
+   table.Set(DO_ACTION, 1); // above the range
+   CHECK(nullptr == table.Find(GO_NORTH));
+   CHECK(nullptr == table.Find(DO_ACTION));
+}
+
+// Size budgets for the tables a dense machine touches while running.
+using DenseDefinition = Blueprint<DenseController, MyStates, WHOLE, NNW, MySignals, GO_NORTH, DO_ACTION>;
+static_assert(sizeof(DenseDefinition::IndexType) == 1, "six states index with a byte");
+static_assert(sizeof(DenseDefinition::MethodSlot) == 1, "so do their handlers");
+static_assert(sizeof(DenseDefinition::Resolution) <= 8, "a resolved signal is a handful of bytes");
+static_assert(sizeof(DenseDefinition::SignalTable<DenseDefinition::Resolution>) <= 64,
+              "all signals of a state fit in a cache line");
+static_assert(DenseDefinition::COUNT * (sizeof(DenseDefinition::SignalTable<DenseDefinition::Resolution>) + sizeof(DenseDefinition::MethodSlot)) <= 6 * 64,
+              "the dispatch tables of six states fit in six cache lines");
+static_assert(sizeof(RelocatableStateMachine<DenseDefinition>) <= 2 * sizeof(void*), "a pointer, a byte and a tick count");
+static_assert(sizeof(StateMachine<DenseController, MyStates, WHOLE, NNW, MySignals, GO_NORTH, DO_ACTION>) <= 3 * 1024,
+              "a dense six by six machine, its definition included, stays within 3 KiB");
+
+// A distinct action for every cell of the dense table.
+template<size_t n>
+struct NthAction {
+   void operator()(DenseController&) const {}
+};
+template<size_t... n>
+void DefineDistinctActions(DenseDefinition& b, std::index_sequence<n...>) {
+   const int unused[] = { (b.DefineState(static_cast<MyStates>(n / 6)).SetNoParent()
+                              .ForSignal(static_cast<MySignals>(n % 6)).Do(NthAction<n>{}), 0)... };
+   (void)unused;
+}
+
+TEST_CASE( "A dense blueprint has room for a fixed number of distinct handlers", "[fhsm]" ) {
+   static_assert(DenseDefinition::METHOD_CAPACITY == 1 + KV_FHSM_HANDLER_CAPACITY, "fewer than the 6 * 9 a six by six machine could have");
+   DenseDefinition fits;
+   CHECK_NOTHROW(DefineDistinctActions(fits, std::make_index_sequence<KV_FHSM_HANDLER_CAPACITY>()));
+   DenseDefinition overflows;
+   CHECK_THROWS_AS(DefineDistinctActions(overflows, std::make_index_sequence<KV_FHSM_HANDLER_CAPACITY + 1>()),
+                   DenseDefinition::TooManyHandlersException);
+}
+
+enum class DeepStates  { ROOT, A, AA, AAA, AB, B, BB };
+enum class DeepSignals { JUMP, BACK, SIDE };
+class DeepTest {
+   StateMachine<DeepTest, DeepStates, DeepStates::ROOT, DeepStates::BB, DeepSignals> m_hsm;
+public:
+   DeepTest() : m_hsm(*this) {
+      m_hsm.DefineState(DeepStates::ROOT)
+         .SetNoParent()
+         .SetOnEnter(&DeepTest::EnterRoot)
+         .SetOnExit(&DeepTest::ExitRoot)
+         .ForSignal(DeepSignals::BACK).GoTo(DeepStates::AAA)
+         .ForSignal(DeepSignals::SIDE).GoTo(DeepStates::AB);
+      m_hsm.DefineState(DeepStates::A)
+         .SetParent(DeepStates::ROOT)
+         .SetOnEnter(&DeepTest::EnterA)
+         .SetOnExit(&DeepTest::ExitA);
+      m_hsm.DefineState(DeepStates::AA) // no handlers at this level
+         .SetParent(DeepStates::A);
+      m_hsm.DefineState(DeepStates::AAA)
+         .SetParent(DeepStates::AA)
+         .SetOnExit(&DeepTest::ExitAAA)
+         .ForSignal(DeepSignals::JUMP).GoTo(DeepStates::BB);
+      m_hsm.DefineState(DeepStates::AB)
+         .SetParent(DeepStates::A)
+         .SetOnEnter(&DeepTest::EnterAB);
+      m_hsm.DefineState(DeepStates::B)
+         .SetParent(DeepStates::ROOT)
+         .SetOnEnter(&DeepTest::EnterB);
+      m_hsm.DefineState(DeepStates::BB)
+         .SetParent(DeepStates::B)
+         .SetOnEnter(&DeepTest::EnterBB)
+         .SetOnExit(&DeepTest::ExitBB);
+      m_hsm.ConcludeSetupAndSetInitialState(DeepStates::AAA);
+   }
+   void Signal(const DeepSignals s) { m_hsm.Signal(s); }
+   void Tick() { m_hsm.Tick(); }
+   void AddTickToA() {
+      m_hsm.DefineState(DeepStates::A)
+         .SetParent(DeepStates::ROOT)
+         .SetOnTick(&DeepTest::CountTick);
+   }
+   void SlowDownA(std::uint32_t period) {
+      m_hsm.DefineState(DeepStates::A)
+         .SetParent(DeepStates::ROOT)
+         .SetTickPeriod(period);
+   }
+   void SlowDownAAA(std::uint32_t period) {
+      m_hsm.DefineState(DeepStates::AAA)
+         .SetParent(DeepStates::AA)
+         .SetTickPeriod(period);
+   }
+   void CountTick() { ++tick_count; }
+   int tick_count = 0;
+   void EnterRoot() { trail += "+root"; }
+   void ExitRoot() { trail += "-root"; }
+   void EnterA() { trail += "+A"; }
+   void ExitA() { trail += "-A"; }
+   void ExitAAA() { trail += "-AAA"; }
+   void EnterAB() { trail += "+AB"; }
+   void EnterB() { trail += "+B"; }
+   void EnterBB() { trail += "+BB"; }
+   void ExitBB() { trail += "-BB"; }
+   std::string trail;
+};
+
+SCENARIO("Transitions run the precomputed exit and enter paths", "[fhsm]") {
+   DeepTest uut;
+   GIVEN("The machine was started in a deep state") {
+      REQUIRE("+root+A" == uut.trail);
+      WHEN("A transition crosses to another branch") {
+         uut.trail.clear();
+         uut.Signal(DeepSignals::JUMP);
+         THEN("Exits run leaf first, enters run root first, and only up to the common ancestor") {
+            CHECK("-AAA-A+B+BB" == uut.trail);
+         }
+         AND_WHEN("A transition inherited from the root goes back") {
+            uut.trail.clear();
+            uut.Signal(DeepSignals::BACK);
+            THEN("The paths are computed from the current leaf") {
+               CHECK("-BB+A" == uut.trail);
+            }
+         }
+      }
+      WHEN("A transition inherited from the root goes to a sibling of the leaf's branch") {
+         uut.trail.clear();
+         uut.Signal(DeepSignals::SIDE);
+         THEN("The paths are computed from the current leaf, so their common parent is neither left nor entered") {
+            CHECK("-AAA+AB" == uut.trail);
+         }
+      }
+   }
+}
+
+SCENARIO("Tick handlers are resolved when the definition changes", "[fhsm]") {
+   DeepTest uut;
+   GIVEN("No state in the ancestry has a tick handler") {
+      uut.Tick();
+      REQUIRE(0 == uut.tick_count);
+      WHEN("An ancestor gets a tick handler after setup was concluded") {
+         uut.AddTickToA();
+         uut.Tick();
+         THEN("The leaf ticks through it") {
+            CHECK(1 == uut.tick_count);
+         }
+         AND_WHEN("The machine moves outside of that ancestor") {
+            uut.Signal(DeepSignals::JUMP);
+            uut.Tick();
+            THEN("Nothing ticks") {
+               CHECK(1 == uut.tick_count);
+            }
+         }
+         AND_WHEN("The ancestor gets a tick period") {
+            uut.SlowDownA(10);
+            for (int t=1; t<30; t++) {
+               uut.Tick(); // ticks 2 to 30 of the machine
+            }
+            THEN("The leaf ticks through it every 10th tick") {
+               CHECK(1 + 3 == uut.tick_count);
+            }
+         }
+         AND_WHEN("The leaf sets a period of its own") {
+            uut.SlowDownA(10);
+            uut.SlowDownAAA(4);
+            for (int t=1; t<30; t++) {
+               uut.Tick();
+            }
+            THEN("It overrides the ancestor's") {
+               CHECK(1 + 7 == uut.tick_count);
+            }
+         }
+      }
+   }
+}
+
+class CountedDeep {
+public:
+   using Machine = InstrumentedStateMachine<CountedDeep, DeepStates, DeepStates::ROOT, DeepStates::BB, DeepSignals>;
+   CountedDeep() : m_hsm(*this) {
+      m_hsm.DefineState(DeepStates::ROOT)
+         .SetNoParent()
+         .ForSignal(DeepSignals::BACK).GoTo(DeepStates::AAA);
+      m_hsm.DefineState(DeepStates::A).SetParent(DeepStates::ROOT);
+      m_hsm.DefineState(DeepStates::AA).SetParent(DeepStates::A);
+      m_hsm.DefineState(DeepStates::AAA)
+         .SetParent(DeepStates::AA)
+         .ForSignal(DeepSignals::JUMP).GoTo(DeepStates::BB);
+      m_hsm.DefineState(DeepStates::B).SetParent(DeepStates::ROOT);
+      m_hsm.DefineState(DeepStates::BB).SetParent(DeepStates::B);
+      m_hsm.ConcludeSetupAndSetInitialState(DeepStates::AAA);
+   }
+   Machine m_hsm;
+};
+
+SCENARIO("An instrumented machine counts what it does", "[fhsm]") {
+   CountedDeep uut;
+   const auto index = [&uut](DeepStates s) { return uut.m_hsm.GetDefinition().StateToIndex(s); };
+   GIVEN("A machine that was started, signaled and sent back") {
+      uut.m_hsm.Signal(DeepSignals::JUMP);
+      uut.m_hsm.Signal(DeepSignals::JUMP); // BB does not react to it
+      uut.m_hsm.Signal(DeepSignals::BACK);
+      const auto counts = uut.m_hsm.GetInstrumentation().Snapshot();
+      THEN("Dispatches, consumed and unhandled signals are counted") {
+         CHECK(1 == counts.Dispatched(index(DeepStates::AAA), DeepSignals::JUMP));
+         CHECK(1 == counts.Dispatched(index(DeepStates::BB), DeepSignals::JUMP));
+         CHECK(1 == counts.Dispatched(index(DeepStates::BB), DeepSignals::BACK));
+         CHECK(0 == counts.Dispatched(index(DeepStates::AAA), DeepSignals::BACK));
+         CHECK(2 == counts.consumed);
+         CHECK(1 == counts.unhandled);
+         CHECK(0 == counts.uncounted);
+      }
+      THEN("Transitions are counted per edge, entries and exits per state") {
+         CHECK(1 == counts.Transitions(index(DeepStates::AAA), index(DeepStates::BB)));
+         CHECK(1 == counts.Transitions(index(DeepStates::BB), index(DeepStates::AAA)));
+         CHECK(1 == counts.entries[index(DeepStates::ROOT)]);
+         CHECK(0 == counts.exits[index(DeepStates::ROOT)]);
+         CHECK(2 == counts.entries[index(DeepStates::A)]);
+         CHECK(1 == counts.exits[index(DeepStates::A)]);
+         CHECK(1 == counts.entries[index(DeepStates::BB)]);
+         CHECK(1 == counts.exits[index(DeepStates::B)]);
+      }
+      WHEN("The counts are taken and reset") {
+         uut.m_hsm.GetInstrumentation().SnapshotAndReset();
+         uut.m_hsm.Signal(DeepSignals::JUMP);
+         const auto later = uut.m_hsm.GetInstrumentation().Snapshot();
+         THEN("The machine keeps counting from zero") {
+            CHECK(1 == later.consumed);
+            CHECK(0 == later.unhandled);
+            CHECK(0 == later.entries[index(DeepStates::A)]);
+            CHECK(1 == later.entries[index(DeepStates::BB)]);
+            CHECK(1 == later.Dispatched(index(DeepStates::AAA), DeepSignals::JUMP));
+            CHECK(0 == later.Transitions(index(DeepStates::BB), index(DeepStates::AAA)));
+         }
+      }
+      WHEN("More distinct signals are dispatched than it counts per state") {
+         for (int s=0; s<KV_FHSM_COUNTED_SIGNALS; s++) {
+            uut.m_hsm.Signal(static_cast<DeepSignals>(100 + s));
+         }
+         const auto later = uut.m_hsm.GetInstrumentation().Snapshot();
+         THEN("The dispatches of the signals beyond them are only counted in all") {
+            CHECK(CountedDeep::Machine::Probe::SIGNALS == KV_FHSM_COUNTED_SIGNALS);
+            CHECK(1 == later.Dispatched(index(DeepStates::AAA), static_cast<DeepSignals>(100)));
+            CHECK(0 == later.Dispatched(index(DeepStates::AAA), static_cast<DeepSignals>(99 + KV_FHSM_COUNTED_SIGNALS)));
+            CHECK(2 == later.uncounted);
+            CHECK(1 + KV_FHSM_COUNTED_SIGNALS == later.unhandled);
+         }
+      }
+   }
+}
+
+static_assert(sizeof(NoInstrumentation<DenseDefinition>) == 1, "no instrumentation is an empty class");
+
+enum class RelayStates  { IDLE, ARMED, FIRED };
+enum class RelaySignals { ARM, FIRE, ECHO, RESET };
+class Relay {
+   StateMachine<Relay, RelayStates, RelayStates::IDLE, RelayStates::FIRED, RelaySignals> m_hsm;
+public:
+   Relay() : m_hsm(*this) {
+      m_hsm.DefineState(RelayStates::IDLE)
+         .SetNoParent()
+         .ForSignal(RelaySignals::ARM).GoTo(RelayStates::ARMED);
+      m_hsm.DefineState(RelayStates::ARMED)
+         .SetNoParent()
+         .SetOnEnter(&Relay::EnterArmed)
+         .ForSignal(RelaySignals::FIRE).GoTo(RelayStates::FIRED);
+      m_hsm.DefineState(RelayStates::FIRED)
+         .SetNoParent()
+         .SetOnEnter(&Relay::EnterFired)
+         .ForSignal(RelaySignals::ECHO).Do(&Relay::Flood)
+         .ForSignal(RelaySignals::RESET).GoTo(RelayStates::IDLE);
+      m_hsm.ConcludeSetupAndSetInitialState(RelayStates::IDLE, &Relay::NewState);
+   }
+   void EnterArmed() { trail += "+armed"; m_hsm.Signal(RelaySignals::FIRE); }
+   void EnterFired() { trail += "+fired"; }
+   // The first echo raises a burst of them; the rest only leave a mark.
+   void Flood() {
+      trail += "!echo";
+      if (flooded) return;
+      flooded = true;
+      for (int i=0; i<10; i++) {
+         if (!m_hsm.Signal(RelaySignals::ECHO)) {
+            ++dropped;
+         }
+      }
+   }
+   void NewState(const RelayStates s) { state = s; trail += "@" + std::to_string(int(s)); }
+   std::string trail;
+   bool flooded = false;
+   int dropped = 0;
+   RelayStates state = RelayStates::IDLE;
+   decltype(m_hsm)& Hsm() { return m_hsm; }
+};
+
+SCENARIO("Signals raised by handlers run to completion", "[fhsm]") {
+   Relay uut;
+   GIVEN("An enter handler that raises a signal") {
+      uut.trail.clear();
+      WHEN("The machine enters that state") {
+         uut.Hsm().Signal(RelaySignals::ARM);
+         THEN("The transition completes before the raised signal is dispatched") {
+            CHECK("+armed@1+fired@2" == uut.trail);
+            CHECK(RelayStates::FIRED == uut.state);
+         }
+         AND_WHEN("A handler raises more signals than the queue holds") {
+            uut.trail.clear();
+            uut.Hsm().Signal(RelaySignals::ECHO);
+            THEN("The ones that fit are dispatched in order and the rest are reported dropped") {
+               std::string expected;
+               for (size_t i=0; i<1 + DEFAULT_QUEUE_CAPACITY; i++) expected += "!echo";
+               CHECK(expected == uut.trail);
+               CHECK(10 - int(DEFAULT_QUEUE_CAPACITY) == uut.dropped);
+               CHECK(0 == uut.Hsm().Queued());
+            }
+         }
+      }
+   }
+   GIVEN("Signals queued from outside") {
+      REQUIRE(uut.Hsm().Enqueue(RelaySignals::ARM));
+      REQUIRE(uut.Hsm().Enqueue(RelaySignals::RESET));
+      REQUIRE(uut.Hsm().Enqueue(RelaySignals::ARM));
+      REQUIRE(RelayStates::IDLE == uut.state);
+      WHEN("A batch is dispatched") {
+         const auto dispatched = uut.Hsm().DispatchQueued(2);
+         THEN("Only that many are; signals raised along the way queue up behind the rest") {
+            CHECK(2 == dispatched);
+            CHECK(RelayStates::ARMED == uut.state); // RESET is not handled while armed
+            CHECK(2 == uut.Hsm().Queued());
+         }
+         AND_WHEN("The rest are dispatched") {
+            CHECK(2 == uut.Hsm().DispatchQueued());
+            THEN("The queue is empty and they ran in order") {
+               CHECK(0 == uut.Hsm().Queued());
+               CHECK(RelayStates::FIRED == uut.state);
+            }
+         }
+      }
+   }
+}
+
+// The relay again, on a shared machine without a queue.
+class QueuelessRelay {
+public:
+   using Definition = Blueprint<QueuelessRelay, RelayStates, RelayStates::IDLE, RelayStates::FIRED, RelaySignals>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(RelayStates::IDLE)
+            .SetNoParent()
+            .ForSignal(RelaySignals::ARM).GoTo(RelayStates::ARMED);
+         b.DefineState(RelayStates::ARMED)
+            .SetNoParent()
+            .SetOnEnter(&QueuelessRelay::EnterArmed)
+            .ForSignal(RelaySignals::FIRE).GoTo(RelayStates::FIRED);
+         b.DefineState(RelayStates::FIRED)
+            .SetNoParent();
+         b.ConcludeSetupAndSetInitialState(RelayStates::IDLE);
+      });
+      return blueprint;
+   }
+
+   QueuelessRelay() : m_hsm(*this, Shared()) {
+      m_hsm.Start();
+   }
+   void EnterArmed() { m_hsm.Signal(RelaySignals::FIRE); }
+
+   using Machine = SharedStateMachine<Definition>;
+   Machine m_hsm;
+};
+
+SCENARIO("A machine without a queue refuses signals from its own handlers", "[fhsm]") {
+   QueuelessRelay uut;
+   WHEN("An enter handler signals the machine") {
+      THEN("Signal throws rather than dispatch half way through the transition") {
+         CHECK_THROWS_AS(uut.m_hsm.Signal(RelaySignals::ARM), QueuelessRelay::Machine::ReentrantSignalException);
+         AND_THEN("The machine takes signals again afterwards") {
+            CHECK(uut.m_hsm.Signal(RelaySignals::FIRE));
+            CHECK(RelayStates::IDLE == uut.m_hsm.CurrentState());
+         }
+      }
+   }
+}
+
+class SharedForest {
+public:
+   using Definition = Blueprint<SharedForest, ForestStates, ForestStates::BIRCH_TRUNK, ForestStates::PINE_RIGHT, ForestSignals>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(ForestStates::BIRCH_TRUNK)
+            .SetNoParent()
+            .SetOnTick(&SharedForest::DoIt)
+            .ForSignal(ForestSignals::GO_DOWN_LEFT).GoTo(ForestStates::BIRCH_LEFT);
+         b.DefineState(ForestStates::BIRCH_LEFT)
+            .SetParent(ForestStates::BIRCH_TRUNK)
+            .SetOnEnter(&SharedForest::CountEnter)
+            .ForSignal(ForestSignals::GO_UP).GoTo(ForestStates::BIRCH_TRUNK)
+            .ForSignal(ForestSignals::DO_SING).Do(&SharedForest::Sing);
+         b.ConcludeSetupAndSetInitialState(ForestStates::BIRCH_TRUNK, &SharedForest::NewState);
+      });
+      return blueprint;
+   }
+
+   SharedForest() : m_hsm(*this, Shared()) {
+      m_hsm.Start();
+   }
+   void NewState(const ForestStates s) { m_state = s; }
+   void Signal(const ForestSignals s) { m_hsm.Signal(s); }
+   void Tick() { m_hsm.Tick(); }
+   void DoIt() { ++tickCount; }
+   void CountEnter() { ++enterCount; }
+   void Sing() { sung = true; }
+
+   ForestStates m_state = ForestStates::PINE_TRUNK;
+   SharedStateMachine<Definition> m_hsm;
+   int tickCount{0};
+   int enterCount{0};
+   bool sung{false};
+};
+
+SCENARIO("Actors sharing one blueprint", "[fhsm]") {
+   GIVEN("Two actors of the same type") {
+      SharedForest one;
+      SharedForest two;
+      REQUIRE(ForestStates::BIRCH_TRUNK == one.m_state);
+      REQUIRE(ForestStates::BIRCH_TRUNK == two.m_state);
+      WHEN("Only one of them is signaled") {
+         one.Signal(ForestSignals::GO_DOWN_LEFT);
+         one.Signal(ForestSignals::DO_SING);
+         one.Tick();
+         THEN("Only that one changes") {
+            CHECK(ForestStates::BIRCH_LEFT == one.m_state);
+            CHECK(ForestStates::BIRCH_LEFT == one.m_hsm.CurrentState());
+            CHECK(1 == one.enterCount);
+            CHECK(1 == one.tickCount);
+            CHECK(one.sung);
+            CHECK(ForestStates::BIRCH_TRUNK == two.m_state);
+            CHECK(0 == two.enterCount);
+            CHECK_FALSE(two.sung);
+         }
+      }
+   }
+   GIVEN("The machine of an actor") {
+      THEN("It is a few words, not a copy of the definition") {
+         CHECK(sizeof(SharedStateMachine<SharedForest::Definition>) <= 3 * sizeof(void*));
+      }
+   }
+}
+
+class RelocatableForest {
+public:
+   using Definition = Blueprint<RelocatableForest, ForestStates, ForestStates::BIRCH_TRUNK, ForestStates::PINE_RIGHT, ForestSignals>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(ForestStates::PINE_TRUNK)
+            .SetNoParent()
+            .SetOnTick(&RelocatableForest::DoIt)
+            .ForSignal(ForestSignals::GO_DOWN_RIGHT).GoTo(ForestStates::PINE_RIGHT);
+         b.DefineState(ForestStates::PINE_RIGHT)
+            .SetParent(ForestStates::PINE_TRUNK)
+            .SetOnEnter(&RelocatableForest::CountEnter)
+            .ForSignal(ForestSignals::GO_UP).GoTo(ForestStates::PINE_TRUNK);
+         b.ConcludeSetupAndSetInitialState(ForestStates::PINE_TRUNK);
+      });
+      return blueprint;
+   }
+
+   explicit RelocatableForest(int id) : m_id(id), m_hsm(Shared()) {
+      m_hsm.Start(*this);
+   }
+   void Signal(const ForestSignals s) { m_hsm.Signal(*this, s); }
+   void Tick() { m_hsm.Tick(*this); }
+   ForestStates CurrentState() const { return m_hsm.CurrentState(); }
+   void DoIt() { tickCount += m_id; }
+   void CountEnter() { ++enterCount; }
+
+   int m_id;
+   RelocatableStateMachine<Definition> m_hsm;
+   int tickCount{0};
+   int enterCount{0};
+};
+
+SCENARIO("Relocatable state machines", "[fhsm]") {
+   static_assert(std::is_copy_constructible<RelocatableForest>::value, "actors can be copied");
+   static_assert(std::is_move_assignable<RelocatableForest>::value, "actors can be moved");
+   GIVEN("Actors kept by value in a vector that reallocates") {
+      std::vector<RelocatableForest> fleet;
+      for (int i=0; i<100; i++) {
+         fleet.emplace_back(i);
+         fleet.back().Signal(ForestSignals::GO_DOWN_RIGHT);
+      }
+      WHEN("Every actor is ticked and signaled after the moves") {
+         for (auto& actor : fleet) {
+            actor.Tick();
+            actor.Signal(ForestSignals::GO_UP);
+         }
+         THEN("Each actor's own handlers ran on its own data") {
+            for (int i=0; i<100; i++) {
+               CHECK(i == fleet[i].tickCount);
+               CHECK(1 == fleet[i].enterCount);
+               CHECK(ForestStates::PINE_TRUNK == fleet[i].CurrentState());
+            }
+         }
+      }
+      WHEN("An actor is copied") {
+         auto copy = fleet[7];
+         copy.Signal(ForestSignals::GO_UP);
+         THEN("The copy moves on independently") {
+            CHECK(ForestStates::PINE_TRUNK == copy.CurrentState());
+            CHECK(ForestStates::PINE_RIGHT == fleet[7].CurrentState());
+         }
+      }
+   }
+}
+
+// The DenseController's machine with its handlers bound the other ways:
+// as template arguments, as captureless lambdas and as a stateless functor.
+class BoundController {
+   StateMachine<BoundController, MyStates, WHOLE, NNW, MySignals, GO_NORTH, DO_ACTION> m_hsm;
+
+   struct CountExit {
+      void operator()(BoundController& c) const { ++c.exit_count; }
+   };
+public:
+   BoundController() : m_hsm(*this) {
+      m_hsm.DefineState(WHOLE)
+         .SetNoParent()
+         .SetOnTick<&BoundController::CountTick>()
+         .ForSignal(GO_HOME).GoTo(SOUTH);
+
+      m_hsm.DefineState(NORTH)
+         .SetParent(WHOLE)
+         .SetOnEnter([](BoundController& c) { ++c.enter_count; })
+         .SetOnExit(CountExit())
+         .ForSignal(DO_ACTION).Do<&BoundController::CountAction>();
+
+      m_hsm.DefineState(SOUTH)
+         .SetParent(WHOLE)
+         .ForSignal(GO_NORTH).GoToIf<&BoundController::IsNorthOpen>(NORTH)
+         .ForSignal(GO_EAST).GoToIf(EAST, [](const BoundController& c) { return c.m_eastIsOpen; })
+         .ForSignal(GO_EAST).Do([](BoundController& c) { ++c.action_count; });
+
+      m_hsm.DefineState(EAST)
+         .SetParent(WHOLE);
+      m_hsm.DefineState(NORTH_WEST)
+         .SetParent(NORTH);
+      m_hsm.DefineState(NNW)
+         .SetParent(NORTH_WEST);
+
+      m_hsm.ConcludeSetupAndSetInitialState(SOUTH);
+   }
+   void Tick() { m_hsm.Tick(); }
+   void Signal(const MySignals s) { m_hsm.Signal(s); }
+   void CountTick() { ++tick_count; }
+   void CountAction() { ++action_count; }
+   bool IsNorthOpen() const { return m_northIsOpen; }
+
+   bool m_northIsOpen = false;
+   bool m_eastIsOpen = false;
+   int tick_count = 0;
+   int action_count = 0;
+   int enter_count = 0;
+   int exit_count = 0;
+};
+
+SCENARIO("Handlers bound as template arguments, lambdas and functors", "[fhsm]") {
+   BoundController uut;
+   WHEN("The guards say no") {
+      uut.Signal(GO_NORTH);
+      uut.Signal(GO_EAST);
+      THEN("Only the action ran") {
+         CHECK(1 == uut.action_count);
+         CHECK(0 == uut.enter_count);
+      }
+   }
+   WHEN("The guard bound as a template argument allows the transition") {
+      uut.m_northIsOpen = true;
+      uut.Signal(GO_NORTH);
+      uut.Tick();
+      uut.Signal(DO_ACTION);
+      uut.Signal(GO_HOME);
+      THEN("The lambda, the functor and the bound member functions ran") {
+         CHECK(1 == uut.enter_count);
+         CHECK(1 == uut.exit_count);
+         CHECK(1 == uut.tick_count);
+         CHECK(1 == uut.action_count);
+      }
+   }
+   WHEN("The lambda guard allows the transition") {
+      uut.m_eastIsOpen = true;
+      uut.Signal(GO_EAST);
+      uut.Signal(GO_EAST);
+      THEN("The lambda action ran on the way") {
+         CHECK(1 == uut.action_count);
+      }
+   }
+}
+
+enum class PrinterStates  { IDLE, BUSY, WARMING, PAUSED };
+enum class PrinterSignals { JOB, READY, DONE, CANCEL, PAUSE, RESUME };
+class Printer {
+public:
+   using Definition = Blueprint<Printer, PrinterStates, PrinterStates::IDLE, PrinterStates::PAUSED,
+                                PrinterSignals, PrinterSignals::JOB, PrinterSignals::RESUME>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(PrinterStates::IDLE)
+            .SetNoParent()
+            .ForSignal(PrinterSignals::JOB).GoTo(PrinterStates::WARMING);
+         b.DefineState(PrinterStates::BUSY)
+            .SetNoParent()
+            .SetOnEnter(&Printer::CountJob)
+            .ForSignal(PrinterSignals::JOB).Defer()
+            .ForSignal(PrinterSignals::DONE).GoTo(PrinterStates::IDLE)
+            .ForSignal(PrinterSignals::CANCEL).GoTo(PrinterStates::IDLE)
+            .ForSignal(PrinterSignals::PAUSE).GoTo(PrinterStates::PAUSED);
+         // Inherits the deferral of JOB, and defers DONE its parent handles.
+         b.DefineState(PrinterStates::WARMING)
+            .SetParent(PrinterStates::BUSY)
+            .ForSignal(PrinterSignals::DONE).Defer()
+            .ForSignal(PrinterSignals::READY).GoTo(PrinterStates::BUSY);
+         b.DefineState(PrinterStates::PAUSED)
+            .SetNoParent()
+            .ForSignal(PrinterSignals::JOB).Defer()
+            .ForSignal(PrinterSignals::CANCEL).Defer()
+            .ForSignal(PrinterSignals::RESUME).GoTo(PrinterStates::BUSY);
+         b.ConcludeSetupAndSetInitialState(PrinterStates::IDLE, &Printer::NoteState);
+      });
+      return blueprint;
+   }
+
+   Printer() : m_hsm(*this, Shared()) { m_hsm.Start(); }
+   void CountJob() { ++jobs; }
+   void NoteState(const PrinterStates s) { states.push_back(s); }
+
+   SharedStateMachine<Definition, 0, NoInstrumentation, 4> m_hsm;
+   int jobs = 0;
+   std::vector<PrinterStates> states;
+};
+
+SCENARIO("Deferred signals are dispatched once a state that does not defer them is entered", "[fhsm]") {
+   Printer uut;
+   GIVEN("A printer warming up for a job") {
+      uut.m_hsm.Signal(PrinterSignals::JOB);
+      uut.m_hsm.Signal(PrinterSignals::JOB);
+      uut.m_hsm.Signal(PrinterSignals::DONE);
+      THEN("The signals it defers are kept") {
+         CHECK(PrinterStates::WARMING == uut.m_hsm.CurrentState());
+         CHECK(2 == uut.m_hsm.Deferred());
+      }
+      WHEN("It is ready") {
+         uut.m_hsm.Signal(PrinterSignals::READY);
+         THEN("DONE, which BUSY handles, finishes the job and the kept JOB starts the next one") {
+            CHECK(PrinterStates::WARMING == uut.m_hsm.CurrentState());
+            CHECK(0 == uut.m_hsm.Deferred());
+            const std::vector<PrinterStates> expected{ PrinterStates::IDLE, PrinterStates::WARMING, PrinterStates::BUSY,
+                                                      PrinterStates::IDLE, PrinterStates::WARMING };
+            CHECK(expected == uut.states);
+         }
+      }
+   }
+   GIVEN("A paused printer") {
+      uut.m_hsm.Signal(PrinterSignals::JOB);
+      uut.m_hsm.Signal(PrinterSignals::READY);
+      uut.m_hsm.Signal(PrinterSignals::PAUSE);
+      uut.m_hsm.Signal(PrinterSignals::JOB);
+      uut.m_hsm.Signal(PrinterSignals::CANCEL);
+      CHECK(2 == uut.m_hsm.Deferred());
+      WHEN("It resumes") {
+         uut.m_hsm.Signal(PrinterSignals::RESUME);
+         THEN("CANCEL goes ahead of the JOB that BUSY still defers, and then the JOB goes") {
+            CHECK(PrinterStates::WARMING == uut.m_hsm.CurrentState());
+            CHECK(0 == uut.m_hsm.Deferred());
+            const std::vector<PrinterStates> expected{ PrinterStates::IDLE, PrinterStates::WARMING, PrinterStates::BUSY, PrinterStates::PAUSED,
+                                                      PrinterStates::BUSY, PrinterStates::IDLE, PrinterStates::WARMING };
+            CHECK(expected == uut.states);
+            CHECK(3 == uut.jobs);
+         }
+      }
+   }
+   GIVEN("Machines of the same blueprint that keep fewer deferred signals") {
+      RelocatableStateMachine<Printer::Definition, 0, 1> small(Printer::Shared());
+      RelocatableStateMachine<Printer::Definition> none(Printer::Shared());
+      small.Start(uut);
+      none.Start(uut);
+      for (auto s : { PrinterSignals::JOB, PrinterSignals::JOB, PrinterSignals::DONE, PrinterSignals::READY }) {
+         small.Signal(uut, s);
+         none.Signal(uut, s);
+      }
+      THEN("What does not fit is dropped") {
+         CHECK(1 == small.Deferred());
+         CHECK(PrinterStates::BUSY == small.CurrentState());
+         CHECK(0 == none.Deferred());
+         CHECK(PrinterStates::BUSY == none.CurrentState());
+      }
+   }
+   GIVEN("The blueprint") {
+      const auto& b = Printer::Shared();
+      THEN("A state defers what it, or the closest ancestor reacting to the signal, defers") {
+         CHECK(b.Defers(b.StateToIndex(PrinterStates::WARMING), PrinterSignals::JOB));
+         CHECK(b.Defers(b.StateToIndex(PrinterStates::WARMING), PrinterSignals::DONE));
+         CHECK( ! b.Defers(b.StateToIndex(PrinterStates::BUSY), PrinterSignals::DONE));
+         CHECK( ! b.Defers(b.StateToIndex(PrinterStates::IDLE), PrinterSignals::JOB));
+      }
+   }
+}
+
+// The keyboard of the UML books: caps lock and num lock are independent.
+enum class KeyboardStates  { CAPS, CAPS_OFF, CAPS_ON, NUM, NUM_OFF, NUM_ON, NUM_ON_BLINKING };
+enum class KeyboardSignals { CAPS_LOCK, NUM_LOCK, ANY_KEY, BLINK };
+class Keyboard {
+public:
+   using Definition = Blueprint<Keyboard, KeyboardStates, KeyboardStates::CAPS, KeyboardStates::NUM_ON_BLINKING,
+                                KeyboardSignals, KeyboardSignals::CAPS_LOCK, KeyboardSignals::BLINK>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(KeyboardStates::CAPS)
+            .SetNoParent();
+         b.DefineState(KeyboardStates::CAPS_OFF)
+            .SetParent(KeyboardStates::CAPS)
+            .ForSignal(KeyboardSignals::CAPS_LOCK).GoTo(KeyboardStates::CAPS_ON)
+            .ForSignal(KeyboardSignals::ANY_KEY).Do(&Keyboard::TypeLower);
+         b.DefineState(KeyboardStates::CAPS_ON)
+            .SetParent(KeyboardStates::CAPS)
+            .ForSignal(KeyboardSignals::CAPS_LOCK).GoTo(KeyboardStates::CAPS_OFF)
+            .ForSignal(KeyboardSignals::ANY_KEY).Do(&Keyboard::TypeUpper);
+         b.DefineState(KeyboardStates::NUM)
+            .SetNoParent();
+         b.DefineState(KeyboardStates::NUM_OFF)
+            .SetParent(KeyboardStates::NUM)
+            .ForSignal(KeyboardSignals::NUM_LOCK).GoTo(KeyboardStates::NUM_ON);
+         b.DefineState(KeyboardStates::NUM_ON)
+            .SetParent(KeyboardStates::NUM)
+            .SetOnEnter(&Keyboard::RaiseBlink)
+            .SetOnTick(&Keyboard::CountTick)
+            .ForSignal(KeyboardSignals::NUM_LOCK).GoTo(KeyboardStates::NUM_OFF)
+            .ForSignal(KeyboardSignals::ANY_KEY).Do(&Keyboard::CountDigit)
+            .ForSignal(KeyboardSignals::BLINK).GoTo(KeyboardStates::NUM_ON_BLINKING);
+         b.DefineState(KeyboardStates::NUM_ON_BLINKING)
+            .SetParent(KeyboardStates::NUM_ON);
+         b.ConcludeSetupAndSetInitialState(KeyboardStates::CAPS_OFF); // each region starts in its own
+      });
+      return blueprint;
+   }
+
+   Keyboard() : m_hsm(*this, Shared(), {{ KeyboardStates::NUM_OFF, KeyboardStates::CAPS_OFF }}) { m_hsm.Start(); }
+   void TypeLower() { typed += 'a'; }
+   void TypeUpper() { typed += 'A'; }
+   void CountDigit() { ++digits; }
+   void CountTick() { ++ticks; }
+   void RaiseBlink() {
+      // Queued: the caps region (1) has not had the signal that got this one here yet.
+      blinkQueued = m_hsm.Signal(KeyboardSignals::BLINK) && m_hsm.Queued() == 1;
+   }
+
+   OrthogonalStateMachine<Definition, 2, 4> m_hsm;
+   std::string typed;
+   int digits = 0;
+   int ticks = 0;
+   bool blinkQueued = false;
+};
+
+SCENARIO("Orthogonal regions each take every signal", "[fhsm]") {
+   Keyboard uut;
+   WHEN("Keys are pressed with and without caps lock") {
+      uut.m_hsm.Signal(KeyboardSignals::ANY_KEY);
+      uut.m_hsm.Signal(KeyboardSignals::CAPS_LOCK);
+      uut.m_hsm.Signal(KeyboardSignals::ANY_KEY);
+      THEN("Only the caps region changed") {
+         CHECK("aA" == uut.typed);
+         CHECK(0 == uut.digits);
+         CHECK(KeyboardStates::NUM_OFF == uut.m_hsm.CurrentState(0));
+         CHECK(KeyboardStates::CAPS_ON == uut.m_hsm.CurrentState(1));
+      }
+   }
+   WHEN("Num lock is pressed") {
+      uut.m_hsm.Signal(KeyboardSignals::NUM_LOCK);
+      uut.m_hsm.Signal(KeyboardSignals::ANY_KEY);
+      uut.m_hsm.Tick();
+      THEN("The signal its enter handler raised ran after both regions had NUM_LOCK") {
+         CHECK(uut.blinkQueued);
+         CHECK(KeyboardStates::NUM_ON_BLINKING == uut.m_hsm.CurrentState(0));
+         CHECK(uut.m_hsm.IsIn(KeyboardStates::NUM_ON));
+         CHECK(uut.m_hsm.IsIn(KeyboardStates::CAPS));
+         CHECK(uut.m_hsm.IsIn(KeyboardStates::CAPS_OFF));
+         CHECK( ! uut.m_hsm.IsIn(KeyboardStates::CAPS_ON));
+      }
+      THEN("Both regions handled the key, and the ticking one ticked") {
+         CHECK("a" == uut.typed);
+         CHECK(1 == uut.digits);
+         CHECK(1 == uut.ticks);
+      }
+   }
+   WHEN("Two regions start in one tree") {
+      using Machine = OrthogonalStateMachine<Keyboard::Definition, 2>;
+      THEN("The machine is rejected") {
+         CHECK_THROWS_AS(Machine(uut, Keyboard::Shared(), {{ KeyboardStates::NUM_OFF, KeyboardStates::NUM_ON }}),
+                         Machine::InvalidRegionsException);
+      }
+   }
+   WHEN("A region defers a signal") {
+      using Machine = OrthogonalStateMachine<Keyboard::Definition, 2>;
+      const Keyboard::Definition deferring([](Keyboard::Definition& b) {
+         b.DefineState(KeyboardStates::CAPS)
+            .SetNoParent();
+         b.DefineState(KeyboardStates::CAPS_OFF)
+            .SetParent(KeyboardStates::CAPS)
+            .ForSignal(KeyboardSignals::ANY_KEY).Defer();
+         b.DefineState(KeyboardStates::NUM)
+            .SetNoParent();
+         b.DefineState(KeyboardStates::NUM_OFF)
+            .SetParent(KeyboardStates::NUM);
+         b.ConcludeSetupAndSetInitialState(KeyboardStates::CAPS_OFF);
+      });
+      THEN("The machine is rejected rather than losing the deferred signals") {
+         CHECK_THROWS_AS(Machine(uut, deferring, {{ KeyboardStates::NUM_OFF, KeyboardStates::CAPS_OFF }}),
+                         Machine::InvalidRegionsException);
+      }
+   }
+   WHEN("The machine is instrumented") {
+      OrthogonalStateMachine<Keyboard::Definition, 2, 4, CountingInstrumentation> counted(
+         uut, Keyboard::Shared(), {{ KeyboardStates::NUM_OFF, KeyboardStates::CAPS_OFF }});
+      counted.Start();
+      counted.Signal(KeyboardSignals::CAPS_LOCK);
+      counted.Signal(KeyboardSignals::CAPS_LOCK);
+      counted.Signal(KeyboardSignals::NUM_LOCK);
+      THEN("Each region is counted on its own") {
+         const auto& b = Keyboard::Shared();
+         const auto num = counted.GetInstrumentation(0).Snapshot();
+         const auto caps = counted.GetInstrumentation(1).Snapshot();
+         CHECK(1 == num.Transitions(b.StateToIndex(KeyboardStates::NUM_OFF), b.StateToIndex(KeyboardStates::NUM_ON)));
+         CHECK(2 == num.unhandled);
+         CHECK(0 == num.entries[b.StateToIndex(KeyboardStates::CAPS_ON)]);
+         CHECK(1 == caps.Transitions(b.StateToIndex(KeyboardStates::CAPS_OFF), b.StateToIndex(KeyboardStates::CAPS_ON)));
+         CHECK(1 == caps.Transitions(b.StateToIndex(KeyboardStates::CAPS_ON), b.StateToIndex(KeyboardStates::CAPS_OFF)));
+         CHECK(1 == caps.unhandled);
+      }
+   }
+}
+
+enum class WasherStates  { RUNNING, WASHING, RINSING, RINSING_COLD, SPINNING, DOOR_OPEN };
+enum class WasherSignals { NEXT, COLD, OPEN_DOOR, CLOSE_DOOR, RESTART_STEP };
+class Washer {
+public:
+   using Definition = Blueprint<Washer, WasherStates, WasherStates::RUNNING, WasherStates::DOOR_OPEN,
+                                WasherSignals, WasherSignals::NEXT, WasherSignals::RESTART_STEP>;
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(WasherStates::RUNNING)
+            .SetNoParent()
+            .SetOnEnter(&Washer::CountRun)
+            .ForSignal(WasherSignals::OPEN_DOOR).GoTo(WasherStates::DOOR_OPEN);
+         b.DefineState(WasherStates::WASHING)
+            .SetParent(WasherStates::RUNNING)
+            .ForSignal(WasherSignals::NEXT).GoTo(WasherStates::RINSING);
+         b.DefineState(WasherStates::RINSING)
+            .SetParent(WasherStates::RUNNING)
+            .SetOnEnter(&Washer::CountRinse)
+            .ForSignal(WasherSignals::COLD).GoTo(WasherStates::RINSING_COLD)
+            .ForSignal(WasherSignals::NEXT).GoTo(WasherStates::SPINNING);
+         b.DefineState(WasherStates::RINSING_COLD)
+            .SetParent(WasherStates::RINSING)
+            .SetOnEnter(&Washer::CountCold);
+         b.DefineState(WasherStates::SPINNING)
+            .SetParent(WasherStates::RUNNING);
+         b.DefineState(WasherStates::DOOR_OPEN)
+            .SetNoParent()
+            .ForSignal(WasherSignals::CLOSE_DOOR).GoToDeepHistory(WasherStates::RUNNING)
+            .ForSignal(WasherSignals::RESTART_STEP).GoToShallowHistory(WasherStates::RUNNING);
+         b.ConcludeSetupAndSetInitialState(WasherStates::WASHING, &Washer::NoteState);
+      });
+      return blueprint;
+   }
+
+   void CountRun() { ++runs; }
+   void CountRinse() { ++rinses; }
+   void CountCold() { ++colds; }
+   void NoteState(const WasherStates s) { states.push_back(s); }
+
+   int runs = 0;
+   int rinses = 0;
+   int colds = 0;
+   std::vector<WasherStates> states;
+};
+
+SCENARIO("History transitions resume where a composite state was left", "[fhsm]") {
+   using Counting = SharedStateMachine<Washer::Definition, 0, CountingInstrumentation, 0, Washer::Definition::COUNT>;
+   const auto& b = Washer::Shared();
+   Washer uut;
+   Counting hsm(uut, b);
+   hsm.Start();
+   GIVEN("A washer opened while rinsing cold") {
+      hsm.Signal(WasherSignals::NEXT);
+      hsm.Signal(WasherSignals::COLD);
+      hsm.Signal(WasherSignals::OPEN_DOOR);
+      hsm.GetInstrumentation().Reset();
+      uut.states.clear();
+      WHEN("The door closes") {
+         hsm.Signal(WasherSignals::CLOSE_DOOR);
+         THEN("One transition enters every state down to the one it was in") {
+            CHECK(WasherStates::RINSING_COLD == hsm.CurrentState());
+            CHECK(std::vector<WasherStates>{ WasherStates::RINSING_COLD } == uut.states);
+            CHECK(2 == uut.runs);
+            CHECK(2 == uut.rinses);
+            CHECK(2 == uut.colds);
+            const auto counts = hsm.GetInstrumentation().Snapshot();
+            CHECK(1 == counts.Transitions(b.StateToIndex(WasherStates::DOOR_OPEN), b.StateToIndex(WasherStates::RINSING_COLD)));
+            CHECK(1 == counts.Dispatched(b.StateToIndex(WasherStates::DOOR_OPEN), WasherSignals::CLOSE_DOOR));
+            CHECK(0 == counts.Dispatched(b.StateToIndex(WasherStates::DOOR_OPEN), WasherSignals::OPEN_DOOR));
+            CHECK(1 == counts.entries[b.StateToIndex(WasherStates::RUNNING)]);
+            CHECK(1 == counts.entries[b.StateToIndex(WasherStates::RINSING)]);
+            CHECK(1 == counts.entries[b.StateToIndex(WasherStates::RINSING_COLD)]);
+            CHECK(1 == counts.exits[b.StateToIndex(WasherStates::DOOR_OPEN)]);
+         }
+      }
+      WHEN("The step restarts") {
+         hsm.Signal(WasherSignals::RESTART_STEP);
+         THEN("Only the child of the composite is restored") {
+            CHECK(WasherStates::RINSING == hsm.CurrentState());
+            CHECK(2 == uut.rinses);
+            CHECK(1 == uut.colds);
+         }
+      }
+      WHEN("It is opened again from another step") {
+         hsm.Signal(WasherSignals::CLOSE_DOOR);
+         hsm.Signal(WasherSignals::NEXT);
+         hsm.Signal(WasherSignals::OPEN_DOOR);
+         hsm.Signal(WasherSignals::CLOSE_DOOR);
+         THEN("The last step is restored") {
+            CHECK(WasherStates::SPINNING == hsm.CurrentState());
+         }
+      }
+   }
+   GIVEN("A machine that keeps no history") {
+      RelocatableStateMachine<Washer::Definition> forgetful(b);
+      forgetful.Start(uut);
+      forgetful.Signal(uut, WasherSignals::NEXT);
+      forgetful.Signal(uut, WasherSignals::OPEN_DOOR);
+      forgetful.Signal(uut, WasherSignals::CLOSE_DOOR);
+      THEN("A history transition enters the composite state itself") {
+         CHECK(WasherStates::RUNNING == forgetful.CurrentState());
+      }
+   }
+}
@@ -0,0 +1,205 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/MachineFleet.h"
+#include "kv/fhsm/RelocatableStateMachine.h"
+
+#include <vector>
+
+using namespace kv::fhsm;
+
+enum class LampStates  { OFF, ON, DIMMED, BROKEN };
+enum class LampSignals { TOGGLE, DIM, SURGE };
+
+// TOGGLE and DIM are mostly plain transitions; DIMMED counts DIM and
+// leaving BROKEN runs an exit handler. SURGE breaks a lamp if it is weak.
+class Lamp {
+public:
+   using Definition = Blueprint<Lamp, LampStates, LampStates::OFF, LampStates::BROKEN,
+                                LampSignals, LampSignals::TOGGLE, LampSignals::SURGE>;
+
+   static void Define(Definition& b) {
+      b.DefineState(LampStates::OFF)
+         .SetNoParent()
+         .ForSignal(LampSignals::TOGGLE).GoTo(LampStates::ON);
+      b.DefineState(LampStates::ON)
+         .SetNoParent()
+         .ForSignal(LampSignals::TOGGLE).GoTo(LampStates::OFF)
+         .ForSignal(LampSignals::DIM).GoTo(LampStates::DIMMED)
+         .ForSignal(LampSignals::SURGE).GoToIf(LampStates::BROKEN, &Lamp::IsWeak);
+      b.DefineState(LampStates::DIMMED)
+         .SetParent(LampStates::ON)
+         .ForSignal(LampSignals::DIM).Do(&Lamp::CountDim);
+      b.DefineState(LampStates::BROKEN)
+         .SetNoParent()
+         .SetOnExit(&Lamp::CountRepair)
+         .ForSignal(LampSignals::TOGGLE).GoTo(LampStates::OFF);
+   }
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         Define(b);
+         b.ConcludeSetupAndSetInitialState(LampStates::OFF);
+      });
+      return blueprint;
+   }
+
+   explicit Lamp(int id) : m_hsm(Shared()), weak(id % 7 == 0) {
+      m_hsm.Start(*this);
+   }
+   bool IsWeak() const { return weak; }
+   void CountDim() { ++dims; }
+   void CountRepair() { ++repairs; }
+
+   RelocatableStateMachine<Lamp::Definition> m_hsm; // the reference: one machine per lamp
+   bool weak;
+   int dims = 0;
+   int repairs = 0;
+};
+
+namespace {
+
+// Every lamp in the fleet and its own machine get the same signals.
+void Both(MachineFleet<Lamp::Definition>& fleet, std::vector<Lamp>& reference, LampSignals s) {
+   fleet.Broadcast(s);
+   for (auto& lamp : reference) {
+      lamp.m_hsm.Signal(lamp, s);
+   }
+}
+
+} // namespace
+
+TEST_CASE( "A broadcast does what signaling every machine does", "[fhsm][broadcast]" ) {
+   // 1000 is not a multiple of sixteen, so the tail of the fleet is covered too.
+   std::vector<Lamp> lamps;
+   std::vector<Lamp> reference;
+   for (int i=0; i<1000; i++) {
+      lamps.emplace_back(i);
+      reference.emplace_back(i);
+   }
+   MachineFleet<Lamp::Definition> fleet(Lamp::Shared());
+   for (auto& lamp : lamps) {
+      fleet.Add(lamp);
+   }
+   // Spread the lamps over the states before broadcasting.
+   for (size_t i=0; i<lamps.size(); i++) {
+      for (size_t k=0; k<i % 3; k++) {
+         fleet.Signal(i, LampSignals::TOGGLE);
+         reference[i].m_hsm.Signal(reference[i], LampSignals::TOGGLE);
+      }
+   }
+
+   const LampSignals script[] = { LampSignals::DIM, LampSignals::DIM, LampSignals::SURGE, LampSignals::TOGGLE,
+                                  LampSignals::TOGGLE, LampSignals::SURGE, LampSignals::TOGGLE, LampSignals::DIM };
+   for (auto s : script) {
+      Both(fleet, reference, s);
+      for (size_t i=0; i<lamps.size(); i++) {
+         REQUIRE(reference[i].m_hsm.CurrentState() == fleet.CurrentState(i));
+         REQUIRE(reference[i].dims == lamps[i].dims);
+         REQUIRE(reference[i].repairs == lamps[i].repairs);
+      }
+   }
+}
+
+TEST_CASE( "Only machines whose state runs handlers for the signal are dispatched", "[fhsm][broadcast]" ) {
+   std::vector<Lamp> lamps;
+   for (int i=0; i<100; i++) {
+      lamps.emplace_back(i + 1);
+   }
+   MachineFleet<Lamp::Definition> fleet(Lamp::Shared());
+   for (auto& lamp : lamps) {
+      fleet.Add(lamp);
+   }
+   CHECK(0 == fleet.Broadcast(LampSignals::TOGGLE));  // OFF -> ON
+   CHECK(0 == fleet.Broadcast(LampSignals::DIM));     // ON -> DIMMED
+   CHECK(100 == fleet.Broadcast(LampSignals::DIM));   // DIMMED counts
+   CHECK(100 == fleet.Broadcast(LampSignals::SURGE)); // guarded
+   CHECK(14 == fleet.Broadcast(LampSignals::TOGGLE)); // the broken ones leave BROKEN through its exit handler
+   for (size_t i=0; i<lamps.size(); i++) {
+      CHECK(LampStates::OFF == fleet.CurrentState(i));
+      CHECK(1 == lamps[i].dims);
+   }
+}
+
+enum class WideStates  { S0, S1, S2, S3, S4, S5, S6, S7, S8, S9, S10, S11, S12, S13, S14, S15, S16, S17, S18, S19 };
+enum class WideSignals { NEXT };
+
+// More states than one shuffle can look up: each goes on to the next.
+class Wide {
+public:
+   using Definition = Blueprint<Wide, WideStates, WideStates::S0, WideStates::S19, WideSignals, WideSignals::NEXT, WideSignals::NEXT>;
+};
+
+TEST_CASE( "A fleet of more than sixteen states broadcasts too", "[fhsm][broadcast]" ) {
+   Wide::Definition blueprint;
+   for (int i=0; i<20; i++) {
+      blueprint.DefineState(static_cast<WideStates>(i))
+         .SetNoParent()
+         .ForSignal(WideSignals::NEXT).GoTo(static_cast<WideStates>((i + 1) % 20));
+   }
+   blueprint.ConcludeSetupAndSetInitialState(WideStates::S0);
+
+   std::vector<Wide> actors(50);
+   MachineFleet<Wide::Definition> fleet(blueprint);
+   for (auto& actor : actors) {
+      fleet.Add(actor);
+   }
+   for (size_t i=0; i<actors.size(); i++) {
+      for (size_t k=0; k<i; k++) {
+         fleet.Signal(i, WideSignals::NEXT);
+      }
+   }
+   for (int b=0; b<25; b++) {
+      CHECK(0 == fleet.Broadcast(WideSignals::NEXT));
+   }
+   for (size_t i=0; i<actors.size(); i++) {
+      CHECK(static_cast<WideStates>((i + 25) % 20) == fleet.CurrentState(i));
+   }
+}
+
+static_assert(sizeof(MachineFleet<Lamp::Definition>) < sizeof(MachineFleet<Lamp::Definition, true>), "an unindexed fleet keeps no index");
+
+TEST_CASE( "Publishing reaches only the machines whose state handles the signal", "[fhsm][broadcast]" ) {
+   std::vector<Lamp> lamps;
+   std::vector<Lamp> reference;
+   for (int i=0; i<300; i++) {
+      lamps.emplace_back(i);
+      reference.emplace_back(i);
+   }
+   MachineFleet<Lamp::Definition, true> fleet(Lamp::Shared());
+   for (auto& lamp : lamps) {
+      fleet.Add(lamp);
+   }
+   // A third of the lamps on, a tenth of those dimmed.
+   for (size_t i=0; i<lamps.size(); i+=3) {
+      fleet.Signal(i, LampSignals::TOGGLE);
+      reference[i].m_hsm.Signal(reference[i], LampSignals::TOGGLE);
+      if (i % 10 == 0) {
+         fleet.Signal(i, LampSignals::DIM);
+         reference[i].m_hsm.Signal(reference[i], LampSignals::DIM);
+      }
+   }
+
+   const LampSignals script[] = { LampSignals::DIM, LampSignals::SURGE, LampSignals::DIM, LampSignals::TOGGLE,
+                                  LampSignals::SURGE, LampSignals::TOGGLE, LampSignals::DIM, LampSignals::TOGGLE };
+   for (auto s : script) {
+      size_t interested = 0;
+      for (auto& lamp : reference) {
+         const auto state = lamp.m_hsm.CurrentState();
+         interested += (s == LampSignals::TOGGLE || state == LampStates::ON || state == LampStates::DIMMED);
+         lamp.m_hsm.Signal(lamp, s);
+      }
+      CHECK(interested == fleet.Publish(s));
+      for (size_t i=0; i<lamps.size(); i++) {
+         REQUIRE(reference[i].m_hsm.CurrentState() == fleet.CurrentState(i));
+         REQUIRE(reference[i].dims == lamps[i].dims);
+         REQUIRE(reference[i].repairs == lamps[i].repairs);
+      }
+   }
+
+   // Broadcasts keep the index too.
+   fleet.Broadcast(LampSignals::TOGGLE);
+   size_t on = 0;
+   for (size_t i=0; i<lamps.size(); i++) {
+      on += (fleet.CurrentState(i) == LampStates::ON);
+   }
+   CHECK(on == fleet.Publish(LampSignals::DIM));
+}
@@ -0,0 +1,188 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/CodeGenerator.h"
+#include "kv/fhsm/StateMachine.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using namespace kv::fhsm;
+
+enum class TurnstileStates  { POWERED, LOCKED, UNLOCKED, ALARM, OFF };
+enum class TurnstileSignals { COIN, PUSH, KICK, RESET, POWER };
+
+// Records every handler call so the generated and the interpreted machine can be compared.
+class TurnstileLog {
+public:
+   void EnterPowered() { trail += "+powered"; }
+   void ExitPowered() { trail += "-powered"; }
+   void TickPowered() { trail += "~powered"; }
+   void EnterLocked() { trail += "+locked"; }
+   void ExitLocked() { trail += "-locked"; }
+   void EnterUnlocked() { trail += "+unlocked"; }
+   void ExitUnlocked() { trail += "-unlocked"; --credit; }
+   void EnterAlarm() { trail += "+alarm"; }
+   void TickAlarm() { trail += "~alarm"; }
+   void EnterOff() { trail += "+off"; }
+   void AddCredit() { trail += "!coin"; ++credit; }
+   void Pass() { trail += "!pass"; ++passes; }
+   void Siren() { trail += "!siren"; }
+   void Complain() { trail += "!complain"; }
+   bool PassedTwice() const { return passes % 2 == 0; }
+   void NewState(const TurnstileStates s) { state = s; trail += "@" + std::to_string(int(s)); }
+
+   std::string trail;
+   int credit = 0;
+   int passes = 0;
+   TurnstileStates state = TurnstileStates::OFF;
+};
+
+using Turnstile = StateMachine<TurnstileLog, TurnstileStates, TurnstileStates::POWERED, TurnstileStates::OFF, TurnstileSignals>;
+
+// The source of truth for both machines (a few handlers are bound as template arguments).
+void DefineTurnstile(Turnstile& hsm) {
+   hsm.DefineState(TurnstileStates::POWERED)
+      .SetNoParent()
+      .SetOnEnter(&TurnstileLog::EnterPowered)
+      .SetOnExit(&TurnstileLog::ExitPowered)
+      .SetOnTick(&TurnstileLog::TickPowered)
+      .ForSignal(TurnstileSignals::POWER).GoTo(TurnstileStates::OFF)
+      .ForSignal(TurnstileSignals::RESET).GoTo(TurnstileStates::LOCKED)
+      .ForSignal(TurnstileSignals::KICK).Do(&TurnstileLog::Complain);
+   hsm.DefineState(TurnstileStates::LOCKED)
+      .SetParent(TurnstileStates::POWERED)
+      .SetOnEnter(&TurnstileLog::EnterLocked)
+      .SetOnExit(&TurnstileLog::ExitLocked)
+      .ForSignal(TurnstileSignals::COIN).Do(&TurnstileLog::AddCredit)
+      .ForSignal(TurnstileSignals::COIN).GoTo(TurnstileStates::UNLOCKED)
+      .ForSignal(TurnstileSignals::PUSH).GoTo(TurnstileStates::ALARM);
+   hsm.DefineState(TurnstileStates::UNLOCKED)
+      .SetParent(TurnstileStates::POWERED)
+      .SetOnEnter(&TurnstileLog::EnterUnlocked)
+      .SetOnExit(&TurnstileLog::ExitUnlocked)
+      .ForSignal(TurnstileSignals::COIN).Do(&TurnstileLog::AddCredit)
+      .ForSignal(TurnstileSignals::PUSH).Do(&TurnstileLog::Pass)
+      .ForSignal(TurnstileSignals::PUSH).GoToIf<&TurnstileLog::PassedTwice>(TurnstileStates::LOCKED);
+   hsm.DefineState(TurnstileStates::ALARM)
+      .SetParent(TurnstileStates::LOCKED)
+      .SetOnEnter(&TurnstileLog::EnterAlarm)
+      .SetOnTick<&TurnstileLog::TickAlarm>()
+      .ForSignal(TurnstileSignals::RESET).GoTo(TurnstileStates::UNLOCKED)
+      .ForSignal(TurnstileSignals::KICK).Do(&TurnstileLog::Siren);
+   hsm.DefineState(TurnstileStates::OFF)
+      .SetNoParent()
+      .SetOnEnter(&TurnstileLog::EnterOff)
+      .ForSignal(TurnstileSignals::POWER).GoTo(TurnstileStates::LOCKED);
+   hsm.ConcludeSetupAndSetInitialState(TurnstileStates::LOCKED, &TurnstileLog::NewState);
+}
+
+// How ut_fhsm_codegen_turnstile.h was made.
+std::string GenerateTurnstile(const Turnstile::Definition& definition) {
+   CodeGenerator<Turnstile::Definition> generator(definition);
+   generator
+      .NameTypes("TurnstileLog", "TurnstileStates", "TurnstileSignals")
+      .NameState(TurnstileStates::POWERED, "TurnstileStates::POWERED")
+      .NameState(TurnstileStates::LOCKED, "TurnstileStates::LOCKED")
+      .NameState(TurnstileStates::UNLOCKED, "TurnstileStates::UNLOCKED")
+      .NameState(TurnstileStates::ALARM, "TurnstileStates::ALARM")
+      .NameState(TurnstileStates::OFF, "TurnstileStates::OFF")
+      .NameSignal(TurnstileSignals::COIN, "TurnstileSignals::COIN")
+      .NameSignal(TurnstileSignals::PUSH, "TurnstileSignals::PUSH")
+      .NameSignal(TurnstileSignals::KICK, "TurnstileSignals::KICK")
+      .NameSignal(TurnstileSignals::RESET, "TurnstileSignals::RESET")
+      .NameSignal(TurnstileSignals::POWER, "TurnstileSignals::POWER")
+      .NameHandler(&TurnstileLog::EnterPowered, "EnterPowered")
+      .NameHandler(&TurnstileLog::ExitPowered, "ExitPowered")
+      .NameHandler(&TurnstileLog::TickPowered, "TickPowered")
+      .NameHandler(&TurnstileLog::EnterLocked, "EnterLocked")
+      .NameHandler(&TurnstileLog::ExitLocked, "ExitLocked")
+      .NameHandler(&TurnstileLog::EnterUnlocked, "EnterUnlocked")
+      .NameHandler(&TurnstileLog::ExitUnlocked, "ExitUnlocked")
+      .NameHandler(&TurnstileLog::EnterAlarm, "EnterAlarm")
+      .NameHandler<&TurnstileLog::TickAlarm>("TickAlarm")
+      .NameHandler(&TurnstileLog::EnterOff, "EnterOff")
+      .NameHandler(&TurnstileLog::AddCredit, "AddCredit")
+      .NameHandler(&TurnstileLog::Pass, "Pass")
+      .NameHandler(&TurnstileLog::Siren, "Siren")
+      .NameHandler(&TurnstileLog::Complain, "Complain")
+      .NameGuard<&TurnstileLog::PassedTwice>("PassedTwice")
+      .NameCallback(&TurnstileLog::NewState, "NewState");
+   return generator.Generate("TurnstileDispatcher");
+}
+
+#include "ut_fhsm_codegen_turnstile.h"
+
+TEST_CASE( "The checked in dispatcher is what the generator makes of the definition", "[fhsm][codegen]" ) {
+   TurnstileLog log;
+   Turnstile hsm(log);
+   DefineTurnstile(hsm);
+
+   // It is next to this file, wherever the tests run from.
+   const std::string self(__FILE__);
+   const auto slash = self.find_last_of("/\\");
+   const std::string path = ((slash == std::string::npos) ? std::string() : self.substr(0, slash + 1)) + "ut_fhsm_codegen_turnstile.h";
+   std::ifstream file(path);
+   INFO(path);
+   REQUIRE(file);
+   const std::string checkedIn((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+   CHECK(GenerateTurnstile(hsm.GetDefinition()) == checkedIn);
+}
+
+TEST_CASE( "A generated dispatcher behaves like the interpreted machine", "[fhsm][codegen]" ) {
+   TurnstileLog interpreted;
+   Turnstile hsm(interpreted);
+   DefineTurnstile(hsm);
+
+   TurnstileLog generated;
+   TurnstileDispatcher dispatcher;
+   dispatcher.Start(generated);
+   CHECK(interpreted.trail == generated.trail);
+
+   // A fixed pseudo random stream, with the odd signal nobody handles.
+   unsigned seed = 12345;
+   for (int i=0; i<1000; i++) {
+      seed = seed * 1103515245u + 12345u;
+      const auto s = static_cast<TurnstileSignals>((seed >> 16) % 6);
+      hsm.Signal(s);
+      dispatcher.Signal(generated, s);
+      if (i % 3 == 0) {
+         hsm.Tick();
+         dispatcher.Tick(generated);
+      }
+      REQUIRE(interpreted.trail == generated.trail);
+      CHECK(interpreted.state == dispatcher.CurrentState());
+   }
+   CHECK(interpreted.credit == generated.credit);
+   CHECK(interpreted.passes == generated.passes);
+}
+
+TEST_CASE( "The generator refuses to guess names", "[fhsm][codegen]" ) {
+   TurnstileLog log;
+   Turnstile hsm(log);
+   DefineTurnstile(hsm);
+
+   using Generator = CodeGenerator<Turnstile::Definition>;
+   Generator generator(hsm.GetDefinition());
+   CHECK_THROWS_AS(generator.Generate("Nameless"), Generator::GenerationException);
+}
+
+TEST_CASE( "The generator refuses definitions with deferred signals", "[fhsm][codegen]" ) {
+   TurnstileLog log;
+   Turnstile hsm(log);
+   DefineTurnstile(hsm);
+   hsm.DefineState(TurnstileStates::OFF)
+      .SetNoParent()
+      .ForSignal(TurnstileSignals::COIN).Defer();
+   CHECK_THROWS_AS(GenerateTurnstile(hsm.GetDefinition()), CodeGenerator<Turnstile::Definition>::GenerationException);
+}
+
+TEST_CASE( "The generator refuses definitions with history transitions", "[fhsm][codegen]" ) {
+   TurnstileLog log;
+   Turnstile hsm(log);
+   DefineTurnstile(hsm);
+   hsm.DefineState(TurnstileStates::OFF)
+      .SetNoParent()
+      .ForSignal(TurnstileSignals::COIN).GoToShallowHistory(TurnstileStates::POWERED);
+   CHECK_THROWS_AS(GenerateTurnstile(hsm.GetDefinition()), CodeGenerator<Turnstile::Definition>::GenerationException);
+}
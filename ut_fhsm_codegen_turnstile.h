@@ -0,0 +1,162 @@
+// Generated by kv::fhsm::CodeGenerator from a fluent definition; do not edit.
+// Include it after TurnstileLog, TurnstileStates and TurnstileSignals are declared.
+#ifndef generated_TurnstileDispatcher_h
+#define generated_TurnstileDispatcher_h
+
+class TurnstileDispatcher {
+public:
+   using Actor = TurnstileLog;
+   using StateSpace = TurnstileStates;
+   using SignalSpace = TurnstileSignals;
+
+   void Start(Actor& actor) {
+      m_current = TurnstileStates::LOCKED;
+      actor.NewState(TurnstileStates::LOCKED);
+      actor.EnterPowered();
+      actor.EnterLocked();
+   }
+
+   void Tick(Actor& actor) const {
+      switch (m_current) {
+      case TurnstileStates::POWERED: actor.TickPowered(); return;
+      case TurnstileStates::LOCKED: actor.TickPowered(); return;
+      case TurnstileStates::UNLOCKED: actor.TickPowered(); return;
+      case TurnstileStates::ALARM: actor.TickAlarm(); return;
+      default: return;
+      }
+   }
+
+   void Signal(Actor& actor, const SignalSpace s) {
+      switch (m_current) {
+      case TurnstileStates::POWERED:
+         switch (s) {
+         case TurnstileSignals::KICK:
+            actor.Complain();
+            return;
+         case TurnstileSignals::RESET:
+            actor.EnterLocked();
+            m_current = TurnstileStates::LOCKED;
+            actor.NewState(TurnstileStates::LOCKED);
+            return;
+         case TurnstileSignals::POWER:
+            actor.ExitPowered();
+            actor.EnterOff();
+            m_current = TurnstileStates::OFF;
+            actor.NewState(TurnstileStates::OFF);
+            return;
+         default: return;
+         }
+      case TurnstileStates::LOCKED:
+         switch (s) {
+         case TurnstileSignals::COIN:
+            actor.AddCredit();
+            actor.ExitLocked();
+            actor.EnterUnlocked();
+            m_current = TurnstileStates::UNLOCKED;
+            actor.NewState(TurnstileStates::UNLOCKED);
+            return;
+         case TurnstileSignals::PUSH:
+            actor.EnterAlarm();
+            m_current = TurnstileStates::ALARM;
+            actor.NewState(TurnstileStates::ALARM);
+            return;
+         case TurnstileSignals::KICK:
+            actor.Complain();
+            return;
+         case TurnstileSignals::RESET:
+            m_current = TurnstileStates::LOCKED;
+            actor.NewState(TurnstileStates::LOCKED);
+            return;
+         case TurnstileSignals::POWER:
+            actor.ExitLocked();
+            actor.ExitPowered();
+            actor.EnterOff();
+            m_current = TurnstileStates::OFF;
+            actor.NewState(TurnstileStates::OFF);
+            return;
+         default: return;
+         }
+      case TurnstileStates::UNLOCKED:
+         switch (s) {
+         case TurnstileSignals::COIN:
+            actor.AddCredit();
+            return;
+         case TurnstileSignals::PUSH:
+            actor.Pass();
+            if (actor.PassedTwice()) {
+               actor.ExitUnlocked();
+               actor.EnterLocked();
+               m_current = TurnstileStates::LOCKED;
+               actor.NewState(TurnstileStates::LOCKED);
+            }
+            return;
+         case TurnstileSignals::KICK:
+            actor.Complain();
+            return;
+         case TurnstileSignals::RESET:
+            actor.ExitUnlocked();
+            actor.EnterLocked();
+            m_current = TurnstileStates::LOCKED;
+            actor.NewState(TurnstileStates::LOCKED);
+            return;
+         case TurnstileSignals::POWER:
+            actor.ExitUnlocked();
+            actor.ExitPowered();
+            actor.EnterOff();
+            m_current = TurnstileStates::OFF;
+            actor.NewState(TurnstileStates::OFF);
+            return;
+         default: return;
+         }
+      case TurnstileStates::ALARM:
+         switch (s) {
+         case TurnstileSignals::COIN:
+            actor.AddCredit();
+            actor.ExitLocked();
+            actor.EnterUnlocked();
+            m_current = TurnstileStates::UNLOCKED;
+            actor.NewState(TurnstileStates::UNLOCKED);
+            return;
+         case TurnstileSignals::PUSH:
+            m_current = TurnstileStates::ALARM;
+            actor.NewState(TurnstileStates::ALARM);
+            return;
+         case TurnstileSignals::KICK:
+            actor.Siren();
+            return;
+         case TurnstileSignals::RESET:
+            actor.ExitLocked();
+            actor.EnterUnlocked();
+            m_current = TurnstileStates::UNLOCKED;
+            actor.NewState(TurnstileStates::UNLOCKED);
+            return;
+         case TurnstileSignals::POWER:
+            actor.ExitLocked();
+            actor.ExitPowered();
+            actor.EnterOff();
+            m_current = TurnstileStates::OFF;
+            actor.NewState(TurnstileStates::OFF);
+            return;
+         default: return;
+         }
+      case TurnstileStates::OFF:
+         switch (s) {
+         case TurnstileSignals::POWER:
+            actor.EnterPowered();
+            actor.EnterLocked();
+            m_current = TurnstileStates::LOCKED;
+            actor.NewState(TurnstileStates::LOCKED);
+            return;
+         default: return;
+         }
+      default: return;
+      }
+   }
+
+   StateSpace CurrentState() const { return m_current; }
+
+private:
+   StateSpace m_current{TurnstileStates::LOCKED};
+};
+
+#endif
@@ -0,0 +1,154 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/Executor.h"
+#include "kv/fhsm/StateMachine.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace kv::fhsm;
+
+TEST_CASE( "The owner of a deque works LIFO and thieves FIFO", "[fhsm][executor]" ) {
+   int items[5] = {0, 1, 2, 3, 4};
+   WorkStealingDeque<int, 4> deque;
+   CHECK(nullptr == deque.Pop());
+   CHECK(nullptr == deque.Steal());
+   for (int i=0; i<4; i++) {
+      REQUIRE(deque.Push(&items[i]));
+   }
+   CHECK( ! deque.Push(&items[4]));
+   CHECK(&items[3] == deque.Pop());
+   CHECK(&items[0] == deque.Steal());
+   CHECK(&items[2] == deque.Pop());
+   CHECK(&items[1] == deque.Pop());
+   CHECK(nullptr == deque.Pop());
+}
+
+TEST_CASE( "Every pushed item is taken exactly once", "[fhsm][executor]" ) {
+   const int COUNT = 100000;
+   std::vector<int> items(COUNT);
+   std::vector<std::atomic<int>> taken(COUNT);
+   WorkStealingDeque<int, 256> deque;
+   std::atomic<bool> done{false};
+   auto take = [&](int* item) { taken[item - items.data()].fetch_add(1); };
+
+   std::vector<std::thread> thieves;
+   for (int t=0; t<3; t++) {
+      thieves.emplace_back([&] {
+         while ( ! done.load()) {
+            if (auto item = deque.Steal()) take(item);
+         }
+      });
+   }
+   for (int i=0; i<COUNT; i++) {
+      while ( ! deque.Push(&items[i])) {
+         if (auto item = deque.Pop()) take(item);
+      }
+      if (i % 3 == 0) {
+         if (auto item = deque.Pop()) take(item);
+      }
+   }
+   while (auto item = deque.Pop()) take(item);
+   done.store(true);
+   for (auto& t : thieves) t.join();
+
+   int wrong = 0;
+   for (auto& count : taken) {
+      if (count.load() != 1) ++wrong;
+   }
+   CHECK(0 == wrong);
+}
+
+enum class CounterStates  { COUNTING };
+enum class CounterSignals { BUMP };
+
+// Complains if it is ever run on two threads at once.
+class Counter {
+public:
+   using Machine = StateMachine<Counter, CounterStates, CounterStates::COUNTING, CounterStates::COUNTING, CounterSignals>;
+   Counter(Executor& executor) : m_hsm(*this), m_activity(executor, m_hsm) {
+      m_hsm.DefineState(CounterStates::COUNTING)
+         .SetNoParent()
+         .ForSignal(CounterSignals::BUMP).Do(&Counter::Bump);
+      m_hsm.ConcludeSetupAndSetInitialState(CounterStates::COUNTING);
+   }
+   void Bump() {
+      if (m_inside.fetch_add(1) != 0) ++overlaps;
+      ++bumps;
+      m_inside.fetch_sub(1);
+   }
+   kv::embedded::Status Post(const CounterSignals s) { return m_activity.Post(s); }
+
+   int bumps = 0;     // only touched by the activity
+   int overlaps = 0;
+private:
+   std::atomic<int> m_inside{0};
+   Machine m_hsm;
+   Activity<CounterSignals, Machine, 64, OverflowPolicy::BLOCK> m_activity;
+};
+
+TEST_CASE( "An executor runs each activity on one thread at a time", "[fhsm][executor]" ) {
+   const int ACTORS = 32;
+   const int PRODUCERS = 4;
+   const int EACH = 5000;
+   Executor executor(4);
+   std::vector<std::unique_ptr<Counter>> counters;
+   for (int a=0; a<ACTORS; a++) {
+      counters.emplace_back(new Counter(executor));
+   }
+
+   std::vector<std::thread> producers;
+   for (int p=0; p<PRODUCERS; p++) {
+      producers.emplace_back([&counters, p] {
+         for (int i=0; i<EACH; i++) {
+            counters[(i * 7 + p) % ACTORS]->Post(CounterSignals::BUMP);
+         }
+      });
+   }
+   for (auto& t : producers) t.join();
+   executor.WaitUntilIdle();
+
+   int bumps = 0;
+   int overlaps = 0;
+   for (auto& c : counters) {
+      bumps += c->bumps;
+      overlaps += c->overlaps;
+   }
+   CHECK(PRODUCERS * EACH == bumps);
+   CHECK(0 == overlaps);
+}
+
+namespace {
+
+// Always has more to do, until the counter has had both its bumps (or it
+// has run far too often); it bumps the counter itself on its first run.
+class Busy : public Schedulable {
+public:
+   static constexpr int TOO_OFTEN{100000};
+   Busy(Executor& executor, Counter& counter) : Schedulable(executor), m_counter(counter) {}
+   int runs = 0; // only touched by the worker
+protected:
+   void Run(size_t) override {
+      if (runs++ == 0) {
+         m_counter.Post(CounterSignals::BUMP);
+      }
+   }
+   bool HasWork() const override { return m_counter.bumps < 2 && runs < TOO_OFTEN; }
+private:
+   Counter& m_counter;
+};
+
+} // namespace
+
+TEST_CASE( "A busy activity does not starve the others on its worker", "[fhsm][executor]" ) {
+   Executor executor(1);
+   Counter counter(executor);
+   Busy busy(executor, counter);
+   busy.Notify();
+   counter.Post(CounterSignals::BUMP);
+   executor.WaitUntilIdle();
+   CHECK(2 == counter.bumps);
+   CHECK(busy.runs < Busy::TOO_OFTEN);
+}
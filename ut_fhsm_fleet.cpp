@@ -0,0 +1,219 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/FleetStateMachine.h"
+
+#include <memory>
+#include <vector>
+
+using namespace kv::fhsm;
+
+enum class PumpStates  { IDLE, ACTIVE, FILLING };
+enum class PumpSignals { START, FULL, PAUSE, RESUME };
+
+// Only ACTIVE (and so FILLING) ticks; a filling pump is full after three ticks.
+class Pump {
+public:
+   using Definition = Blueprint<Pump, PumpStates, PumpStates::IDLE, PumpStates::FILLING, PumpSignals>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(PumpStates::IDLE)
+            .SetNoParent()
+            .ForSignal(PumpSignals::START).GoTo(PumpStates::FILLING)
+            .ForSignal(PumpSignals::RESUME).GoToDeepHistory(PumpStates::ACTIVE);
+         b.DefineState(PumpStates::ACTIVE)
+            .SetNoParent()
+            .SetOnTick(&Pump::Fill)
+            .ForSignal(PumpSignals::FULL).GoTo(PumpStates::IDLE)
+            .ForSignal(PumpSignals::PAUSE).GoTo(PumpStates::IDLE)
+            .ForSignal(PumpSignals::START).Defer();
+         b.DefineState(PumpStates::FILLING)
+            .SetParent(PumpStates::ACTIVE);
+         b.ConcludeSetupAndSetInitialState(PumpStates::IDLE);
+      });
+      return blueprint;
+   }
+
+   explicit Pump(FleetTicker& ticker) : m_hsm(*this, Shared(), ticker) {
+      m_hsm.Start();
+   }
+   void Fill() {
+      ++ticks;
+      if (stops) {
+         stops->m_hsm.Signal(PumpSignals::FULL);
+      }
+      if (ticks % 3 == 0) {
+         m_hsm.Signal(PumpSignals::FULL);
+      }
+   }
+
+   FleetStateMachine<Definition, 2> m_hsm;
+   Pump* stops = nullptr;
+   int ticks = 0;
+};
+
+TEST_CASE( "Only machines in ticking states are ticked", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   std::vector<std::unique_ptr<Pump>> pumps;
+   for (int p=0; p<100; p++) {
+      pumps.emplace_back(new Pump(ticker));
+   }
+   CHECK(0 == ticker.Size());
+   for (int p=0; p<100; p+=20) {
+      pumps[p]->m_hsm.Signal(PumpSignals::START);
+   }
+   CHECK(5 == ticker.Size());
+   ticker.Tick();
+   ticker.Tick();
+   for (int p=0; p<100; p++) {
+      REQUIRE(((p % 20 == 0) ? 2 : 0) == pumps[p]->ticks);
+   }
+   ticker.Tick(); // each of them is full and leaves while it is ticked
+   CHECK(0 == ticker.Size());
+   CHECK(PumpStates::IDLE == pumps[20]->m_hsm.CurrentState());
+   ticker.Tick();
+   CHECK(3 == pumps[20]->ticks);
+}
+
+TEST_CASE( "A member may make another leave while the fleet is ticked", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   Pump first(ticker);
+   Pump second(ticker);
+   second.m_hsm.Signal(PumpSignals::START);
+   first.m_hsm.Signal(PumpSignals::START); // joins in front of second
+   first.stops = &second;
+   ticker.Tick();
+   CHECK(1 == first.ticks);
+   CHECK(0 == second.ticks);
+   CHECK(1 == ticker.Size());
+}
+
+TEST_CASE( "A fleet machine keeps the signals its states defer", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   Pump pump(ticker);
+   pump.m_hsm.Signal(PumpSignals::START);
+   pump.m_hsm.Signal(PumpSignals::START); // again once it is full
+   CHECK(1 == pump.m_hsm.Deferred());
+   for (int frame=0; frame<3; frame++) {
+      ticker.Tick();
+   }
+   CHECK(0 == pump.m_hsm.Deferred());
+   CHECK(PumpStates::FILLING == pump.m_hsm.CurrentState());
+   CHECK(1 == ticker.Size());
+}
+
+TEST_CASE( "A fleet machine remembers the history of its states", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   Pump pump(ticker);
+   pump.m_hsm.Signal(PumpSignals::START);
+   pump.m_hsm.Signal(PumpSignals::PAUSE);
+   CHECK(0 == ticker.Size());
+   pump.m_hsm.Signal(PumpSignals::RESUME);
+   CHECK(PumpStates::FILLING == pump.m_hsm.CurrentState());
+   CHECK(1 == ticker.Size());
+}
+
+TEST_CASE( "A destroyed machine leaves the fleet", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   {
+      Pump pump(ticker);
+      pump.m_hsm.Signal(PumpSignals::START);
+      CHECK(1 == ticker.Size());
+   }
+   CHECK(0 == ticker.Size());
+   ticker.Tick();
+}
+
+enum class SensorStates  { SAMPLING };
+enum class SensorSignals { UNUSED };
+
+// An expensive handler that only has to run every 10th frame.
+class Sensor {
+public:
+   using Definition = Blueprint<Sensor, SensorStates, SensorStates::SAMPLING, SensorStates::SAMPLING, SensorSignals>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(SensorStates::SAMPLING)
+            .SetNoParent()
+            .SetOnTick(&Sensor::Sample)
+            .SetTickPeriod(10);
+         b.ConcludeSetupAndSetInitialState(SensorStates::SAMPLING);
+      });
+      return blueprint;
+   }
+
+   Sensor(FleetTicker& ticker, int& samplesThisFrame) : m_hsm(*this, Shared(), ticker), m_samplesThisFrame(samplesThisFrame) {
+      m_hsm.Start();
+   }
+   void Sample() {
+      ++samples;
+      ++m_samplesThisFrame;
+   }
+
+   FleetStateMachine<Definition> m_hsm;
+   int samples = 0;
+private:
+   int& m_samplesThisFrame;
+};
+
+TEST_CASE( "The fleet staggers the phases of periodic tick handlers", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   int samplesThisFrame = 0;
+   std::vector<std::unique_ptr<Sensor>> sensors;
+   for (int s=0; s<100; s++) {
+      sensors.emplace_back(new Sensor(ticker, samplesThisFrame));
+   }
+   for (int frame=0; frame<30; frame++) {
+      samplesThisFrame = 0;
+      ticker.Tick();
+      REQUIRE(10 == samplesThisFrame);
+   }
+   for (auto& sensor : sensors) {
+      REQUIRE(3 == sensor->samples);
+   }
+}
+
+// Counts how often the ticker visits it.
+class Visited : public FleetTicker::Member {
+public:
+   explicit Visited(std::uint32_t phase) : FleetTicker::Member(phase) {}
+   void Tick() override { ++visits; }
+   int visits = 0;
+};
+
+TEST_CASE( "A periodic member is only visited on the frames it is due", "[fhsm][fleet]" ) {
+   FleetTicker ticker;
+   Visited every(0);
+   Visited tenth(3);
+   ticker.Join(every);
+   ticker.Join(tenth, 10);
+   CHECK(2 == ticker.Size());
+   for (int frame=0; frame<7; frame++) {
+      ticker.Tick();
+   }
+   CHECK(7 == every.visits);
+   CHECK(0 == tenth.visits);
+   for (int frame=7; frame<30; frame++) {
+      ticker.Tick();
+   }
+   CHECK(30 == every.visits);
+   CHECK(3 == tenth.visits); // frames 7, 17 and 27
+   ticker.Join(tenth, 1);
+   ticker.Tick();
+   CHECK(4 == tenth.visits);
+   ticker.Join(tenth, 4); // due again on frame 33
+   ticker.Tick();
+   ticker.Tick();
+   CHECK(4 == tenth.visits);
+   ticker.Tick();
+   CHECK(5 == tenth.visits);
+   ticker.Leave(tenth);
+   ticker.Leave(every);
+   CHECK(0 == ticker.Size());
+   for (int frame=0; frame<10; frame++) {
+      ticker.Tick();
+   }
+   CHECK(34 == every.visits);
+   CHECK(5 == tenth.visits);
+}
@@ -0,0 +1,102 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/Mailbox.h"
+#include "kv/fhsm/StateMachine.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kv::fhsm;
+
+enum class IngestStates  { WAITING, RUNNING };
+enum class IngestSignals { DATA, STOP, GO };
+
+// Counts what the machine gets; only ever touched from the owning thread.
+class Ingest {
+public:
+   Ingest() : m_hsm(*this) {
+      m_hsm.DefineState(IngestStates::WAITING)
+         .SetNoParent()
+         .ForSignal(IngestSignals::DATA).Do(&Ingest::Record)
+         .ForSignal(IngestSignals::GO).GoTo(IngestStates::RUNNING);
+      m_hsm.DefineState(IngestStates::RUNNING)
+         .SetNoParent()
+         .SetOnTick(&Ingest::CountTick)
+         .ForSignal(IngestSignals::DATA).Do(&Ingest::Record)
+         .ForSignal(IngestSignals::STOP).GoTo(IngestStates::WAITING);
+      m_hsm.ConcludeSetupAndSetInitialState(IngestStates::WAITING, &Ingest::NewState);
+   }
+   void Record() { ++data; }
+   void CountTick() { ++ticks; }
+   void NewState(const IngestStates s) { trail += (s == IngestStates::RUNNING) ? "R" : "W"; }
+
+   StateMachine<Ingest, IngestStates, IngestStates::WAITING, IngestStates::RUNNING, IngestSignals> m_hsm;
+   int data = 0;
+   int ticks = 0;
+   std::string trail;
+};
+
+TEST_CASE( "A full mailbox rejects new signals", "[fhsm][mailbox]" ) {
+   Ingest ingest;
+   Mailbox<IngestSignals, 4> mailbox;
+   for (int i=0; i<4; i++) {
+      CHECK(kv::embedded::Success == mailbox.Post(IngestSignals::DATA));
+   }
+   CHECK(kv::embedded::Rejected == mailbox.Post(IngestSignals::GO));
+   CHECK(1 == mailbox.Dropped());
+   CHECK(4 == mailbox.Pump(ingest.m_hsm));
+   CHECK(4 == ingest.data);
+   CHECK("W" == ingest.trail);
+   CHECK(0 == mailbox.Pump(ingest.m_hsm));
+}
+
+TEST_CASE( "An overwriting mailbox keeps the newest signals", "[fhsm][mailbox]" ) {
+   Ingest ingest;
+   Mailbox<IngestSignals, 4, OverflowPolicy::OVERWRITE> mailbox;
+   const IngestSignals posted[] = {
+      IngestSignals::GO, IngestSignals::STOP, IngestSignals::DATA, IngestSignals::GO, IngestSignals::STOP, IngestSignals::GO,
+   };
+   for (auto s : posted) {
+      CHECK(kv::embedded::Success == mailbox.Post(s));
+   }
+   CHECK(2 == mailbox.Dropped());
+   CHECK(1 == mailbox.Pump(ingest.m_hsm, 1)); // a batch of one
+   CHECK(3 == mailbox.Pump(ingest.m_hsm));
+   CHECK(1 == ingest.data);
+   CHECK("WRWR" == ingest.trail);
+}
+
+TEST_CASE( "Tick pumps the mailbox first", "[fhsm][mailbox]" ) {
+   Ingest ingest;
+   Mailbox<IngestSignals, 8> mailbox;
+   mailbox.Post(IngestSignals::GO);
+   mailbox.Tick(ingest.m_hsm);
+   CHECK("WR" == ingest.trail);
+   CHECK(1 == ingest.ticks);
+}
+
+TEST_CASE( "Many threads post while the owner pumps", "[fhsm][mailbox]" ) {
+   const int PRODUCERS = 4;
+   const int EACH = 20000;
+   Ingest ingest;
+   Mailbox<IngestSignals, 64, OverflowPolicy::BLOCK> mailbox;
+
+   std::vector<std::thread> producers;
+   for (int p=0; p<PRODUCERS; p++) {
+      producers.emplace_back([&mailbox] {
+         for (int i=0; i<EACH; i++) {
+            mailbox.Post(IngestSignals::DATA);
+         }
+      });
+   }
+   while (ingest.data < PRODUCERS * EACH) {
+      mailbox.Tick(ingest.m_hsm);
+   }
+   for (auto& t : producers) {
+      t.join();
+   }
+   CHECK(PRODUCERS * EACH == ingest.data);
+   CHECK(0 == mailbox.Dropped());
+   CHECK(0 == mailbox.Pump(ingest.m_hsm));
+}
@@ -0,0 +1,158 @@
+// Proves that a state machine with a dense signal range never touches the
+// heap: global operator new is replaced by one that counts allocations.
+// This must be its own test program since the replacement is global.
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/StateMachine.h"
+#include "kv/fhsm/SharedStateMachine.h"
+#include "kv/fhsm/RelocatableStateMachine.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+size_t allocations = 0;
+}
+
+// Kept out of line so the compiler does not pair the inlined malloc/free with new/delete expressions.
+#if defined(__GNUC__)
+#define FHSM_NOINLINE __attribute__((noinline))
+#else
+#define FHSM_NOINLINE
+#endif
+
+FHSM_NOINLINE void* operator new(size_t size) {
+   ++allocations;
+   if (void* p = std::malloc(size ? size : 1)) {
+      return p;
+   }
+   throw std::bad_alloc();
+}
+FHSM_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+FHSM_NOINLINE void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+using namespace kv::fhsm;
+
+enum class DoorStates  { CLOSED, SHUT, LOCKED, OPEN, AJAR, WIDE };
+enum class DoorSignals { PUSH, PULL, LOCK, UNLOCK, CREAK };
+
+class Door {
+public:
+   using Machine = StateMachine<Door, DoorStates, DoorStates::CLOSED, DoorStates::WIDE,
+                                DoorSignals, DoorSignals::PUSH, DoorSignals::CREAK>;
+   using Definition = Machine::Definition;
+
+   // Works on a StateMachine as well as on a Blueprint.
+   template<class Builder>
+   static void Define(Builder& b) {
+      b.DefineState(DoorStates::CLOSED)
+         .SetNoParent()
+         .SetOnEnter(&Door::Count)
+         .SetOnExit(&Door::Count)
+         .ForSignal(DoorSignals::PULL).GoTo(DoorStates::AJAR);
+      b.DefineState(DoorStates::SHUT)
+         .SetParent(DoorStates::CLOSED)
+         .SetOnTick(&Door::Count)
+         .ForSignal(DoorSignals::LOCK).GoToIf(DoorStates::LOCKED, &Door::HasKey);
+      b.DefineState(DoorStates::LOCKED)
+         .SetParent(DoorStates::CLOSED)
+         .ForSignal(DoorSignals::UNLOCK).GoTo(DoorStates::SHUT)
+         .ForSignal(DoorSignals::PULL).Do(&Door::Count);
+      b.DefineState(DoorStates::OPEN)
+         .SetNoParent()
+         .SetOnEnter(&Door::Count)
+         .ForSignal(DoorSignals::PUSH).GoTo(DoorStates::SHUT)
+         .ForSignal(DoorSignals::CREAK).Do(&Door::Count);
+      b.DefineState(DoorStates::AJAR)
+         .SetParent(DoorStates::OPEN)
+         .ForSignal(DoorSignals::PULL).GoTo(DoorStates::WIDE);
+      b.DefineState(DoorStates::WIDE)
+         .SetParent(DoorStates::OPEN)
+         .SetOnExit(&Door::Count);
+      b.ConcludeSetupAndSetInitialState(DoorStates::SHUT, &Door::NewState);
+   }
+
+   void Count() { ++count; }
+   bool HasKey() const { return true; }
+   void NewState(const DoorStates s) { state = s; }
+
+   int count = 0;
+   DoorStates state = DoorStates::CLOSED;
+};
+
+class OwningDoor : public Door {
+public:
+   OwningDoor() : m_hsm(*this) {
+      Define(m_hsm);
+   }
+   Machine m_hsm;
+};
+
+namespace {
+
+template<class Machine>
+void Exercise(Machine& hsm) {
+   for (int i=0; i<10; i++) {
+      hsm.Tick();
+      hsm.Signal(DoorSignals::LOCK);
+      hsm.Signal(DoorSignals::PULL);
+      hsm.Signal(DoorSignals::UNLOCK);
+      hsm.Signal(DoorSignals::PULL);
+      hsm.Signal(DoorSignals::PULL);
+      hsm.Signal(DoorSignals::CREAK);
+      hsm.Signal(DoorSignals::PUSH);
+   }
+}
+
+} // anonymous namespace
+
+TEST_CASE( "A dense StateMachine does not allocate", "[fhsm][noheap]" ) {
+   auto before = allocations;
+   {
+      OwningDoor door;
+      Exercise(door.m_hsm);
+   }
+   auto during = allocations - before;
+   CHECK(0 == during);
+}
+
+TEST_CASE( "Blueprint setup and shared machines do not allocate", "[fhsm][noheap]" ) {
+   auto before = allocations;
+   Door::Definition blueprint;
+   Door::Define(blueprint);
+   Door door;
+   SharedStateMachine<Door::Definition> hsm(door, blueprint);
+   hsm.Start();
+   Exercise(hsm);
+   auto during = allocations - before;
+   CHECK(0 == during);
+   CHECK(DoorStates::SHUT == door.state);
+   CHECK(door.count > 0);
+}
+
+TEST_CASE( "Relocatable machines do not allocate", "[fhsm][noheap]" ) {
+   static Door::Definition blueprint;
+   Door::Define(blueprint);
+   Door door;
+   auto before = allocations;
+   RelocatableStateMachine<Door::Definition> hsm(blueprint);
+   hsm.Start(door);
+   for (int i=0; i<10; i++) {
+      hsm.Tick(door);
+      hsm.Signal(door, DoorSignals::PULL);
+      hsm.Signal(door, DoorSignals::PULL);
+      hsm.Signal(door, DoorSignals::PUSH);
+   }
+   auto during = allocations - before;
+   CHECK(0 == during);
+}
+
+TEST_CASE( "The counting operator new sees map based machines allocate", "[fhsm][noheap]" ) {
+   using Definition = Blueprint<Door, DoorStates, DoorStates::CLOSED, DoorStates::WIDE, DoorSignals>;
+   auto before = allocations;
+   {
+      Definition blueprint;
+      Door::Define(blueprint);
+   }
+   CHECK(allocations > before);
+}
@@ -0,0 +1,184 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/StaticStateMachine.h"
+#include "kv/fhsm/StateMachine.h"
+
+#include <string>
+
+using namespace kv::fhsm;
+
+enum class DoorStates  { CLOSED, SHUT, LOCKED, OPEN, AJAR, WIDE };
+enum class DoorSignals { PUSH, PULL, LOCK, UNLOCK, CREAK, KICK };
+
+// Records every handler call so two machines can be compared.
+class DoorLog {
+public:
+   void EnterClosed() { trail += "+closed"; }
+   void ExitClosed() { trail += "-closed"; }
+   void TickShut() { trail += "~shut"; }
+   void EnterLocked() { trail += "+locked"; }
+   void ExitLocked() { trail += "-locked"; }
+   void EnterOpen() { trail += "+open"; }
+   void TickOpen() { trail += "~open"; }
+   void ExitWide() { trail += "-wide"; }
+   void Creak() { trail += "!creak"; }
+   void Rattle() { trail += "!rattle"; }
+   bool HasKey() const { return hasKey; }
+   void NewState(const DoorStates s) { state = s; trail += "@" + std::to_string(int(s)); }
+
+   std::string trail;
+   bool hasKey = true;
+   DoorStates state = DoorStates::CLOSED;
+};
+
+using S = StaticBlueprint<DoorLog, DoorStates, DoorStates::CLOSED, DoorStates::WIDE,
+                          DoorSignals, DoorSignals::PUSH, DoorSignals::KICK>;
+using StaticDoor = S::Machine<
+   S::Initial<DoorStates::SHUT, &DoorLog::NewState>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent,
+      S::OnEnter<&DoorLog::EnterClosed>,
+      S::OnExit<&DoorLog::ExitClosed>,
+      S::GoTo<DoorSignals::PULL, DoorStates::AJAR>,
+      S::GoTo<DoorSignals::KICK, DoorStates::LOCKED>>,
+   S::DefineState<DoorStates::SHUT, S::Parent<DoorStates::CLOSED>,
+      S::OnTick<&DoorLog::TickShut>,
+      S::GoToIf<DoorSignals::LOCK, DoorStates::LOCKED, &DoorLog::HasKey>>,
+   S::DefineState<DoorStates::LOCKED, S::Parent<DoorStates::CLOSED>,
+      S::OnEnter<&DoorLog::EnterLocked>,
+      S::OnExit<&DoorLog::ExitLocked>,
+      S::GoTo<DoorSignals::UNLOCK, DoorStates::SHUT>,
+      S::Do<DoorSignals::PULL, &DoorLog::Rattle>>,
+   S::DefineState<DoorStates::OPEN, S::NoParent,
+      S::OnEnter<&DoorLog::EnterOpen>,
+      S::OnTick<&DoorLog::TickOpen>,
+      S::GoTo<DoorSignals::PUSH, DoorStates::SHUT>,
+      S::Do<DoorSignals::CREAK, &DoorLog::Creak>>,
+   S::DefineState<DoorStates::AJAR, S::Parent<DoorStates::OPEN>,
+      S::GoTo<DoorSignals::PULL, DoorStates::WIDE>>,
+   S::DefineState<DoorStates::WIDE, S::Parent<DoorStates::OPEN>,
+      S::OnExit<&DoorLog::ExitWide>,
+      S::Do<DoorSignals::PUSH, &DoorLog::Creak>,
+      S::GoTo<DoorSignals::KICK, DoorStates::WIDE>>>;
+
+// The same machine through the fluent API.
+class DynamicDoor : public DoorLog {
+public:
+   DynamicDoor() : m_hsm(*this) {
+      m_hsm.DefineState(DoorStates::CLOSED)
+         .SetNoParent()
+         .SetOnEnter(&DoorLog::EnterClosed)
+         .SetOnExit(&DoorLog::ExitClosed)
+         .ForSignal(DoorSignals::PULL).GoTo(DoorStates::AJAR)
+         .ForSignal(DoorSignals::KICK).GoTo(DoorStates::LOCKED);
+      m_hsm.DefineState(DoorStates::SHUT)
+         .SetParent(DoorStates::CLOSED)
+         .SetOnTick(&DoorLog::TickShut)
+         .ForSignal(DoorSignals::LOCK).GoToIf(DoorStates::LOCKED, &DoorLog::HasKey);
+      m_hsm.DefineState(DoorStates::LOCKED)
+         .SetParent(DoorStates::CLOSED)
+         .SetOnEnter(&DoorLog::EnterLocked)
+         .SetOnExit(&DoorLog::ExitLocked)
+         .ForSignal(DoorSignals::UNLOCK).GoTo(DoorStates::SHUT)
+         .ForSignal(DoorSignals::PULL).Do(&DoorLog::Rattle);
+      m_hsm.DefineState(DoorStates::OPEN)
+         .SetNoParent()
+         .SetOnEnter(&DoorLog::EnterOpen)
+         .SetOnTick(&DoorLog::TickOpen)
+         .ForSignal(DoorSignals::PUSH).GoTo(DoorStates::SHUT)
+         .ForSignal(DoorSignals::CREAK).Do(&DoorLog::Creak);
+      m_hsm.DefineState(DoorStates::AJAR)
+         .SetParent(DoorStates::OPEN)
+         .ForSignal(DoorSignals::PULL).GoTo(DoorStates::WIDE);
+      m_hsm.DefineState(DoorStates::WIDE)
+         .SetParent(DoorStates::OPEN)
+         .SetOnExit(&DoorLog::ExitWide)
+         .ForSignal(DoorSignals::PUSH).Do(&DoorLog::Creak)
+         .ForSignal(DoorSignals::KICK).GoTo(DoorStates::WIDE);
+      m_hsm.ConcludeSetupAndSetInitialState(DoorStates::SHUT, &DoorLog::NewState);
+   }
+   StateMachine<DoorLog, DoorStates, DoorStates::CLOSED, DoorStates::WIDE, DoorSignals> m_hsm;
+};
+
+TEST_CASE( "A compile time definition behaves like the fluent one", "[fhsm][static]" ) {
+   const DoorSignals stream[] = {
+      DoorSignals::CREAK, DoorSignals::LOCK, DoorSignals::PULL, DoorSignals::UNLOCK,
+      DoorSignals::PULL, DoorSignals::CREAK, DoorSignals::PULL, DoorSignals::KICK,
+      DoorSignals::PUSH, DoorSignals::PULL, DoorSignals::PUSH, DoorSignals::LOCK,
+      DoorSignals::PUSH, DoorSignals::UNLOCK, static_cast<DoorSignals>(42),
+   };
+   DynamicDoor dynamicDoor;
+   DoorLog staticDoor;
+   StaticStateMachine<StaticDoor> hsm;
+   hsm.Start(staticDoor);
+   CHECK(dynamicDoor.trail == staticDoor.trail);
+   for (auto s : stream) {
+      dynamicDoor.m_hsm.Signal(s);
+      dynamicDoor.m_hsm.Tick();
+      hsm.Signal(staticDoor, s);
+      hsm.Tick(staticDoor);
+      CHECK(dynamicDoor.state == staticDoor.state);
+      CHECK(dynamicDoor.state == hsm.CurrentState());
+   }
+   CHECK(dynamicDoor.trail == staticDoor.trail);
+}
+
+TEST_CASE( "An inherited transition leaves and enters up to the current leaf's common ancestor", "[fhsm][static]" ) {
+   DynamicDoor dynamicDoor;
+   DoorLog staticDoor;
+   StaticStateMachine<StaticDoor> hsm;
+   hsm.Start(staticDoor);
+   dynamicDoor.trail.clear();
+   staticDoor.trail.clear();
+   for (int kick=0; kick<2; kick++) {
+      dynamicDoor.m_hsm.Signal(DoorSignals::KICK);
+      hsm.Signal(staticDoor, DoorSignals::KICK);
+   }
+   CHECK("+locked@2@2" == staticDoor.trail); // CLOSED's KICK, taken in LOCKED, leads to the leaf itself
+   CHECK(dynamicDoor.trail == staticDoor.trail);
+}
+
+TEST_CASE( "A guard in a compile time definition", "[fhsm][static]" ) {
+   DoorLog door;
+   door.hasKey = false;
+   StaticStateMachine<StaticDoor> hsm;
+   hsm.Start(door);
+   hsm.Signal(door, DoorSignals::LOCK);
+   CHECK(DoorStates::SHUT == hsm.CurrentState());
+}
+
+TEST_CASE( "A compile time machine is just its current state", "[fhsm][static]" ) {
+   static_assert(sizeof(StaticStateMachine<StaticDoor>) == sizeof(StaticDoor::IndexType), "only the current state");
+   static_assert(StaticDoor::ERROR == StaticError::NONE, "the door is well formed");
+}
+
+// Ill-formed definitions are rejected when a StaticStateMachine is instantiated;
+// the error is also available as a constant, which is what is checked here.
+using Cycle = S::Machine<
+   S::Initial<DoorStates::CLOSED>,
+   S::DefineState<DoorStates::CLOSED, S::Parent<DoorStates::SHUT>>,
+   S::DefineState<DoorStates::SHUT, S::Parent<DoorStates::CLOSED>>>;
+static_assert(Cycle::ERROR == StaticError::CYCLE, "cycles are found");
+
+using Undefined = S::Machine<
+   S::Initial<DoorStates::CLOSED>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent,
+      S::GoTo<DoorSignals::PULL, DoorStates::AJAR>>>;
+static_assert(Undefined::ERROR == StaticError::UNDEFINED_STATE, "undefined destinations are found");
+
+using UndefinedInitial = S::Machine<
+   S::Initial<DoorStates::OPEN>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent>>;
+static_assert(UndefinedInitial::ERROR == StaticError::UNDEFINED_STATE, "undefined initial states are found");
+
+using Duplicate = S::Machine<
+   S::Initial<DoorStates::CLOSED>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent,
+      S::GoTo<DoorSignals::PULL, DoorStates::CLOSED>,
+      S::GoTo<DoorSignals::PULL, DoorStates::CLOSED>>>;
+static_assert(Duplicate::ERROR == StaticError::DUPLICATE_TRANSITION, "duplicate transitions are found");
+
+using Twice = S::Machine<
+   S::Initial<DoorStates::CLOSED>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent>,
+   S::DefineState<DoorStates::CLOSED, S::NoParent>>;
+static_assert(Twice::ERROR == StaticError::DUPLICATE_STATE, "states defined twice are found");
@@ -0,0 +1,235 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/TimedStateMachine.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace kv::fhsm;
+
+enum class KettleStates  { OFF, ON, HEATING, KEEPING_WARM };
+enum class KettleSignals { SWITCH_ON, DONE, LIFT, NUDGE, SHUTDOWN, RESUME };
+
+// Heats for 50 ticks, keeps warm (beeping once after 10 ticks) and switches
+// itself off 1000 ticks after it was switched on; nothing is ever ticked.
+class Kettle {
+public:
+   using Definition = Blueprint<Kettle, KettleStates, KettleStates::OFF, KettleStates::KEEPING_WARM, KettleSignals>;
+   template<size_t timers>
+   using Machine = TimedStateMachine<Definition, TimingWheel<>, timers>;
+
+   static const Definition& Shared() {
+      static const Definition blueprint([](Definition& b) {
+         b.DefineState(KettleStates::OFF)
+            .SetNoParent()
+            .ForSignal(KettleSignals::SWITCH_ON).GoTo(KettleStates::HEATING)
+            .ForSignal(KettleSignals::RESUME).GoToDeepHistory(KettleStates::ON);
+         b.DefineState(KettleStates::ON)
+            .SetNoParent()
+            .SetTimeout(1000, KettleSignals::SHUTDOWN)
+            .ForSignal(KettleSignals::SHUTDOWN).GoTo(KettleStates::OFF)
+            .ForSignal(KettleSignals::SWITCH_ON).Defer();
+         b.DefineState(KettleStates::HEATING)
+            .SetParent(KettleStates::ON)
+            .SetTimeout(50, KettleSignals::DONE)
+            .ForSignal(KettleSignals::DONE).GoTo(KettleStates::KEEPING_WARM)
+            .ForSignal(KettleSignals::LIFT).GoTo(KettleStates::KEEPING_WARM);
+         b.DefineState(KettleStates::KEEPING_WARM)
+            .SetParent(KettleStates::ON)
+            .SetTimeout(10, KettleSignals::NUDGE)
+            .ForSignal(KettleSignals::NUDGE).Do(&Kettle::Beep);
+         b.ConcludeSetupAndSetInitialState(KettleStates::OFF, &Kettle::NewState);
+      });
+      return blueprint;
+   }
+
+   explicit Kettle(TimingWheel<>& wheel) : m_hsm(*this, Shared(), wheel) {
+      m_hsm.Start();
+   }
+   void Beep() { ++beeps; }
+   void NewState(const KettleStates s) {
+      const char* letters = "OxHK";
+      trail += letters[static_cast<int>(s)];
+   }
+
+   Machine<2> m_hsm;
+   std::string trail;
+   int beeps = 0;
+};
+
+TEST_CASE( "A state times out after its duration", "[fhsm][timeout]" ) {
+   TimingWheel<> wheel;
+   Kettle kettle(wheel);
+   CHECK(0 == wheel.Pending());
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON);
+   CHECK(2 == kettle.m_hsm.ArmedTimeouts()); // ON and HEATING
+   wheel.AdvanceTo(49);
+   CHECK(KettleStates::HEATING == kettle.m_hsm.CurrentState());
+   wheel.AdvanceTo(50);
+   CHECK(KettleStates::KEEPING_WARM == kettle.m_hsm.CurrentState());
+   CHECK(2 == kettle.m_hsm.ArmedTimeouts()); // ON and KEEPING_WARM
+   wheel.AdvanceTo(60);
+   CHECK(1 == kettle.beeps);
+   CHECK(1 == kettle.m_hsm.ArmedTimeouts()); // it times out once per entry
+   wheel.AdvanceTo(999);
+   CHECK(KettleStates::KEEPING_WARM == kettle.m_hsm.CurrentState());
+   wheel.AdvanceTo(1000);
+   CHECK(KettleStates::OFF == kettle.m_hsm.CurrentState());
+   CHECK(0 == wheel.Pending());
+   wheel.AdvanceTo(5000);
+   CHECK(1 == kettle.beeps);
+   CHECK("OHKO" == kettle.trail);
+}
+
+TEST_CASE( "Leaving a state cancels its timeout", "[fhsm][timeout]" ) {
+   TimingWheel<> wheel;
+   Kettle kettle(wheel);
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON);
+   wheel.AdvanceTo(10);
+   kettle.m_hsm.Signal(KettleSignals::LIFT); // HEATING will not get DONE
+   wheel.AdvanceTo(19);
+   CHECK(0 == kettle.beeps);
+   wheel.AdvanceTo(20);
+   CHECK(1 == kettle.beeps); // 10 ticks after KEEPING_WARM was entered
+   wheel.AdvanceTo(1000);    // ON was not left, so its timeout still counts from 0
+   CHECK("OHKO" == kettle.trail);
+
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON); // entered again: armed again
+   CHECK(2 == wheel.Pending());
+   wheel.AdvanceBy(1000);
+   CHECK(2 == kettle.beeps);
+   CHECK("OHKOHKO" == kettle.trail);
+}
+
+TEST_CASE( "A timed machine keeps the signals its states defer", "[fhsm][timeout]" ) {
+   TimingWheel<> wheel;
+   Kettle kettle(wheel);
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON);
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON); // again once it is off
+   CHECK(1 == kettle.m_hsm.Deferred());
+   wheel.AdvanceTo(1000);
+   CHECK(0 == kettle.m_hsm.Deferred());
+   CHECK(KettleStates::HEATING == kettle.m_hsm.CurrentState());
+   CHECK("OHKOH" == kettle.trail);
+   CHECK(2 == kettle.m_hsm.ArmedTimeouts());
+}
+
+TEST_CASE( "A timed machine remembers the history of its states", "[fhsm][timeout]" ) {
+   TimingWheel<> wheel;
+   Kettle kettle(wheel);
+   kettle.m_hsm.Signal(KettleSignals::SWITCH_ON);
+   kettle.m_hsm.Signal(KettleSignals::LIFT);
+   kettle.m_hsm.Signal(KettleSignals::SHUTDOWN);
+   CHECK(0 == wheel.Pending());
+   kettle.m_hsm.Signal(KettleSignals::RESUME);
+   CHECK(KettleStates::KEEPING_WARM == kettle.m_hsm.CurrentState());
+   CHECK(2 == kettle.m_hsm.ArmedTimeouts()); // the restored state is armed too
+   CHECK("OHKOK" == kettle.trail);
+}
+
+TEST_CASE( "A machine needs a timer for every nested timeout", "[fhsm][timeout]" ) {
+   class Flask : public Kettle {
+   public:
+      Flask(TimingWheel<>& wheel) : Kettle(wheel), m_small(*this, Shared(), wheel) {}
+      Machine<1> m_small;
+   };
+   TimingWheel<> wheel;
+   Flask flask(wheel);
+   CHECK(2 == Kettle::Shared().MaxNestedTimeouts());
+   CHECK_THROWS_AS(flask.m_small.Start(), Kettle::Machine<1>::TooManyTimeoutsException);
+}
+
+TEST_CASE( "Many idle machines share one wheel", "[fhsm][timeout]" ) {
+   TimingWheel<> wheel;
+   VirtualClock clock;
+   const size_t KETTLES = 10000;
+   std::vector<std::unique_ptr<Kettle>> kettles;
+   for (size_t k=0; k<KETTLES; k++) {
+      kettles.emplace_back(new Kettle(wheel));
+      kettles.back()->m_hsm.Signal(KettleSignals::SWITCH_ON);
+      clock.Advance(1);
+      wheel.Poll(clock);
+   }
+   // Kettle k was switched on at k and shut down at k + 1000.
+   size_t off = 0;
+   for (auto& kettle : kettles) {
+      off += (KettleStates::OFF == kettle->m_hsm.CurrentState()) ? 1 : 0;
+   }
+   CHECK(KETTLES - 999 == off);
+   clock.Advance(1000);
+   wheel.Poll(clock);
+   for (auto& kettle : kettles) {
+      REQUIRE(KettleStates::OFF == kettle->m_hsm.CurrentState());
+      REQUIRE(1 == kettle->beeps);
+   }
+   CHECK(0 == wheel.Pending());
+}
+
+namespace {
+
+class Probe : public TimerEntry {
+public:
+   explicit Probe(std::vector<std::uint64_t>& fired, const TimingWheel<2>& wheel) : m_fired(fired), m_wheel(wheel) {}
+   std::uint64_t firedAt = 0;
+protected:
+   void Expire() override {
+      firedAt = m_wheel.Now();
+      m_fired.push_back(firedAt);
+   }
+private:
+   std::vector<std::uint64_t>& m_fired;
+   const TimingWheel<2>& m_wheel;
+};
+
+} // namespace
+
+TEST_CASE( "Timers expire exactly at their deadlines, however far out", "[fhsm][timeout]" ) {
+   TimingWheel<2> wheel; // a span of 4096 ticks, so many timers are cascaded more than once
+   REQUIRE(4096 == TimingWheel<2>::SPAN);
+   std::vector<std::uint64_t> fired;
+   std::vector<std::unique_ptr<Probe>> probes;
+   std::uint32_t random = 12345;
+   auto next = [&random](std::uint32_t range) {
+      random = random * 1103515245u + 12345u;
+      return (random >> 8) % range;
+   };
+   for (int i=0; i<2000; i++) {
+      probes.emplace_back(new Probe(fired, wheel));
+      wheel.Arm(*probes.back(), 1 + next(20000));
+   }
+   for (int i=0; i<500; i+=3) {
+      wheel.Cancel(*probes[i]);
+   }
+   CHECK(2000 - 167 == wheel.Pending());
+   while (wheel.Pending()) {
+      wheel.AdvanceBy(next(700));
+   }
+   CHECK(2000 - 167 == fired.size());
+   for (size_t i=1; i<fired.size(); i++) {
+      REQUIRE(fired[i - 1] <= fired[i]);
+   }
+   for (size_t i=0; i<probes.size(); i++) {
+      if (i < 500 && i % 3 == 0) {
+         REQUIRE(0 == probes[i]->firedAt);
+      } else {
+         REQUIRE(probes[i]->Deadline() == probes[i]->firedAt);
+      }
+   }
+}
+
+TEST_CASE( "A wheel advanced at once expires the timers of every level in order", "[fhsm][timeout]" ) {
+   TimingWheel<2> wheel;
+   std::vector<std::uint64_t> fired;
+   Probe soon(fired, wheel), later(fired, wheel), wrapped(fired, wheel), far(fired, wheel);
+   wheel.AdvanceTo(40);
+   wheel.Arm(soon, 3);     // level 0, ahead in the same round of slots
+   wheel.Arm(wrapped, 30); // level 0, in a slot before the current one
+   wheel.Arm(later, 100);  // level 1
+   wheel.Arm(far, 5000);   // out of range, cascaded again
+   wheel.AdvanceTo(10000);
+   const std::vector<std::uint64_t> expected{ 43, 70, 140, 5040 };
+   CHECK(expected == fired);
+   CHECK(10000 == wheel.Now());
+}
@@ -0,0 +1,249 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "kv/fhsm/StateMachine.h"
+#include "kv/fhsm/Trace.h"
+#include "kv/fhsm/TraceDecoder.h"
+
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace kv::fhsm;
+
+enum class ValveStates  { CLOSED, OPEN, FULL };
+enum class ValveSignals { OPEN, CLOSE, PING, FLUSH, WIDEN, RESUME };
+
+// Opens only when allowed; PING is handled while open and ignored while
+// closed, FLUSH is kept while closed, and RESUME reopens it as it was
+// (and is consumed, doing nothing, while open).
+class Valve {
+public:
+   using Machine = BasicStateMachine<TracingInstrumentation, Valve, ValveStates, ValveStates::CLOSED, ValveStates::FULL, ValveSignals>;
+   Valve(TraceSink& trace, std::uint32_t id) : m_hsm(*this) {
+      m_hsm.GetInstrumentation().Attach(trace, id);
+      m_hsm.DefineState(ValveStates::CLOSED)
+         .SetNoParent()
+         .ForSignal(ValveSignals::OPEN).Do(&Valve::Echo)
+         .ForSignal(ValveSignals::OPEN).GoToIf(ValveStates::OPEN, &Valve::IsAllowed)
+         .ForSignal(ValveSignals::FLUSH).Defer()
+         .ForSignal(ValveSignals::RESUME).GoToDeepHistory(ValveStates::OPEN);
+      m_hsm.DefineState(ValveStates::OPEN)
+         .SetNoParent()
+         .ForSignal(ValveSignals::PING).Do(&Valve::Pong)
+         .ForSignal(ValveSignals::FLUSH).Do(&Valve::Pong)
+         .ForSignal(ValveSignals::RESUME).Do(nullptr)
+         .ForSignal(ValveSignals::WIDEN).GoTo(ValveStates::FULL)
+         .ForSignal(ValveSignals::CLOSE).GoTo(ValveStates::CLOSED);
+      m_hsm.DefineState(ValveStates::FULL)
+         .SetParent(ValveStates::OPEN);
+      m_hsm.ConcludeSetupAndSetInitialState(ValveStates::CLOSED);
+   }
+   bool IsAllowed() const { return allowed; }
+   void Pong() {}
+   void Echo() {
+      if (echo) {
+         echo->m_hsm.Signal(ValveSignals::PING);
+         echo->m_hsm.Signal(ValveSignals::PING);
+      }
+   }
+
+   Machine m_hsm;
+   bool allowed = false;
+   Valve* echo = nullptr;
+};
+
+namespace {
+
+TraceDecoder NamedDecoder() {
+   TraceDecoder decoder;
+   decoder.NameState(0, "CLOSED").NameState(1, "OPEN").NameState(2, "FULL")
+      .NameSignal(0, "OPEN").NameSignal(1, "CLOSE").NameSignal(2, "PING")
+      .NameSignal(3, "FLUSH").NameSignal(4, "WIDEN").NameSignal(5, "RESUME");
+   return decoder;
+}
+
+std::vector<TraceRecord> RoundTrip(const TraceSink& trace) {
+   std::stringstream dump;
+   trace.Dump(dump);
+   return TraceDecoder::Read(dump);
+}
+
+} // namespace
+
+TEST_CASE( "Every start and signal leaves a record", "[fhsm][trace]" ) {
+   TraceBuffer<64> trace;
+   Valve valve(trace, 7);
+   valve.m_hsm.Signal(ValveSignals::PING);  // ignored
+   valve.m_hsm.Signal(ValveSignals::OPEN);  // blocked by the guard
+   valve.allowed = true;
+   valve.m_hsm.Signal(ValveSignals::OPEN);
+   valve.m_hsm.Signal(ValveSignals::PING);
+
+   const auto records = RoundTrip(trace);
+   REQUIRE(5 == records.size());
+   const TraceKind kinds[] = { TraceKind::START, TraceKind::UNHANDLED, TraceKind::BLOCKED, TraceKind::TRANSITION, TraceKind::ACTION };
+   for (size_t i=0; i<records.size(); i++) {
+      CHECK(kinds[i] == records[i].kind);
+      CHECK(7 == records[i].machine);
+      if (i > 0) {
+         CHECK(records[i - 1].time <= records[i].time);
+      }
+   }
+   CHECK(0 == records[3].source);
+   CHECK(1 == records[3].destination);
+
+   std::ostringstream text;
+   NamedDecoder().WriteText(text, records);
+   CHECK(text.str().find("#7  start in CLOSED\n") != std::string::npos);
+   CHECK(text.str().find("CLOSED ignores PING\n") != std::string::npos);
+   CHECK(text.str().find("CLOSED --OPEN--| OPEN (guard)\n") != std::string::npos);
+   CHECK(text.str().find("CLOSED --OPEN--> OPEN\n") != std::string::npos);
+   CHECK(text.str().find("OPEN handles PING\n") != std::string::npos);
+}
+
+TEST_CASE( "Deferrals and history transitions are recorded as what they did", "[fhsm][trace]" ) {
+   TraceBuffer<64> trace;
+   Valve valve(trace, 7);
+   valve.allowed = true;
+   valve.m_hsm.Signal(ValveSignals::FLUSH);  // kept while closed
+   valve.m_hsm.Signal(ValveSignals::OPEN);   // and handled once open
+   valve.m_hsm.Signal(ValveSignals::WIDEN);
+   valve.m_hsm.Signal(ValveSignals::CLOSE);
+   valve.m_hsm.Signal(ValveSignals::RESUME); // back into FULL
+
+   const auto records = RoundTrip(trace);
+   REQUIRE(7 == records.size());
+   const TraceKind kinds[] = { TraceKind::START, TraceKind::DEFERRED, TraceKind::TRANSITION, TraceKind::ACTION,
+                               TraceKind::TRANSITION, TraceKind::TRANSITION, TraceKind::TRANSITION };
+   for (size_t i=0; i<records.size(); i++) {
+      CHECK(kinds[i] == records[i].kind);
+   }
+   CHECK(0 == records[6].source);
+   CHECK(2 == records[6].destination);
+
+   std::ostringstream text;
+   NamedDecoder().WriteText(text, records);
+   CHECK(text.str().find("CLOSED defers FLUSH\n") != std::string::npos);
+   CHECK(text.str().find("OPEN handles FLUSH\n") != std::string::npos);
+   CHECK(text.str().find("CLOSED --RESUME--> FULL\n") != std::string::npos);
+}
+
+TEST_CASE( "A signal consumed by an empty action is not recorded as deferred", "[fhsm][trace]" ) {
+   TraceBuffer<64> trace;
+   Valve valve(trace, 7);
+   valve.allowed = true;
+   valve.m_hsm.Signal(ValveSignals::OPEN);
+   valve.m_hsm.Signal(ValveSignals::RESUME);
+
+   const auto records = RoundTrip(trace);
+   REQUIRE(3 == records.size());
+   CHECK(TraceKind::ACTION == records[2].kind);
+   CHECK(1 == records[2].source);
+   CHECK(0 == valve.m_hsm.Deferred());
+}
+
+TEST_CASE( "A record is written whole, after the handlers that signal other machines", "[fhsm][trace]" ) {
+   TraceBuffer<2> trace;
+   Valve one(trace, 1);
+   Valve two(trace, 2);
+   one.echo = &two;
+   one.allowed = true;
+   one.m_hsm.Signal(ValveSignals::OPEN); // its action has two trace twice
+
+   const auto records = RoundTrip(trace);
+   REQUIRE(2 == records.size());
+   CHECK(2 == records[0].machine);
+   CHECK(TraceKind::UNHANDLED == records[0].kind);
+   CHECK(1 == records[1].machine);
+   CHECK(TraceKind::TRANSITION == records[1].kind);
+   CHECK(0 == records[1].source);
+   CHECK(1 == records[1].destination);
+}
+
+TEST_CASE( "The Chrome trace has a span per stay in a state", "[fhsm][trace]" ) {
+   TraceBuffer<64> trace;
+   Valve one(trace, 1);
+   Valve two(trace, 2);
+   one.allowed = true;
+   one.m_hsm.Signal(ValveSignals::OPEN);
+   one.m_hsm.Signal(ValveSignals::CLOSE);
+
+   std::ostringstream json;
+   NamedDecoder().WriteChromeTrace(json, RoundTrip(trace));
+   const auto out = json.str();
+   auto count = [&out](const std::string& what) {
+      size_t n = 0;
+      for (auto at = out.find(what); at != std::string::npos; at = out.find(what, at + 1)) {
+         ++n;
+      }
+      return n;
+   };
+   CHECK(0 == out.find("{\"traceEvents\":["));
+   CHECK(4 == count("\"ph\":\"X\""));   // one: CLOSED, OPEN, CLOSED; two: CLOSED
+   CHECK(2 == count("\"ph\":\"i\""));
+   CHECK(3 == count("\"name\":\"CLOSED\",\"cat\":\"state\""));
+   CHECK(1 == count("\"tid\":2,"));
+}
+
+TEST_CASE( "Names are escaped in the Chrome trace", "[fhsm][trace]" ) {
+   TraceBuffer<64> trace;
+   Valve valve(trace, 1);
+   valve.m_hsm.Signal(ValveSignals::PING);
+
+   TraceDecoder decoder;
+   decoder.NameState(0, "\"SHUT\"\\").NameSignal(2, "PING\n");
+   std::ostringstream json;
+   decoder.WriteChromeTrace(json, RoundTrip(trace));
+   CHECK(json.str().find("\"name\":\"\\\"SHUT\\\"\\\\\",") != std::string::npos);
+   CHECK(json.str().find("\"name\":\"PING\\u000a\",") != std::string::npos);
+}
+
+TEST_CASE( "A dump holds no stale bytes between the fields of a record", "[fhsm][trace]" ) {
+   TraceBuffer<4> trace;
+   for (int i=0; i<4; i++) {
+      std::memset(&trace.Claim(), 0xa5, sizeof(TraceRecord));
+   }
+   trace.Clear();
+   Valve valve(trace, 0);
+   valve.m_hsm.Signal(ValveSignals::PING);
+
+   std::ostringstream dump;
+   trace.Dump(dump);
+   const auto bytes = dump.str();
+   const size_t header = TraceSink::MAGIC_SIZE + 2 * sizeof(std::uint32_t);
+   REQUIRE(header + 2 * sizeof(TraceRecord) == bytes.size());
+   for (size_t at=header; at<bytes.size(); at+=sizeof(TraceRecord)) {
+      for (size_t i=offsetof(TraceRecord, kind) + 1; i<sizeof(TraceRecord); i++) {
+         CHECK(0 == bytes[at + i]);
+      }
+   }
+}
+
+TEST_CASE( "A full trace keeps the newest records", "[fhsm][trace]" ) {
+   TraceBuffer<4> trace;
+   Valve valve(trace, 0);
+   for (int i=0; i<10; i++) {
+      valve.m_hsm.Signal(ValveSignals::PING);
+   }
+   CHECK(11 == trace.Written());
+   const auto records = RoundTrip(trace);
+   REQUIRE(4 == records.size());
+   for (auto& r : records) {
+      CHECK(TraceKind::UNHANDLED == r.kind);
+   }
+}
+
+TEST_CASE( "A detached tracer records nothing", "[fhsm][trace]" ) {
+   TraceBuffer<4> trace;
+   Valve valve(trace, 0);
+   valve.m_hsm.GetInstrumentation().Attach(nullptr, 0);
+   valve.m_hsm.Signal(ValveSignals::PING);
+   CHECK(1 == trace.Written()); // the start
+}
+
+TEST_CASE( "Something else is not read as a trace", "[fhsm][trace]" ) {
+   std::istringstream garbage("FHSMTRC0 and then some");
+   CHECK_THROWS_AS(TraceDecoder::Read(garbage), TraceDecoder::FormatException);
+}